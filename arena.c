@@ -0,0 +1,252 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: A bump allocator for memory that only lives for one command line
+ *      (the tokens, the expanded words and the argument vector). Memory is carved
+ *      out of large chunks; resetting the arena rewinds it without freeing, so once
+ *      the chunks are big enough a command line causes no heap traffic at all.
+ *      The counters in the arena make that verifiable
+ * ********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wish.h"
+
+// Size of a chunk, unless a single allocation needs more
+#define CHUNK_SIZE 16384
+
+// Every allocation is aligned for any type
+#define ARENA_ALIGN 16
+
+
+/********************
+ * arenaInit
+ * Description: Prepares an empty arena. No memory is allocated until it is used
+ * -----
+ * Input: arena - the arena to initialize
+ * Output: NA
+ * ******************/
+
+void arenaInit(struct arena *arena)
+{
+    memset(arena, 0, sizeof(struct arena));
+}
+
+
+/********************
+ * newChunk
+ * Description: Allocates a chunk from the heap and links it after the current chunk
+ * -----
+ * Input: arena - the arena that needs more room
+ *        size - the minimum usable size of the chunk
+ * Output: Returns the new chunk
+ * ******************/
+
+static struct arenaChunk *newChunk(struct arena *arena, size_t size)
+{
+    if(size < CHUNK_SIZE)
+        size = CHUNK_SIZE;
+
+    struct arenaChunk *chunk = malloc(sizeof(struct arenaChunk) + size);
+    if(chunk == 0)
+    {
+        perror("Error allocating memory");
+        exit(1);
+    }
+    arena->heapAllocs++;
+
+    chunk->size = size;
+    chunk->used = 0;
+
+    // Insert after the current chunk, so chunks kept from earlier lines are still reused
+    if(arena->current == 0)
+    {
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    else
+    {
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    }
+
+    return chunk;
+}
+
+
+/********************
+ * arenaAlloc
+ * Description: Allocates memory from the arena
+ * -----
+ * Input: arena - the arena to allocate from
+ *        size - the number of bytes needed
+ * Output: Returns a pointer to the memory. It stays valid until the arena is reset
+ * ******************/
+
+void *arenaAlloc(struct arena *arena, size_t size)
+{
+    struct arenaChunk *chunk;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    arena->allocs++;
+
+    // Move through the chunks kept from earlier lines until one has room
+    chunk = arena->current ? arena->current : arena->head;
+    while(chunk != 0 && chunk->used + size > chunk->size && chunk->next != 0)
+        chunk = chunk->next;
+    arena->current = chunk;
+
+    // None of them has room, get a new chunk from the heap
+    if(chunk == 0 || chunk->used + size > chunk->size)
+        chunk = arena->current = newChunk(arena, size);
+
+    void *result = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = result;
+
+    return result;
+}
+
+
+/********************
+ * arenaRealloc
+ * Description: Grows an allocation. The most recent allocation grows in place when its chunk
+ *      has room, otherwise the contents are copied to a new allocation
+ * -----
+ * Input: arena - the arena the memory belongs to
+ *        ptr - the memory to grow (may be NULL)
+ *        oldSize - its current size in bytes
+ *        newSize - the size needed
+ * Output: Returns the grown memory
+ * ******************/
+
+void *arenaRealloc(struct arena *arena, void *ptr, size_t oldSize, size_t newSize)
+{
+    struct arenaChunk *chunk = arena->current;
+
+    if(ptr != 0 && ptr == arena->last)
+    {
+        size_t offset = (char *)ptr - chunk->data;
+        size_t size = (newSize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+        if(offset + size <= chunk->size)
+        {
+            chunk->used = offset + size;
+            return ptr;
+        }
+    }
+
+    void *result = arenaAlloc(arena, newSize);
+    if(ptr != 0)
+        memcpy(result, ptr, oldSize);
+
+    return result;
+}
+
+
+/********************
+ * arenaStrndup
+ * Description: Copies a string into the arena
+ * -----
+ * Input: arena - the arena to allocate from
+ *        str - the characters to copy
+ *        len - the number of characters
+ * Output: Returns the null terminated copy
+ * ******************/
+
+char *arenaStrndup(struct arena *arena, const char *str, size_t len)
+{
+    char *copy = arenaAlloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+
+/********************
+ * arenaMark
+ * Description: Remembers how much of the arena is in use, so a loop can release what one of
+ *      its iterations allocated without releasing what was there before it (see ast.c)
+ * -----
+ * Input: arena - the arena
+ *        mark - set to the current position
+ * Output: NA
+ * ******************/
+
+void arenaMark(struct arena *arena, struct arenaMark *mark)
+{
+    mark->chunk = arena->current;
+    mark->used = arena->current ? arena->current->used : 0;
+}
+
+
+/********************
+ * arenaRewind
+ * Description: Releases everything allocated since a mark. The chunks are kept
+ * -----
+ * Input: arena - the arena
+ *        mark - a position taken with arenaMark since the last reset
+ * Output: NA - the memory allocated after the mark is invalid
+ * ******************/
+
+void arenaRewind(struct arena *arena, struct arenaMark *mark)
+{
+    struct arenaChunk *chunk = mark->chunk ? mark->chunk->next : arena->head;
+
+    // Chunks after the marked one were empty when the mark was taken
+    for(; chunk != 0; chunk = chunk->next)
+        chunk->used = 0;
+
+    if(mark->chunk != 0)
+        mark->chunk->used = mark->used;
+
+    arena->current = mark->chunk ? mark->chunk : arena->head;
+    arena->last = 0;
+}
+
+
+/********************
+ * arenaReset
+ * Description: Releases everything allocated from the arena at once. The chunks are kept
+ * -----
+ * Input: arena - the arena to reset
+ * Output: NA - all memory handed out by the arena is invalid
+ * ******************/
+
+void arenaReset(struct arena *arena)
+{
+    struct arenaChunk *chunk;
+    for(chunk = arena->head; chunk != 0; chunk = chunk->next)
+        chunk->used = 0;
+
+    arena->current = arena->head;
+    arena->last = 0;
+}
+
+
+/********************
+ * arenaFree
+ * Description: Returns every chunk of the arena to the heap
+ * -----
+ * Input: arena - the arena to free
+ * Output: NA - the arena is empty and may be used again
+ * ******************/
+
+void arenaFree(struct arena *arena)
+{
+    struct arenaChunk *chunk = arena->head;
+    while(chunk != 0)
+    {
+        struct arenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arenaInit(arena);
+}
@@ -0,0 +1,893 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Control flow. A line that starts an if, while, until or for is compiled,
+ *      together with the lines that follow until the construct is complete, into a tree of
+ *      command lists held in the line arena:
+ *
+ *          if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+ *          while LIST; do LIST; done
+ *          until LIST; do LIST; done
+ *          for NAME in WORDS; do LIST; done
+ *
+ *      Newlines may replace the ; separators. The tree is then run as many times as the loops
+ *      need without reading or parsing anything again. Compiling a command also counts the
+ *      words that need expansion (a command without any is run as it is) and looks its
+ *      builtin up when the name is literal. Each iteration of a loop rewinds the arena to
+ *      where it started, so a loop runs in constant memory. The variable of a for is set in
+ *      the environment, where $NAME finds it. Ctrl-c stops every loop of the line.
+ *      A compound may be followed by redirections, be a stage of a pipeline or run in the
+ *      background, as in `for ...; done > file`, `while ...; done | head` or `...; done &`:
+ *      it then runs in a forked copy of the shell (see exec.c)
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "wish.h"
+
+// How many loop iterations may run before pending signals are read, for loops of builtins only
+#define INTERRUPT_POLL 64
+
+// The reserved words, only recognized at the start of a command
+static const char *RESERVED[] = {"if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done", 0};
+
+// The stop words that end each list of a compound
+static const char *STOP_THEN[] = {"then", 0};
+static const char *STOP_DO[] = {"do", 0};
+static const char *STOP_DONE[] = {"done", 0};
+static const char *STOP_FI[] = {"fi", 0};
+static const char *STOP_BRANCH[] = {"elif", "else", "fi", 0};
+static const char *STOP_NONE[] = {0};
+
+// The lines of a compound being compiled, read one at a time
+struct compiler
+{
+    struct arena *arena;
+    char **words;       // the current line
+    int numWords;
+    int pos;            // the next word
+    int nested;         // compounds open, newlines separate commands while there is one
+    int eof;            // 1 once the input ended
+};
+
+// Set once ctrl-c stops the loops, until the outermost compound returns
+static int stopping = 0;
+static int depth = 0;
+static unsigned long iterations = 0;
+
+
+/********************
+ * isWord
+ * Description: Tells if a word is one of a list
+ * -----
+ * Input: word - the word, with its quotes
+ *        list - NULL terminated list of words
+ * Output: Returns 1 if the word is in the list, otherwise 0
+ * ******************/
+
+static int isWord(const char *word, const char **list)
+{
+    int i;
+    for(i = 0; list[i] != 0; i++)
+    {
+        if(strcmp(word, list[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * startsCompound
+ * Description: Tells if a word at the start of a command begins a compound
+ * -----
+ * Input: word - the word
+ * Output: Returns 1 for if, while, until and for, otherwise 0
+ * ******************/
+
+static int startsCompound(const char *word)
+{
+    return strcmp(word, "if") == 0 || strcmp(word, "while") == 0 || strcmp(word, "until") == 0 ||
+        strcmp(word, "for") == 0;
+}
+
+
+/********************
+ * needsCompiler
+ * Description: Tells if a line holds a reserved word at the start of a command, so parseList
+ *      is not enough for it. The other lines never come here
+ * -----
+ * Input: words - the words of the line
+ *        numWords - the number of words
+ * Output: Returns 1 if the line must be compiled, otherwise 0
+ * ******************/
+
+int needsCompiler(char **words, int numWords)
+{
+    int i;
+
+    for(i = 0; i < numWords; i++)
+    {
+        if(i > 0 && !listOperator(words[i - 1]) && strcmp(words[i - 1], "|") != 0)
+            continue;
+
+        if(isWord(words[i], RESERVED))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * syntaxError
+ * Description: Reports a word that does not fit where it was found
+ * -----
+ * Input: c - the compiler
+ *        token - the word, or NULL at the end of a line
+ * Output: Returns -1
+ * ******************/
+
+static int syntaxError(struct compiler *c, const char *token)
+{
+    if(token == 0 && c->eof)
+        printf("syntax error: unexpected end of file\n");
+    else
+        printf("syntax error near unexpected token `%s'\n", token ? token : "newline");
+    fflush(stdout);
+
+    return -1;
+}
+
+
+/********************
+ * peek
+ * Description: Gives the next word without moving past it
+ * -----
+ * Input: c - the compiler
+ * Output: Returns the word, or NULL at the end of the line
+ * ******************/
+
+static char *peek(struct compiler *c)
+{
+    return c->pos < c->numWords ? c->words[c->pos] : 0;
+}
+
+
+/********************
+ * nextLine
+ * Description: Reads the next line of a compound that is not complete. Empty lines and
+ *      comments are skipped
+ * -----
+ * Input: c - the compiler
+ * Output: Returns 1 if a line was read, 0 at the end of the input
+ * ******************/
+
+static int nextLine(struct compiler *c)
+{
+    char **words;
+    int numWords;
+
+    do
+    {
+        words = getContinuationLine(c->arena, &numWords);
+        if(words == 0)
+        {
+            c->eof = 1;
+            c->numWords = c->pos = 0;
+            return 0;
+        }
+    }
+    while(words[0] == 0 || words[0][0] == '#');
+
+    c->words = words;
+    c->numWords = numWords;
+    c->pos = 0;
+
+    return 1;
+}
+
+
+/********************
+ * skipNewlines
+ * Description: Moves to the next word, reading more lines if needed
+ * -----
+ * Input: c - the compiler
+ * Output: Returns the word, or NULL at the end of the input
+ * ******************/
+
+static char *skipNewlines(struct compiler *c)
+{
+    while(peek(c) == 0)
+    {
+        if(!nextLine(c))
+            return 0;
+    }
+
+    return peek(c);
+}
+
+
+/********************
+ * compileCommand
+ * Description: Prepares a command to run many times: counts the words that need expansion
+ *      and looks up the builtin when the command name is literal
+ * -----
+ * Input: cmd - the parsed command
+ * Output: NA
+ * ******************/
+
+static void compileCommand(struct command *cmd)
+{
+    int i;
+
+    cmd->numSlots = 0;
+    for(i = 0; i < cmd->numWords; i++)
+    {
+        if(!wordIsLiteral(cmd->words[i]))
+            cmd->numSlots++;
+    }
+
+    // A literal name is the same every time, enable -n is checked when it runs
+    if(cmd->numWords > 0 && wordIsLiteral(cmd->words[0]))
+        cmd->builtin = lookupBuiltin(cmd->words[0]);
+}
+
+
+static int compileCompound(struct compiler *c, struct pipeline *pipeline);
+
+
+/********************
+ * compileStage
+ * Description: Compiles one command of a pipeline. A simple command goes up to the | or the
+ *      operator after it, which is cut from the line. A compound is followed by its
+ *      redirections only, which are copied: the line goes on after them
+ * -----
+ * Input: c - the compiler, at the first word of the command
+ *        cmd - the command to fill in
+ *        next - set to the word after the command, or NULL at the end of the line
+ * Output: Returns -1 if the command is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compileStage(struct compiler *c, struct command *cmd, char **next)
+{
+    int i, start = c->pos;
+    char *word = peek(c);
+
+    if(word != 0 && startsCompound(word))
+    {
+        struct pipeline holder;
+        if(compileCompound(c, &holder) == -1)
+            return -1;
+
+        start = c->pos;
+        while(peek(c) != 0 && redirectOperator(peek(c)) != 0)
+            c->pos += c->pos + 1 < c->numWords ? 2 : 1;
+        *next = peek(c);
+
+        cmd->numWords = c->pos - start;
+        cmd->words = arenaAlloc(c->arena, sizeof(char *) * (cmd->numWords + 1));
+        memcpy(cmd->words, c->words + start, sizeof(char *) * cmd->numWords);
+        cmd->words[cmd->numWords] = 0;
+        if(parseCommand(cmd) == -1)
+            return -1;
+
+        cmd->compound = holder.compound;
+        cmd->builtin = -1;
+        cmd->numSlots = 0;
+        return 0;
+    }
+
+    // then, do, done... can not start a command
+    if(word != 0 && isWord(word, RESERVED))
+        return syntaxError(c, word);
+
+    for(i = start; i < c->numWords && !listOperator(c->words[i]) && strcmp(c->words[i], "|") != 0; i++)
+        ;
+    *next = i < c->numWords ? c->words[i] : 0;
+    c->words[i] = 0;
+    c->pos = i;
+
+    cmd->words = c->words + start;
+    cmd->numWords = i - start;
+    if(parseCommand(cmd) == -1)
+        return -1;
+
+    compileCommand(cmd);
+    return 0;
+}
+
+
+/********************
+ * compilePipeline
+ * Description: Compiles a pipeline up to the operator that ends it, the end of the line or
+ *      a stop word. Its commands may be compounds, which then run in a copy of the shell
+ *      (see exec.c); a compound alone, not redirected nor in the background, runs in the
+ *      shell itself
+ * -----
+ * Input: c - the compiler, at the first word of the pipeline
+ *        pipeline - the pipeline to fill in
+ *        stops - the words that may end the list the pipeline is in, left to the caller
+ *        op - set to the operator after the pipeline (consumed), or NULL
+ * Output: Returns -1 if the pipeline is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compilePipeline(struct compiler *c, struct pipeline *pipeline, const char **stops, char **op)
+{
+    int capacity = 0;
+    char *next;
+
+    memset(pipeline, 0, sizeof(struct pipeline));
+
+    // `time` before the pipeline measures it as a whole, like parsePipeline
+    if(peek(c) != 0 && strcmp(peek(c), "time") == 0)
+    {
+        pipeline->timed = 1;
+        c->pos++;
+    }
+
+    while(1)
+    {
+        if(pipeline->numCommands == capacity)
+        {
+            pipeline->commands = arenaRealloc(c->arena, pipeline->commands, sizeof(struct command) * capacity,
+                sizeof(struct command) * (capacity * 2 + 2));
+            capacity = capacity * 2 + 2;
+        }
+
+        struct command *cmd = &pipeline->commands[pipeline->numCommands++];
+        if(compileStage(c, cmd, &next) == -1)
+            return -1;
+
+        int piped = next != 0 && strcmp(next, "|") == 0;
+
+        // Every command of a pipeline needs words, a lone one may be only redirections
+        if(cmd->compound == 0 && cmd->numWords == 0 && cmd->numRedirects == 0 &&
+            (piped || pipeline->numCommands > 1))
+            return syntaxError(c, "|");
+
+        if(!piped)
+            break;
+        c->pos++;
+    }
+
+    // The operator that ends the pipeline, a stop word is left to the list
+    if(next != 0 && listOperator(next))
+    {
+        c->pos++;
+
+        // In foreground-only mode & is ignored
+        if(strcmp(next, "&") == 0 && TSTP_FLAG != 1)
+            pipeline->background = 1;
+    }
+    else if(next != 0 && !isWord(next, stops))
+        return syntaxError(c, next);
+    else
+        next = 0;
+    *op = next;
+
+    // A compound alone runs in the shell, where for and cd keep their effect
+    struct command *first = &pipeline->commands[0];
+    if(pipeline->numCommands == 1 && first->compound != 0 && first->numRedirects == 0 &&
+        !pipeline->background && !pipeline->timed)
+    {
+        pipeline->compound = first->compound;
+        pipeline->commands = 0;
+        pipeline->numCommands = 0;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * compileList
+ * Description: Compiles pipelines and compounds separated by ;, &, &&, || and newlines until
+ *      one of the stop words is found at the start of a command. Outside of any compound the
+ *      list ends with its line instead
+ * -----
+ * Input: c - the compiler
+ *        list - the list to fill in
+ *        stops - the words that end the list, left to the caller
+ * Output: Returns -1 if the list is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compileList(struct compiler *c, struct commandList *list, const char **stops)
+{
+    int capacity = 0, connector = LIST_ALWAYS;
+    char *op;
+
+    list->pipelines = 0;
+    list->numPipelines = 0;
+
+    while(1)
+    {
+        char *word = peek(c);
+
+        // A newline ends the list at the top, after && or || the command is on the next line
+        if(word == 0)
+        {
+            if(c->nested == 0 && connector == LIST_ALWAYS)
+                return 0;
+            if(!nextLine(c))
+                return connector == LIST_ALWAYS ? 0 : syntaxError(c, 0);
+            continue;
+        }
+
+        if(isWord(word, stops))
+            return connector == LIST_ALWAYS ? 0 : syntaxError(c, word);
+
+        if(listOperator(word) || (isWord(word, RESERVED) && !startsCompound(word)))
+            return syntaxError(c, word);
+
+        if(list->numPipelines == capacity)
+        {
+            list->pipelines = arenaRealloc(c->arena, list->pipelines, sizeof(struct pipeline) * capacity,
+                sizeof(struct pipeline) * (capacity * 2 + 4));
+            capacity = capacity * 2 + 4;
+        }
+
+        struct pipeline *pipeline = &list->pipelines[list->numPipelines++];
+        if(compilePipeline(c, pipeline, stops, &op) == -1)
+            return -1;
+
+        pipeline->connector = connector;
+
+        if(op != 0 && strcmp(op, "&&") == 0)
+            connector = LIST_AND;
+        else if(op != 0 && strcmp(op, "||") == 0)
+            connector = LIST_OR;
+        else
+            connector = LIST_ALWAYS;
+    }
+}
+
+
+/********************
+ * compileBody
+ * Description: Compiles a list that must hold at least one command and checks the word
+ *      that ends it
+ * -----
+ * Input: c - the compiler
+ *        list - the list to fill in
+ *        stops - the words that may end the list
+ * Output: Returns the stop word found (consumed), or NULL if the list is not valid
+ * ******************/
+
+static char *compileBody(struct compiler *c, struct commandList *list, const char **stops)
+{
+    if(compileList(c, list, stops) == -1)
+        return 0;
+
+    char *word = peek(c);
+    if(word == 0 || !isWord(word, stops) || list->numPipelines == 0)
+    {
+        syntaxError(c, word);
+        return 0;
+    }
+
+    c->pos++;
+    return word;
+}
+
+
+/********************
+ * compileIf
+ * Description: Compiles the rest of an if, from its condition to fi. An elif is compiled
+ *      as an if of its own that shares the fi
+ * -----
+ * Input: c - the compiler, after the if or elif
+ *        compound - the compound to fill in
+ * Output: Returns -1 if the if is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compileIf(struct compiler *c, struct compound *compound)
+{
+    compound->type = COMPOUND_IF;
+
+    if(compileBody(c, &compound->cond, STOP_THEN) == 0)
+        return -1;
+
+    char *word = compileBody(c, &compound->body, STOP_BRANCH);
+    if(word == 0)
+        return -1;
+
+    if(strcmp(word, "elif") == 0)
+    {
+        struct pipeline *pipeline = arenaAlloc(c->arena, sizeof(struct pipeline));
+        memset(pipeline, 0, sizeof(struct pipeline));
+        pipeline->compound = arenaAlloc(c->arena, sizeof(struct compound));
+        memset(pipeline->compound, 0, sizeof(struct compound));
+
+        compound->orElse.pipelines = pipeline;
+        compound->orElse.numPipelines = 1;
+
+        return compileIf(c, pipeline->compound);
+    }
+
+    if(strcmp(word, "else") == 0 && compileBody(c, &compound->orElse, STOP_FI) == 0)
+        return -1;
+
+    return 0;
+}
+
+
+/********************
+ * compileFor
+ * Description: Compiles the rest of a for: its variable, its words and its body
+ * -----
+ * Input: c - the compiler, after the for
+ *        compound - the compound to fill in
+ * Output: Returns -1 if the for is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compileFor(struct compiler *c, struct compound *compound)
+{
+    int i, start;
+    char *name = peek(c);
+
+    compound->type = COMPOUND_FOR;
+
+    // The variable must be a plain name
+    if(name == 0)
+        return syntaxError(c, 0);
+    for(i = 0; name[i] != '\0'; i++)
+    {
+        if(!(name[i] == '_' || (name[i] >= 'a' && name[i] <= 'z') || (name[i] >= 'A' && name[i] <= 'Z') ||
+            (i > 0 && name[i] >= '0' && name[i] <= '9')))
+        {
+            printf("for: `%s': not a valid name\n", name);
+            fflush(stdout);
+            return -1;
+        }
+    }
+    compound->var = name;
+    c->pos++;
+
+    // The words, up to ; or the end of the line. Without in there are none
+    char *word = peek(c);
+    start = c->pos;
+    if(word != 0 && strcmp(word, "in") == 0)
+    {
+        start = ++c->pos;
+        while(peek(c) != 0 && !listOperator(peek(c)))
+            c->pos++;
+        word = peek(c);
+    }
+
+    compound->numWords = c->pos - start;
+    compound->words = arenaAlloc(c->arena, sizeof(char *) * (compound->numWords + 1));
+    memcpy(compound->words, c->words + start, sizeof(char *) * compound->numWords);
+    compound->words[compound->numWords] = 0;
+
+    if(word != 0 && strcmp(word, ";") == 0)
+        c->pos++;
+    else if(word != 0)
+        return syntaxError(c, word);
+
+    word = skipNewlines(c);
+    if(word == 0 || strcmp(word, "do") != 0)
+        return syntaxError(c, word);
+    c->pos++;
+
+    return compileBody(c, &compound->body, STOP_DONE) ? 0 : -1;
+}
+
+
+/********************
+ * compileCompound
+ * Description: Compiles an if, while, until or for, reading as many lines as it takes
+ * -----
+ * Input: c - the compiler, at the reserved word that starts the compound
+ *        pipeline - set to hold the compound
+ * Output: Returns -1 if the compound is not valid (a message is displayed), otherwise 0
+ * ******************/
+
+static int compileCompound(struct compiler *c, struct pipeline *pipeline)
+{
+    int result = 0;
+    char *word = c->words[c->pos++];
+
+    memset(pipeline, 0, sizeof(struct pipeline));
+    pipeline->compound = arenaAlloc(c->arena, sizeof(struct compound));
+    memset(pipeline->compound, 0, sizeof(struct compound));
+
+    c->nested++;
+
+    if(strcmp(word, "if") == 0)
+        result = compileIf(c, pipeline->compound);
+    else if(strcmp(word, "for") == 0)
+        result = compileFor(c, pipeline->compound);
+    else
+    {
+        pipeline->compound->type = strcmp(word, "while") == 0 ? COMPOUND_WHILE : COMPOUND_UNTIL;
+
+        if(compileBody(c, &pipeline->compound->cond, STOP_DO) == 0 ||
+            compileBody(c, &pipeline->compound->body, STOP_DONE) == 0)
+            result = -1;
+    }
+
+    c->nested--;
+
+    return result;
+}
+
+
+/********************
+ * compileLine
+ * Description: Compiles a command line holding compounds into a command list, reading the
+ *      next lines of the input while a compound is not complete
+ * -----
+ * Input: arena - the arena of the command line, which holds the compiled tree
+ *        words - the words of the first line. The list is changed in place
+ *        numWords - the number of words
+ *        list - the command list to fill in
+ * Output: Returns PARSE_OK if the list is ready to run, or PARSE_ERROR if it is not valid
+ *        (a message is displayed)
+ * ******************/
+
+int compileLine(struct arena *arena, char **words, int numWords, struct commandList *list)
+{
+    struct compiler c;
+
+    c.arena = arena;
+    c.words = words;
+    c.numWords = numWords;
+    c.pos = 0;
+    c.nested = 0;
+    c.eof = 0;
+
+    if(compileList(&c, list, STOP_NONE) == -1)
+        return PARSE_ERROR;
+
+    return PARSE_OK;
+}
+
+
+/********************
+ * interrupted
+ * Description: Tells if ctrl-c stopped the loops: a command was killed by SIGINT, or the
+ *      shell received it
+ * -----
+ * Input: poll - 1 to read the pending signals first (see events.c)
+ * Output: Returns 1 if the compounds must stop, otherwise 0
+ * ******************/
+
+static int interrupted(int poll)
+{
+    if(stopping)
+        return 1;
+
+    if(WIFSIGNALED(STATUS) && WTERMSIG(STATUS) == SIGINT)
+        stopping = 1;
+    else if(interruptPending(poll))
+    {
+        STATUS = W_EXITCODE(130, 0);
+        stopping = 1;
+    }
+
+    return stopping;
+}
+
+
+/********************
+ * copyPipeline
+ * Description: Copies a compiled pipeline before it runs, runPipeline expands the words of
+ *      its commands in place
+ * -----
+ * Input: arena - the arena of the command line
+ *        pipeline - the compiled pipeline
+ * Output: Returns the copy, ready to run
+ * ******************/
+
+static struct pipeline *copyPipeline(struct arena *arena, struct pipeline *pipeline)
+{
+    int i;
+    struct pipeline *copy = arenaAlloc(arena, sizeof(struct pipeline));
+
+    *copy = *pipeline;
+    copy->commands = arenaAlloc(arena, sizeof(struct command) * pipeline->numCommands);
+
+    for(i = 0; i < pipeline->numCommands; i++)
+    {
+        struct command *cmd = &copy->commands[i];
+
+        *cmd = pipeline->commands[i];
+        cmd->words = arenaAlloc(arena, sizeof(char *) * (cmd->numWords + 1));
+        memcpy(cmd->words, pipeline->commands[i].words, sizeof(char *) * (cmd->numWords + 1));
+    }
+
+    return copy;
+}
+
+
+/********************
+ * runBody
+ * Description: Runs a compiled command list, like runList does for a line. Stops at ctrl-c
+ * -----
+ * Input: arena - the arena of the command line
+ *        list - the compiled list
+ * Output: NA
+ * ******************/
+
+static void runBody(struct arena *arena, struct commandList *list)
+{
+    int i;
+
+    for(i = 0; i < list->numPipelines && !stopping; i++)
+    {
+        struct pipeline *pipeline = &list->pipelines[i];
+
+        if(pipeline->connector == LIST_AND && STATUS != 0)
+            continue;
+        if(pipeline->connector == LIST_OR && STATUS == 0)
+            continue;
+
+        if(pipeline->compound != 0)
+            runCompound(arena, pipeline->compound);
+        else
+        {
+            runPipeline(arena, copyPipeline(arena, pipeline));
+            interrupted(0);
+        }
+    }
+}
+
+
+/********************
+ * runLoop
+ * Description: Runs a while or an until. STATUS is the status of the last body, or 0 if the
+ *      body never ran
+ * -----
+ * Input: arena - the arena of the command line
+ *        compound - the compiled loop
+ * Output: NA
+ * ******************/
+
+static void runLoop(struct arena *arena, struct compound *compound)
+{
+    struct arenaMark mark;
+    int last = W_EXITCODE(0, 0);
+
+    arenaMark(arena, &mark);
+
+    while(1)
+    {
+        runBody(arena, &compound->cond);
+
+        // until runs while its condition fails
+        if(stopping || (STATUS == 0) != (compound->type == COMPOUND_WHILE))
+            break;
+
+        runBody(arena, &compound->body);
+        last = STATUS;
+
+        // What the iteration allocated is not needed by the next one
+        arenaRewind(arena, &mark);
+
+        if(interrupted(++iterations % INTERRUPT_POLL == 0))
+            break;
+    }
+
+    arenaRewind(arena, &mark);
+
+    if(!stopping)
+        STATUS = last;
+}
+
+
+/********************
+ * runFor
+ * Description: Runs a for. The words are expanded once, then the body runs with the variable
+ *      set to each of them. STATUS is the status of the last body, or 0 if there were no words
+ * -----
+ * Input: arena - the arena of the command line
+ *        compound - the compiled loop
+ * Output: NA
+ * ******************/
+
+static void runFor(struct arena *arena, struct compound *compound)
+{
+    int i;
+    struct arenaMark mark;
+    int last = W_EXITCODE(0, 0);
+    size_t nameLen = strlen(compound->var), cap = 0;
+    char *entry = 0;
+
+    char **values = arenaAlloc(arena, sizeof(char *) * (compound->numWords + 1));
+    memcpy(values, compound->words, sizeof(char *) * (compound->numWords + 1));
+    int numValues = expandWords(arena, values, compound->numWords);
+
+    arenaMark(arena, &mark);
+
+    for(i = 0; i < numValues; i++)
+    {
+        // setenv would keep a copy of every value, the variable is one NAME=value entry
+        // instead, rewritten for each value and given to putenv again in case the body
+        // replaced it
+        size_t len = nameLen + strlen(values[i]) + 2;
+        if(len > cap)
+        {
+            char *grown = malloc(len * 2);
+            if(grown == 0)
+            {
+                perror("for");
+                break;
+            }
+            sprintf(grown, "%s=%s", compound->var, values[i]);
+            putenv(grown);
+            free(entry);
+            entry = grown;
+            cap = len * 2;
+        }
+        else
+        {
+            sprintf(entry, "%s=%s", compound->var, values[i]);
+            putenv(entry);
+        }
+
+        runBody(arena, &compound->body);
+        last = STATUS;
+
+        arenaRewind(arena, &mark);
+
+        if(interrupted(++iterations % INTERRUPT_POLL == 0))
+            break;
+    }
+
+    // The variable keeps its last value once the entry is freed
+    char *value = getenv(compound->var);
+    if(entry != 0 && value == entry + nameLen + 1)
+        setenv(compound->var, value, 1);
+    free(entry);
+
+    if(!stopping)
+        STATUS = last;
+}
+
+
+/********************
+ * runCompound
+ * Description: Runs a compiled if, while, until or for. An if whose conditions all failed
+ *      and has no else sets STATUS to 0
+ * -----
+ * Input: arena - the arena of the command line
+ *        compound - the compiled compound
+ * Output: NA
+ * ******************/
+
+void runCompound(struct arena *arena, struct compound *compound)
+{
+    // A ctrl-c from an earlier line does not stop this one
+    if(depth++ == 0)
+    {
+        interruptClear();
+        stopping = 0;
+    }
+
+    if(compound->type == COMPOUND_IF)
+    {
+        runBody(arena, &compound->cond);
+
+        if(!stopping && STATUS == 0)
+            runBody(arena, &compound->body);
+        else if(!stopping && compound->orElse.numPipelines > 0)
+            runBody(arena, &compound->orElse);
+        else if(!stopping)
+            STATUS = W_EXITCODE(0, 0);
+    }
+    else if(compound->type == COMPOUND_FOR)
+        runFor(arena, compound);
+    else
+        runLoop(arena, compound);
+
+    depth--;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+# John McBride
+# Description: End-to-end benchmarks of the wish shell, run with `make bench`.
+# 		Each workload is a generated script run with `wish -t`, which reports the lines
+# 		per second, the latency percentiles of the lines and the peak memory of the shell.
+# 		One JSON object per workload is written to $BENCH_OUT (bench.jsonl by default),
+# 		so the results of two builds can be compared with diff. $BENCH_SCALE multiplies
+# 		the size of every workload (default 1)
+
+WISH=${WISH:-./wish}
+BENCH_OUT=${BENCH_OUT:-bench.jsonl}
+BENCH_SCALE=${BENCH_SCALE:-1}
+
+if [ ! -x "$WISH" ]; then
+	echo "bench: $WISH not found, run make first" >&2
+	exit 1
+fi
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/wish-bench.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT INT TERM
+
+: > "$BENCH_OUT"
+printf '%-16s %8s %12s %10s %10s %10s\n' workload commands commands/s p50_us p99_us maxrss_kb
+
+# generate NAME LINES AWK_BODY - writes the workload script $DIR/NAME.wsh, the awk body
+# prints line i of LINES
+generate()
+{
+	awk -v lines="$(($2 * BENCH_SCALE))" -v dir="$DIR" "BEGIN { for(i = 0; i < lines; i++) { $3 } }" > "$DIR/$1.wsh"
+}
+
+# run NAME [SCRIPT] - runs a workload (the script NAME.wsh unless given) and records its results
+run()
+{
+	"$WISH" -t "$DIR/${2:-$1}.wsh" > /dev/null 2> "$DIR/$1.err"
+
+	awk -v name="$1" -v out="$BENCH_OUT" '
+		/^wish: [0-9]+ lines/ { lines = $2; rate = $9; sub(/\(/, "", rate) }
+		/^wish: latency/ { p50 = $4; p99 = $7; rss = $13 }
+		END {
+			printf "%-16s %8d %12.0f %10.2f %10.2f %10d\n", name, lines, rate, p50, p99, rss
+			printf "{\"workload\":\"%s\",\"commands\":%d,\"commands_per_sec\":%.0f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"maxrss_kb\":%d}\n", name, lines, rate, p50, p99, rss >> out
+		}' "$DIR/$1.err"
+}
+
+# Trivial commands run inside the shell
+generate builtins 200000 'print (i % 3 == 0) ? "true" : (i % 3 == 1) ? "echo hello world > /dev/null" : "test " i " -gt 5"'
+run builtins
+
+# Trivial external commands, a spawn each
+generate external 3000 'print "/bin/true " i'
+run external
+
+# The same commands with each spawn engine: fork, and the pre-forked spawn server
+WISH_SPAWN=fork run external_fork external
+WISH_SPAWN=server run external_server external
+
+# Redirections opened and closed by the shell, then by spawned commands
+generate redirect 50000 'print "echo line " i " > " dir "/redirect.out"; print "printf %s " i " < " dir "/redirect.out > /dev/null"'
+run redirect
+generate redirect_ext 2000 'print "/bin/cat < " dir "/redirect.out > " dir "/redirect.copy"'
+run redirect_ext
+
+# Long lines full of $$ expansions
+generate expand 20000 'line = "echo"; for(j = 0; j < 100; j++) line = line " $$-" j; print line " > /dev/null"'
+run expand
+
+# Pipelines of external commands
+generate pipeline 1000 'print "/bin/echo " i " | /bin/cat | /bin/cat > /dev/null"'
+run pipeline
+
+# Bursts of background jobs
+generate background 2000 'print "/bin/true " i " &"'
+run background
+
+echo "results written to $BENCH_OUT"
@@ -4,89 +4,572 @@
  *
  * Description: Several utility functions that work with the input 
  *      buffer for the command line and it's arguments as part of the wish implementation.
+ *      Input normally comes from stdin, read in large blocks. A script file is mapped into
+ *      memory instead and a -c command is used as it is, so the lexer works on the whole
+ *      script without a system call per line. With -t the shell also measures how long
+ *      every line takes, from the moment it is read until the next line is asked for
  * **********************/
 
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "wish.h"
 
+// Input read but not yet consumed by the lexer. input points to readBuffer, or to the
+// mapped script or -c command
+static char readBuffer[READ_SIZE];
+static char *input = readBuffer;
+static size_t readStart = 0;
+static size_t readEnd = 0;
+
+// Where more input is read from, -1 once all of the input is in memory
+static int inputFd = 0;
+
+// Set when the lines of the script come from its cache file (see scriptcache.c)
+static int fromCache = 0;
+
+// The input the event loop waits for: stdin, or the connection of a served session
+static int streamFd = 0;
+
+// Throughput counters, reported at exit with -t
+static int reportStats = 0;
+static unsigned long linesRead = 0;
+static unsigned long long bytesRead = 0;
+static struct timespec startTime;
+
+// Histogram of the time taken by each line. Bucket b counts latencies of the form
+// (16 + sub) << (exp - 1) nanoseconds, so every bucket is within 1/16 of its value
+#define LATENCY_SUB 16
+#define LATENCY_BUCKETS (64 * LATENCY_SUB)
+static unsigned long latencies[LATENCY_BUCKETS];
+static unsigned long numLatencies = 0;
+static long long maxLatency = 0;
+
+// When the line being run was read, 0 if no line is running
+static long long lineStart = 0;
+
 
 /************************
- * getcommandLine
- * Description: updates the argList array with the various commands input at the command line.
+ * inputOpenScript
+ * Description: Makes a script file the input of the shell. A regular file is read from its
+ *      cache file when it has one, otherwise it is mapped into memory in one piece and its
+ *      cache file is written from the lines as they are lexed; anything else (a pipe, a
+ *      terminal) is read in large blocks
+ * ------
+ * Input: path - the script file
+ * Output: Returns -1 if the file can not be opened (errno is set), otherwise 0
+ * ***********************/
+
+int inputOpenScript(const char *path)
+{
+    struct stat info;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        return -1;
+
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        inputFd = -1;
+        readStart = readEnd = 0;
+
+        // Already split into words by an earlier run. Refer to scriptcache.c for details
+        if(info.st_size > 0 && cacheLoad(path, &info))
+        {
+            fromCache = 1;
+            close(fd);
+            return 0;
+        }
+
+        // An empty file can not be mapped, it is simply no input
+        if(info.st_size > 0)
+        {
+            void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data == MAP_FAILED)
+            {
+                close(fd);
+                return -1;
+            }
+
+            // The lexer reads the script front to back once
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            input = data;
+            readEnd = info.st_size;
+
+            // The lines are recorded for the cache as they are lexed
+            cacheStart(path, &info);
+        }
+
+        close(fd);
+        return 0;
+    }
+
+    inputFd = fd;
+    return 0;
+}
+
+
+/************************
+ * inputOpenBuffer
+ * Description: Makes a block of memory the input of the shell. Nothing is read from a
+ *      file after it, so the lexer and parser can be driven without stdin (see microbench.c)
+ * ------
+ * Input: data - the command lines, separated by newlines. It must stay valid while it is read
+ *        len - the number of bytes
+ * Output: NA
+ * ***********************/
+
+void inputOpenBuffer(char *data, size_t len)
+{
+    input = data;
+    readStart = 0;
+    readEnd = len;
+    inputFd = -1;
+    fromCache = 0;
+    cacheDrop();
+}
+
+
+/************************
+ * inputOpenString
+ * Description: Makes a command string (wish -c) the input of the shell
+ * ------
+ * Input: commands - the command lines, separated by newlines
+ * Output: NA
+ * ***********************/
+
+void inputOpenString(char *commands)
+{
+    inputOpenBuffer(commands, strlen(commands));
+}
+
+
+/************************
+ * inputOpenStream
+ * Description: Makes a stream other than stdin (the connection of wish --serve) the input of
+ *      the shell. The event loop waits for it the way it waits for stdin
+ * ------
+ * Input: fd - the stream, read in large blocks
+ * Output: NA
+ * ***********************/
+
+void inputOpenStream(int fd)
+{
+    input = readBuffer;
+    readStart = readEnd = 0;
+    inputFd = streamFd = fd;
+    fromCache = 0;
+    cacheDrop();
+}
+
+
+/************************
+ * inputStream
+ * Description: Gives the descriptor the event loop waits for when no input is buffered
+ * ------
+ * Input: NA
+ * Output: Returns the descriptor, 0 unless inputOpenStream was used
+ * ***********************/
+
+int inputStream()
+{
+    return streamFd;
+}
+
+
+/************************
+ * inputTrackStats
+ * Description: Starts the throughput counters, they are reported when the shell exits
+ * ------
+ * Input: NA
+ * Output: NA
+ * ***********************/
+
+void inputTrackStats()
+{
+    reportStats = 1;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+
+/************************
+ * latencyBucket
+ * Description: Finds the histogram bucket of a latency
+ * ------
+ * Input: nanos - the latency
+ * Output: Returns the bucket index
+ * ***********************/
+
+static int latencyBucket(long long nanos)
+{
+    unsigned long long value = nanos > 0 ? (unsigned long long)nanos : 0;
+
+    if(value < LATENCY_SUB)
+        return (int)value;
+
+    // Position of the highest bit, then the 4 bits below it
+    int exp = 63 - __builtin_clzll(value);
+    return (exp - 3) * LATENCY_SUB + (int)((value >> (exp - 4)) & (LATENCY_SUB - 1));
+}
+
+
+/************************
+ * bucketValue
+ * Description: Gives the smallest latency counted in a histogram bucket
+ * ------
+ * Input: bucket - the bucket index
+ * Output: Returns the latency in nanoseconds
+ * ***********************/
+
+static double bucketValue(int bucket)
+{
+    if(bucket < LATENCY_SUB)
+        return bucket;
+
+    int exp = bucket / LATENCY_SUB + 3;
+    return (double)(LATENCY_SUB + bucket % LATENCY_SUB) * (double)(1ULL << (exp - 4));
+}
+
+
+/************************
+ * latencyPercentile
+ * Description: Finds a percentile of the line latencies in the histogram
+ * ------
+ * Input: percent - the percentile, 0 to 100
+ * Output: Returns the latency in microseconds
+ * ***********************/
+
+static double latencyPercentile(double percent)
+{
+    unsigned long seen = 0;
+    int i;
+
+    // Nearest rank: the smallest latency with at least percent of the lines at or below it
+    double exact = numLatencies * percent / 100.0;
+    unsigned long rank = (unsigned long)exact;
+    if(rank < exact)
+        rank++;
+    if(rank > 0)
+        rank--;
+    if(rank >= numLatencies)
+        rank = numLatencies - 1;
+
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += latencies[i];
+        if(seen > rank)
+            return bucketValue(i) / 1e3;
+    }
+
+    return maxLatency / 1e3;
+}
+
+
+/************************
+ * inputReportStats
+ * Description: Displays the number of command lines and bytes read, the throughput, the
+ *      latency percentiles of the lines and the peak memory of the shell on stderr, if the
+ *      counters were started
+ * ------
+ * Input: NA
+ * Output: NA
+ * ***********************/
+
+void inputReportStats()
+{
+    struct timespec now;
+
+    if(!reportStats)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+    if(seconds <= 0)
+        seconds = 1e-9;
+
+    fprintf(stderr, "wish: %lu lines, %llu bytes in %.3f s (%.0f lines/s, %.2f MB/s)\n",
+            linesRead, bytesRead, seconds, linesRead / seconds, bytesRead / seconds / 1e6);
+
+    // Line latencies and the peak memory of the shell
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    if(numLatencies > 0)
+        fprintf(stderr, "wish: latency p50 %.2f us, p99 %.2f us, max %.2f us, maxrss %ld KB\n",
+                latencyPercentile(50), latencyPercentile(99), maxLatency / 1e3, usage.ru_maxrss);
+    else
+        fprintf(stderr, "wish: latency p50 0.00 us, p99 0.00 us, max 0.00 us, maxrss %ld KB\n", usage.ru_maxrss);
+}
+
+
+/************************
+ * inputPending
+ * Description: Tells the event loop if a command line is already buffered. Input that does not
+ *      come from stdin (a script) never has to be waited for
+ * ------
+ * Input: NA
+ * Output: Returns 1 if buffered input remains or the input is a script, otherwise 0
+ * ***********************/
+
+int inputPending()
+{
+    return readStart < readEnd || inputFd != streamFd;
+}
+
+
+/************************
+ * inputPeek
+ * Description: Gives the lexer access to the buffered input, reading more when the buffer
+ *      is empty. A mapped script is handed over whole (in pieces of at most INT_MAX bytes)
+ * ------
+ * Input: data - set to the first buffered byte
+ * Output: Returns the number of buffered bytes, 0 at the end of input
+ * ***********************/
+
+int inputPeek(char **data)
+{
+    if(readStart == readEnd)
+    {
+        if(inputFd == -1)
+            return 0;
+
+        ssize_t numRead = read(inputFd, readBuffer, READ_SIZE);
+        if(numRead <= 0)
+            return 0;
+
+        input = readBuffer;
+        readStart = 0;
+        readEnd = numRead;
+    }
+
+    *data = input + readStart;
+    return readEnd - readStart > INT_MAX ? INT_MAX : (int)(readEnd - readStart);
+}
+
+
+/************************
+ * inputFill
+ * Description: Reads until at least len bytes are buffered, or the input ends. Used to look
+ *      at a whole header line before the lexer starts
+ * ------
+ * Input: data - set to the first buffered byte
+ *        len - the number of bytes wanted, at most READ_SIZE
+ * Output: Returns the number of buffered bytes, less than len at the end of input
+ * ***********************/
+
+int inputFill(char **data, size_t len)
+{
+    if(inputFd != -1 && readEnd - readStart < len)
+    {
+        // Move what is buffered to the front of the read buffer
+        memmove(readBuffer, input + readStart, readEnd - readStart);
+        input = readBuffer;
+        readEnd -= readStart;
+        readStart = 0;
+
+        while(readEnd < len)
+        {
+            ssize_t numRead = read(inputFd, readBuffer + readEnd, READ_SIZE - readEnd);
+            if(numRead <= 0)
+                break;
+            readEnd += numRead;
+        }
+    }
+
+    *data = input + readStart;
+    return readEnd - readStart;
+}
+
+
+/************************
+ * inputConsume
+ * Description: Marks buffered input as used by the lexer
  * ------
- * Input: inNum - Will be updated with the number of commands entered on the command line
- *        arglist - Empty array of pointers to strings (pointers to pointers). This array will be
- *        updated with each word (delimited by spaces) entered on the commandl ine
- * Output: NA - inNum and argList will both be updated with input from the command line
+ * Input: numBytes - the number of bytes consumed, at most what inputPeek returned
+ * Output: NA
  * ***********************/
 
-void getCommandLine(int *inNum, char **argList)
+void inputConsume(int numBytes)
 {
-    // Temporary buffer to get input from the command line. Set it's memory to null
-    char inBuffer[LINE_SIZE];
-    memset(inBuffer, '\0', sizeof(LINE_SIZE));
+    readStart += numBytes;
+    bytesRead += numBytes;
+}
+
+
+/************************
+ * lexString
+ * Description: Splits a string of one line into words without disturbing the input of the
+ *      shell, which is put back afterwards (see substitute.c)
+ * ------
+ * Input: arena - the arena the words are allocated from
+ *        text - the line, without its newline
+ *        len - the length of the line
+ *        inNum - set to the number of words
+ * Output: Returns the NULL terminated word list, or NULL if the string holds more than one
+ *        line or can not be split
+ * ***********************/
+
+char **lexString(struct arena *arena, char *text, size_t len, int *inNum)
+{
+    char **words;
+
+    // The input of the shell, untouched by the lexer below
+    char *savedInput = input;
+    size_t savedStart = readStart, savedEnd = readEnd;
+    int savedFd = inputFd, savedCache = fromCache;
+    unsigned long long savedBytes = bytesRead;
+
+    input = text;
+    readStart = 0;
+    readEnd = len;
+    inputFd = -1;
+    fromCache = 0;
+
+    *inNum = lexLine(arena, &words);
+    int complete = readStart == readEnd;
+
+    input = savedInput;
+    readStart = savedStart;
+    readEnd = savedEnd;
+    inputFd = savedFd;
+    fromCache = savedCache;
+    bytesRead = savedBytes;
 
-    // Print out the prompt
-    write(1, ":", 1); 
+    if(*inNum < 0 || !complete)
+        return 0;
+
+    return words;
+}
 
-    // Get the command line from the user and place it into the inBuffer
-    fgets(inBuffer, LINE_SIZE, stdin);
 
-    // Place a newline character on the first occurence of the newline character. 
-    // This ensures there is no buffer overflow or over bounding of the input buffer
-    inBuffer[strcspn(inBuffer, "\n")] = '\0';
+/************************
+ * readLine
+ * Description: Reads a line and breaks it into the argument vector. Every word and the
+ *      vector itself are allocated from the line arena. Words still contain their quotes
+ * ------
+ * Input: arena - the arena of the current command line
+ *        inNum - Will be updated with the number of commands entered on the command line
+ *        prompt - displayed first when the shell is interactive
+ * Output: Returns the NULL terminated argument vector, with each word (delimited by spaces)
+ *        entered on the command line. Returns NULL at the end of the input. inNum is
+ *        LEX_ERROR for a last line the end of the input left inside quotes
+ * ***********************/
 
-    // bust the string up into tokens delimited by spaces
-    char *token = strtok(inBuffer, " ");
+static char **readLine(struct arena *arena, int *inNum, const char *prompt)
+{
+    char **argList;
 
-    // Loop through each of the space delimited words in the command line (until the token returns null)
-    int i = 0;
-    while(token != 0)
+    // The previous line is done
+    if(lineStart != 0)
     {
-        // Get the length of the current token
-        int tokenLen = strlen(token);
+        long long taken = clockNow() - lineStart;
 
-        // Allocate enough space for that token
-        argList[i] = (char*)malloc((sizeof(char) * tokenLen) + 1);
+        latencies[latencyBucket(taken)]++;
+        numLatencies++;
+        if(taken > maxLatency)
+            maxLatency = taken;
+        lineStart = 0;
+    }
+
+    // Print out the prompt. Scripts run without one
+    if(INTERACTIVE)
+        write(1, prompt, strlen(prompt));
 
-        // Copy the string over to the argList array
-        strcpy(argList[i], token);
+    // Wait for input, reporting finished background processes meanwhile. Refer to events.c
+    waitForInput();
 
-        // Ensure the new line char is in the right spot
-        argList[i][tokenLen] = '\0';
+    // Split the command line into words, or take the words from the cache. Refer to lexer.c
+    // and scriptcache.c for details
+    int numWords, numBytes;
+    if(fromCache)
+    {
+        numWords = cacheNextLine(arena, &argList, &numBytes);
+        if(numWords >= 0)
+            bytesRead += numBytes;
+    }
+    else
+    {
+        size_t offset = readStart;
+        numWords = lexLine(arena, &argList);
+        if(numWords >= 0)
+            cacheRecord(argList, numWords, readStart - offset);
+    }
 
-        // Go to the next token and increment the counter
-        token = strtok(NULL, " ");
-        i++;
+    // The last line was left inside quotes: an error for parseNextLine, nothing to cache
+    if(numWords == LEX_ERROR)
+    {
+        cacheDrop();
+        *inNum = LEX_ERROR;
+        return argList;
+    }
+    if(numWords < 0)
+    {
+        // Every line of the script is known, its cache file can be written
+        cacheFinish();
+        *inNum = 0;
+        return 0;
     }
 
     // Set the counter to the number of arguments processed
-    *inNum = i;
+    *inNum = numWords;
+    linesRead++;
+
+    if(reportStats)
+        lineStart = clockNow();
+
+    return argList;
+}
+
+
+/************************
+ * getcommandLine
+ * Description: Reads a command line and breaks it into the argument vector, see readLine
+ * ------
+ * Input: arena - the arena of the current command line
+ *        inNum - Will be updated with the number of commands entered on the command line
+ * Output: Returns the NULL terminated argument vector, or NULL at the end of the input
+ * ***********************/
+
+char **getCommandLine(struct arena *arena, int *inNum)
+{
+    return readLine(arena, inNum, ":");
+}
+
+
+/************************
+ * getContinuationLine
+ * Description: Reads the next line of a command that is not complete yet, like the body
+ *      of a loop (see ast.c). The prompt is "> " instead of ":"
+ * ------
+ * Input: arena - the arena of the current command line
+ *        inNum - Will be updated with the number of words on the line
+ * Output: Returns the NULL terminated argument vector, or NULL at the end of the input
+ * ***********************/
+
+char **getContinuationLine(struct arena *arena, int *inNum)
+{
+    return readLine(arena, inNum, "> ");
 }
 
 
 /************************
  * cleanBuffer
- * Description: Cleans up the allocated memory for the argList array
+ * Description: Releases the memory of the last command line. The arena is rewound
+ *      rather than freed, so the next line reuses the same memory
  * -----
- * Input: argList - The array of pointers to strings where the strings memory was dynamically allocated.
- *          see the getcommandLine function above for allocation details.
- * Output: NA - Memory will be freed and the argList will be ready for the next round of input
+ * Input: arena - the arena of the command line. See getcommandLine above for allocation details.
+ * Output: NA - The arena will be ready for the next round of input
  * ***********************/
 
-void cleanBuffer(char **argList)
+void cleanBuffer(struct arena *arena)
 {
-    // Loop through the argList array (until a null string is reached)
-    int i = 0;
-    while(argList[i] != 0)
-    {
-        // Free up the dynamic memory and set the pointer to NULLPTR (zero)
-        free(argList[i]);
-        argList[i] = 0;
-        i++;
-    }
+    arenaReset(arena);
 }
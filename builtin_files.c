@@ -0,0 +1,646 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The file builtins cat, cp and tee. They move the data inside the kernel
+ *      whenever the descriptors allow it, so copying a file costs no fork, no exec and no
+ *      copy through user memory:
+ *
+ *          file to file        copy_file_range (which may share the blocks on some file systems)
+ *          file to anything    sendfile
+ *          pipe to anything    splice, and tee to give the same data to several outputs
+ *
+ *      Anything else (a terminal, the output of a pipeline stage collected in memory) falls
+ *      back to read and write. The < and > redirections of the command are the in and out
+ *      of the builtin, as for every builtin (see exec.c)
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "wish.h"
+
+// The most bytes moved by one system call
+#define COPY_CHUNK (1 << 30)
+
+// The bytes moved through a pipe at a time by tee, the default size of a pipe
+#define TEE_CHUNK 65536
+
+// The outputs tee may write at once, stdout included
+#define TEE_MAX_FILES 64
+
+// The ways of moving data, tried in this order
+#define COPY_RANGE    0
+#define COPY_SENDFILE 1
+#define COPY_SPLICE   2
+#define COPY_READ     3
+
+// Used by read and write when nothing faster works
+static char copyBuffer[READ_SIZE];
+
+
+/********************
+ * writeAll
+ * Description: Writes every byte to a descriptor
+ * -----
+ * Input: fd - the descriptor
+ *        data - the bytes to write
+ *        len - the number of bytes
+ * Output: Returns -1 if the write failed (errno is set), otherwise 0
+ * ******************/
+
+static int writeAll(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written == -1)
+            return -1;
+
+        data += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * firstMethod
+ * Description: Chooses the fastest way to move data between two descriptors. The size of a
+ *      regular file must be known: files of /proc say 0 and only give their data to read
+ * -----
+ * Input: in - the descriptor read
+ *        out - the descriptor written
+ * Output: Returns one of the COPY_ values
+ * ******************/
+
+static int firstMethod(int in, int out)
+{
+    struct stat inInfo, outInfo;
+
+    if(fstat(in, &inInfo) == -1 || fstat(out, &outInfo) == -1)
+        return COPY_READ;
+
+    if(S_ISREG(inInfo.st_mode) && inInfo.st_size > 0)
+        return S_ISREG(outInfo.st_mode) ? COPY_RANGE : COPY_SENDFILE;
+
+    if(S_ISFIFO(inInfo.st_mode) || S_ISFIFO(outInfo.st_mode))
+        return COPY_SPLICE;
+
+    return COPY_READ;
+}
+
+
+/********************
+ * copyData
+ * Description: Moves everything left in one descriptor to another. A method the descriptors
+ *      do not support fails at once, and the next one takes over from the same offsets
+ * -----
+ * Input: in - the descriptor read, from its offset to its end
+ *        out - the descriptor written, at its offset
+ * Output: Returns -1 if reading or writing failed (errno is set), otherwise 0
+ * ******************/
+
+static int copyData(int in, int out)
+{
+    int method = firstMethod(in, out);
+    ssize_t moved;
+
+    while(1)
+    {
+        if(method == COPY_RANGE)
+            moved = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        else if(method == COPY_SENDFILE)
+            moved = sendfile(out, in, NULL, COPY_CHUNK);
+        else if(method == COPY_SPLICE)
+            moved = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+        else
+        {
+            moved = read(in, copyBuffer, sizeof(copyBuffer));
+            if(moved > 0 && writeAll(out, copyBuffer, moved) == -1)
+                return -1;
+        }
+
+        if(moved == 0)
+            return 0;
+
+        if(moved == -1 && errno != EINTR)
+        {
+            // Not supported for these descriptors: the next method continues
+            if(method != COPY_READ && (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+                errno == EOPNOTSUPP || errno == EBADF))
+            {
+                method = method == COPY_RANGE ? COPY_SENDFILE : COPY_READ;
+                continue;
+            }
+
+            return -1;
+        }
+    }
+}
+
+
+/********************
+ * catOne
+ * Description: Writes one input of cat to the output of the builtin
+ * -----
+ * Input: call - the builtin being run
+ *        fd - the input
+ * Output: Returns -1 if reading or writing failed (errno is set), 1 if ctrl-c stopped it,
+ *        otherwise 0
+ * ******************/
+
+static int catOne(struct builtinCall *call, int fd)
+{
+    ssize_t got;
+    int terminal = isatty(fd);
+
+    // Output collected in memory, or input typed at the terminal, which ctrl-c must stop
+    if(call->out->fd == -1 || terminal)
+    {
+        while(1)
+        {
+            if(terminal && waitReadable(fd) == -1)
+                return 1;
+
+            got = read(fd, copyBuffer, sizeof(copyBuffer));
+            if(got == 0)
+                return 0;
+            if(got == -1 && errno != EINTR)
+                return -1;
+            if(got > 0)
+            {
+                outWrite(call->out, copyBuffer, got);
+                if(terminal)
+                    outFlush(call->out);
+            }
+        }
+    }
+
+    // Whatever the builtin buffered goes first
+    outFlush(call->out);
+    return copyData(fd, call->out->fd);
+}
+
+
+/********************
+ * isOutput
+ * Description: Tells if an input of cat is the regular file it writes to. Copying it would
+ *      never reach the end of the file, as every block read is appended to it again
+ * -----
+ * Input: call - the builtin being run
+ *        fd - the input
+ * Output: Returns 1 if the input is the output file, otherwise 0
+ * ******************/
+
+static int isOutput(struct builtinCall *call, int fd)
+{
+    struct stat inInfo, outInfo;
+
+    if(call->out->fd == -1 || fstat(call->out->fd, &outInfo) == -1 || !S_ISREG(outInfo.st_mode))
+        return 0;
+
+    return fstat(fd, &inInfo) == 0 && inInfo.st_dev == outInfo.st_dev && inInfo.st_ino == outInfo.st_ino;
+}
+
+
+/********************
+ * builtIn_cat
+ * Description: The cat builtin: `cat [file...]` writes the files one after the other, or
+ *      the input of the command when there is none. A - is the input too
+ * -----
+ * Input: call - the words, input and output of the command
+ * Output: Returns 1 if a file could not be read or the output written, otherwise 0
+ * ******************/
+
+int builtIn_cat(struct builtinCall *call)
+{
+    char **args = call->argList + 1;
+    int result = 0;
+
+    // -u (no buffering) is what cat does anyway
+    while(*args != 0 && strcmp(*args, "-u") == 0)
+        args++;
+
+    if(*args == 0)
+    {
+        if(isOutput(call, call->in))
+        {
+            fprintf(stderr, "cat: -: input file is output file\n");
+            return 1;
+        }
+
+        int done = catOne(call, call->in);
+        if(done == -1)
+            fprintf(stderr, "cat: %s\n", strerror(errno));
+        return done == 1 ? 128 + SIGINT : done != 0;
+    }
+
+    for(; *args != 0; args++)
+    {
+        int fd = strcmp(*args, "-") == 0 ? call->in : open(*args, O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+        {
+            fprintf(stderr, "cat: %s: %s\n", *args, strerror(errno));
+            result = 1;
+            continue;
+        }
+
+        if(isOutput(call, fd))
+        {
+            fprintf(stderr, "cat: %s: input file is output file\n", *args);
+            if(fd != call->in)
+                close(fd);
+            result = 1;
+            continue;
+        }
+
+        int done = catOne(call, fd);
+        if(done == -1)
+        {
+            fprintf(stderr, "cat: %s: %s\n", *args, strerror(errno));
+            result = 1;
+        }
+
+        if(fd != call->in)
+            close(fd);
+
+        // Stopped with ctrl-c
+        if(done == 1)
+            return 128 + SIGINT;
+    }
+
+    return result;
+}
+
+
+/********************
+ * copyFile
+ * Description: Copies one file for cp. A new file gets the permissions of the source
+ * -----
+ * Input: source - the file copied
+ *        target - the file written, replaced if it exists
+ * Output: Returns 1 if the file could not be copied (a message is displayed), otherwise 0
+ * ******************/
+
+static int copyFile(const char *source, const char *target)
+{
+    struct stat sourceInfo, targetInfo;
+
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    if(in == -1 || fstat(in, &sourceInfo) == -1)
+    {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        if(in != -1)
+            close(in);
+        return 1;
+    }
+
+    if(S_ISDIR(sourceInfo.st_mode))
+    {
+        fprintf(stderr, "cp: %s: is a directory (not copied)\n", source);
+        close(in);
+        return 1;
+    }
+
+    // Truncating the target would empty the source first
+    if(stat(target, &targetInfo) == 0 && targetInfo.st_dev == sourceInfo.st_dev &&
+        targetInfo.st_ino == sourceInfo.st_ino)
+    {
+        fprintf(stderr, "cp: %s and %s are the same file\n", source, target);
+        close(in);
+        return 1;
+    }
+
+    int out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sourceInfo.st_mode & 07777);
+    if(out == -1)
+    {
+        fprintf(stderr, "cp: %s: %s\n", target, strerror(errno));
+        close(in);
+        return 1;
+    }
+
+    int result = 0;
+    if(copyData(in, out) == -1)
+    {
+        fprintf(stderr, "cp: %s: %s\n", target, strerror(errno));
+        result = 1;
+    }
+
+    close(in);
+    if(close(out) == -1 && result == 0)
+    {
+        fprintf(stderr, "cp: %s: %s\n", target, strerror(errno));
+        result = 1;
+    }
+
+    return result;
+}
+
+
+/********************
+ * builtIn_cp
+ * Description: The cp builtin: `cp source target` copies a file, `cp source... directory`
+ *      copies the files into a directory under their own names
+ * -----
+ * Input: call - the words of the command
+ * Output: Returns 1 if a file could not be copied, otherwise 0
+ * ******************/
+
+int builtIn_cp(struct builtinCall *call)
+{
+    char path[PATH_MAX];
+    struct stat info;
+    int i, result = 0;
+    int numSources = call->numArgs - 2;
+    char *target = call->argList[call->numArgs - 1];
+
+    if(numSources < 1)
+    {
+        fprintf(stderr, "usage: cp source target\n       cp source... directory\n");
+        return 1;
+    }
+
+    int isDirectory = stat(target, &info) == 0 && S_ISDIR(info.st_mode);
+    if(numSources > 1 && !isDirectory)
+    {
+        fprintf(stderr, "cp: %s: not a directory\n", target);
+        return 1;
+    }
+
+    if(!isDirectory)
+        return copyFile(call->argList[1], target);
+
+    for(i = 1; i <= numSources; i++)
+    {
+        const char *name = strrchr(call->argList[i], '/');
+        name = name ? name + 1 : call->argList[i];
+
+        if(snprintf(path, sizeof(path), "%s/%s", target, name) >= (int)sizeof(path))
+        {
+            fprintf(stderr, "cp: %s/%s: file name too long\n", target, name);
+            result = 1;
+        }
+        else
+            result |= copyFile(call->argList[i], path);
+    }
+
+    return result;
+}
+
+
+/********************
+ * drainPipe
+ * Description: Moves a number of bytes out of a pipe of tee's own, with splice when the
+ *      output takes it, otherwise with read and write
+ * -----
+ * Input: pipeFd - the read end of the pipe, it holds at least len bytes
+ *        fd - the output, or -1 to throw the bytes away
+ *        len - the number of bytes
+ * Output: Returns -1 if the output could not be written (errno is set), otherwise 0. The
+ *        bytes are taken out of the pipe either way
+ * ******************/
+
+static int drainPipe(int pipeFd, int fd, size_t len)
+{
+    int result = 0;
+
+    while(len > 0)
+    {
+        ssize_t moved = fd == -1 ? -1 : splice(pipeFd, NULL, fd, NULL, len, SPLICE_F_MOVE);
+        if(moved > 0)
+        {
+            len -= moved;
+            continue;
+        }
+        if(moved == -1 && errno == EINTR)
+            continue;
+        if(moved == -1 && fd != -1 && errno != EINVAL)
+        {
+            result = -1;
+            fd = -1;
+        }
+
+        // The output can not be spliced into (a terminal), or is gone
+        moved = read(pipeFd, copyBuffer, len < sizeof(copyBuffer) ? len : sizeof(copyBuffer));
+        if(moved <= 0)
+            break;
+        len -= moved;
+
+        if(fd != -1 && writeAll(fd, copyBuffer, moved) == -1)
+        {
+            result = -1;
+            fd = -1;
+        }
+    }
+
+    return result;
+}
+
+
+/********************
+ * teeSplice
+ * Description: Copies the input of tee to every output inside the kernel. Each chunk is
+ *      spliced from the input into a pipe of tee's own, duplicated with tee(2) into a second
+ *      empty pipe for every output but the last, and spliced from there to the output
+ * -----
+ * Input: in - the input
+ *        outputs - the descriptors written, an output that fails is set to -1
+ *        names - the names of the outputs, for messages
+ *        numOutputs - the number of outputs
+ * Output: Returns 1 if an output failed, 0 if everything was copied, and -1 if the input can
+ *        not be spliced, before anything was read
+ * ******************/
+
+static int teeSplice(int in, int *outputs, char **names, int numOutputs)
+{
+    int chunk[2], copy[2];
+    int i, result = 0, started = 0;
+
+    if(pipe2(chunk, O_CLOEXEC) == -1)
+        return -1;
+    if(pipe2(copy, O_CLOEXEC) == -1)
+    {
+        close(chunk[0]);
+        close(chunk[1]);
+        return -1;
+    }
+
+    while(1)
+    {
+        ssize_t len = splice(in, NULL, chunk[1], NULL, TEE_CHUNK, SPLICE_F_MOVE);
+        if(len == -1 && errno == EINTR)
+            continue;
+        if(len == -1 && !started)
+            result = -1;
+        else if(len == -1)
+        {
+            fprintf(stderr, "tee: %s\n", strerror(errno));
+            result = 1;
+        }
+        if(len <= 0)
+            break;
+        started = 1;
+
+        for(i = 0; i < numOutputs; i++)
+        {
+            int from = chunk[0];
+
+            // Every output but the last gets a duplicate of the chunk
+            if(i < numOutputs - 1)
+            {
+                if(outputs[i] == -1)
+                    continue;
+
+                // The copy pipe is empty and as large as the chunk pipe, so it takes the whole chunk
+                ssize_t copied = tee(chunk[0], copy[1], len, 0);
+                if(copied != len)
+                {
+                    if(copied > 0)
+                        drainPipe(copy[0], -1, copied);
+                    fprintf(stderr, "tee: %s: %s\n", names[i], copied == -1 ? strerror(errno) : "short copy");
+                    outputs[i] = -1;
+                    result = 1;
+                    continue;
+                }
+                from = copy[0];
+            }
+
+            if(drainPipe(from, outputs[i], len) == -1)
+            {
+                fprintf(stderr, "tee: %s: %s\n", names[i], strerror(errno));
+                outputs[i] = -1;
+                result = 1;
+            }
+        }
+    }
+
+    close(chunk[0]);
+    close(chunk[1]);
+    close(copy[0]);
+    close(copy[1]);
+
+    return result;
+}
+
+
+/********************
+ * builtIn_tee
+ * Description: The tee builtin: `tee [-a] [file...]` writes its input to its output and to
+ *      every file, appended to with -a, otherwise truncated
+ * -----
+ * Input: call - the words, input and output of the command
+ * Output: Returns 1 if a file could not be opened or written, otherwise 0
+ * ******************/
+
+int builtIn_tee(struct builtinCall *call)
+{
+    int outputs[TEE_MAX_FILES + 1], files[TEE_MAX_FILES];
+    char *names[TEE_MAX_FILES + 1];
+    char **args = call->argList + 1;
+    int i, numOutputs = 0, result = 0, flags = O_TRUNC;
+    ssize_t got;
+
+    if(*args != 0 && strcmp(*args, "-a") == 0)
+    {
+        flags = O_APPEND;
+        args++;
+    }
+
+    for(; *args != 0; args++)
+    {
+        if(numOutputs == TEE_MAX_FILES)
+        {
+            fprintf(stderr, "tee: %s: too many files\n", *args);
+            result = 1;
+            continue;
+        }
+
+        int fd = open(*args, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+        if(fd == -1)
+        {
+            fprintf(stderr, "tee: %s: %s\n", *args, strerror(errno));
+            result = 1;
+            continue;
+        }
+
+        files[numOutputs] = outputs[numOutputs] = fd;
+        names[numOutputs++] = *args;
+    }
+
+    // Only the files are closed at the end, stdout is added to the outputs after them
+    int numFiles = numOutputs;
+
+    // The output of the builtin is written last, with the data that is left in the pipe
+    int direct = call->out->fd != -1;
+    if(direct)
+    {
+        outFlush(call->out);
+        outputs[numOutputs] = call->out->fd;
+        names[numOutputs++] = "stdout";
+    }
+
+    int copied = direct && !isatty(call->in) ? teeSplice(call->in, outputs, names, numOutputs) : -1;
+
+    // The input can not be spliced, or the output is collected in memory
+    if(copied == -1)
+    {
+        int terminal = isatty(call->in);
+
+        copied = 0;
+        while(1)
+        {
+            if(terminal && waitReadable(call->in) == -1)
+            {
+                copied = 128 + SIGINT;
+                break;
+            }
+
+            got = read(call->in, copyBuffer, sizeof(copyBuffer));
+            if(got == 0)
+                break;
+            if(got == -1 && errno == EINTR)
+                continue;
+            if(got == -1)
+            {
+                fprintf(stderr, "tee: %s\n", strerror(errno));
+                copied = 1;
+                break;
+            }
+
+            if(!direct)
+                outWrite(call->out, copyBuffer, got);
+
+            for(i = 0; i < numOutputs; i++)
+            {
+                if(outputs[i] != -1 && writeAll(outputs[i], copyBuffer, got) == -1)
+                {
+                    fprintf(stderr, "tee: %s: %s\n", names[i], strerror(errno));
+                    outputs[i] = -1;
+                    copied = 1;
+                }
+            }
+        }
+    }
+
+    for(i = 0; i < numFiles; i++)
+        close(files[i]);
+
+    return result | copied;
+}
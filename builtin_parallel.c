@@ -0,0 +1,476 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The parallel builtin, a bounded pool of workers:
+ *
+ *          parallel [-j N] [-k] command [words...] ::: arg...
+ *          parallel [-j N] [-k] command [words...]          (one arg per line of stdin)
+ *
+ *      The command runs once per arg, with the arg in place of every {} in its words, or
+ *      added as its last word if there is none. Exactly N commands run at a time (the
+ *      number of processors by default): each child is watched through a pidfd and a new
+ *      one starts as soon as one exits, so thousands of args never mean thousands of
+ *      processes. With -k the output of every command is kept in a memfd and written in
+ *      the order of the args, otherwise commands write directly to the output of the
+ *      builtin. The exit value is the number of commands that failed, at most 101. A
+ *      command killed by ctrl-c stops new commands from starting
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "wish.h"
+
+// The exit value once more commands than that failed
+#define PARALLEL_MAX_FAILED 101
+
+// Milliseconds between checks of the children that could not get a pidfd
+#define PARALLEL_POLL_MS 50
+
+// A running command
+struct worker
+{
+    pid_t pid;
+    int pidfd;      // -1 if the child is checked every PARALLEL_POLL_MS instead
+    int capture;    // memfd receiving the output, -1 if written directly
+    int job;        // the index of its arg
+};
+
+// The output of a finished command waiting for the commands before it (-k)
+struct kept
+{
+    char *data;
+    size_t len;
+    int done;
+};
+
+
+/********************
+ * parallelError
+ * Description: Reports a usage error
+ * -----
+ * Input: message - the message
+ * Output: Returns 2, the exit value of a usage error
+ * ******************/
+
+static int parallelError(const char *message)
+{
+    fprintf(stderr, "parallel: %s\n", message);
+    fprintf(stderr, "usage: parallel [-j N] [-k] command [words...] [::: arg...]\n");
+    return 2;
+}
+
+
+/********************
+ * readArgs
+ * Description: Reads the args from the input of the builtin, one per line
+ * -----
+ * Input: fd - the input
+ *        data - set to the text read, allocated with malloc, the lines end with '\0'
+ *        args - set to the lines, allocated with malloc
+ * Output: Returns the number of args, or -1 if the input could not be read
+ * ******************/
+
+static int readArgs(int fd, char **data, char ***args)
+{
+    size_t len = 0, cap = 4096;
+    int i, numArgs = 0;
+    char *text = malloc(cap);
+
+    while(text != 0)
+    {
+        if(len + 1 >= cap)
+        {
+            char *grown = realloc(text, cap * 2);
+            if(grown == 0)
+                break;
+            text = grown;
+            cap *= 2;
+        }
+
+        ssize_t numRead = read(fd, text + len, cap - len - 1);
+        if(numRead == -1 && errno == EINTR)
+            continue;
+        if(numRead == -1)
+        {
+            perror("parallel");
+            break;
+        }
+        if(numRead == 0)
+        {
+            // Split the lines in place, ignoring empty ones
+            text[len] = '\n';
+            for(i = 0; (size_t)i <= len; i++)
+            {
+                if(text[i] == '\n')
+                    numArgs++;
+            }
+
+            *args = malloc(sizeof(char *) * (numArgs + 1));
+            if(*args == 0)
+                break;
+
+            char *line = text;
+            numArgs = 0;
+            for(i = 0; (size_t)i <= len; i++)
+            {
+                if(text[i] != '\n')
+                    continue;
+
+                text[i] = '\0';
+                if(*line != '\0')
+                    (*args)[numArgs++] = line;
+                line = text + i + 1;
+            }
+
+            *data = text;
+            return numArgs;
+        }
+
+        len += numRead;
+    }
+
+    free(text);
+    return -1;
+}
+
+
+/********************
+ * jobWords
+ * Description: Builds the words of the command for one arg: every {} is replaced by the arg,
+ *      or the arg is added after the last word if no word has {}
+ * -----
+ * Input: arena - the arena of the command line
+ *        words - the command and its words
+ *        numWords - the number of words
+ *        arg - the arg
+ * Output: Returns the NULL terminated argument vector
+ * ******************/
+
+static char **jobWords(struct arena *arena, char **words, int numWords, const char *arg)
+{
+    char **argv = arenaAlloc(arena, sizeof(char *) * (numWords + 2));
+    size_t argLen = strlen(arg);
+    int i, replaced = 0;
+
+    for(i = 0; i < numWords; i++)
+    {
+        char *brace = strstr(words[i], "{}");
+        if(brace == 0)
+        {
+            argv[i] = words[i];
+            continue;
+        }
+
+        // Count the {} of the word to size the result
+        int count = 0;
+        char *at;
+        for(at = brace; at != 0; at = strstr(at + 2, "{}"))
+            count++;
+
+        char *word = arenaAlloc(arena, strlen(words[i]) + count * argLen + 1);
+        char *dest = word;
+        const char *src = words[i];
+        for(at = brace; at != 0; at = strstr(src, "{}"))
+        {
+            memcpy(dest, src, at - src);
+            dest += at - src;
+            memcpy(dest, arg, argLen);
+            dest += argLen;
+            src = at + 2;
+        }
+        strcpy(dest, src);
+
+        argv[i] = word;
+        replaced = 1;
+    }
+
+    if(!replaced)
+        argv[i++] = (char *)arg;
+    argv[i] = 0;
+
+    return argv;
+}
+
+
+/********************
+ * startJob
+ * Description: Starts the command of one arg with the spawn engine. stdin is /dev/null
+ * -----
+ * Input: argv - the argument vector
+ *        outFd - the descriptor that becomes stdout, 1 to keep the shell's
+ * Output: Returns the pid, or -1 if the command could not be started (a message is displayed)
+ * ******************/
+
+static pid_t startJob(char **argv, int outFd)
+{
+    struct spawnPlan plan;
+    pid_t pid = -1;
+
+    planInit(&plan, argv, 0);
+    if(redirectStdin(&plan) == 0 && (outFd == 1 || planDup(&plan, 1, outFd) == 0))
+        pid = spawnCommand(&plan);
+    else
+        errno = EMFILE;
+
+    planClose(&plan);
+
+    if(pid == -1)
+        fprintf(stderr, "%s: %s\n", argv[0], errno == ENOENT ? "no such file or directory" : strerror(errno));
+
+    return pid;
+}
+
+
+/********************
+ * takeOutput
+ * Description: Reads back the output a command wrote to its memfd, and closes the memfd
+ * -----
+ * Input: fd - the memfd
+ *        len - set to the number of bytes
+ * Output: Returns the output allocated with malloc, or NULL if there is none
+ * ******************/
+
+static char *takeOutput(int fd, size_t *len)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    char *data = 0;
+
+    *len = 0;
+    if(size > 0 && (data = malloc(size)) != 0)
+    {
+        ssize_t numRead = pread(fd, data, size, 0);
+        *len = numRead > 0 ? numRead : 0;
+    }
+
+    close(fd);
+    return data;
+}
+
+
+/********************
+ * builtIn_parallel
+ * Description: The parallel builtin
+ * -----
+ * Input: call - the words, input and output of the command
+ * Output: Returns the number of commands that failed (at most 101), 2 on a usage error
+ * ******************/
+
+int builtIn_parallel(struct builtinCall *call)
+{
+    char **words = call->argList + 1;
+    char **args = 0, *argData = 0;
+    int numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    int keepOrder = 0, numWords, numArgs, i;
+
+    // Options come first
+    while(*words != 0 && words[0][0] == '-')
+    {
+        if(strcmp(*words, "-k") == 0)
+            keepOrder = 1;
+        else if(strcmp(*words, "-j") == 0 && words[1] != 0)
+        {
+            char *end;
+            numWorkers = strtol(*++words, &end, 10);
+            if(*end != '\0' || numWorkers < 1)
+                return parallelError("-j needs a number of jobs above 0");
+        }
+        else if(strncmp(*words, "-j", 2) == 0 && words[0][2] != '\0')
+        {
+            char *end;
+            numWorkers = strtol(*words + 2, &end, 10);
+            if(*end != '\0' || numWorkers < 1)
+                return parallelError("-j needs a number of jobs above 0");
+        }
+        else
+            return parallelError("unknown option");
+        words++;
+    }
+
+    if(numWorkers < 1)
+        numWorkers = 1;
+
+    // The command ends at :::, the args follow. Without ::: they are read from stdin
+    for(numWords = 0; words[numWords] != 0 && strcmp(words[numWords], ":::") != 0; numWords++)
+        ;
+
+    if(numWords == 0)
+        return parallelError("no command");
+
+    if(words[numWords] != 0)
+    {
+        args = words + numWords + 1;
+        for(numArgs = 0; args[numArgs] != 0; numArgs++)
+            ;
+    }
+    else if((numArgs = readArgs(call->in, &argData, &args)) == -1)
+        return 1;
+
+    // Output going into a pipe is collected by the shell: commands can not write into it directly
+    int capture = keepOrder || call->out->fd == -1;
+    int outFd = call->out->fd;
+    outFlush(call->out);
+
+    if(numWorkers > numArgs)
+        numWorkers = numArgs;
+
+    struct worker *workers = calloc(numWorkers ? numWorkers : 1, sizeof(struct worker));
+    struct pollfd *polls = calloc(numWorkers ? numWorkers : 1, sizeof(struct pollfd));
+    struct kept *kept = keepOrder ? calloc(numArgs ? numArgs : 1, sizeof(struct kept)) : 0;
+    if(workers == 0 || polls == 0 || (keepOrder && kept == 0))
+    {
+        perror("parallel");
+        free(workers);
+        free(polls);
+        free(kept);
+        free(argData);
+        if(argData != 0)
+            free(args);
+        return 1;
+    }
+
+    int nextJob = 0, nextOutput = 0, running = 0, failed = 0, interrupted = 0;
+
+    while(running > 0 || (nextJob < numArgs && !interrupted))
+    {
+        // Fill every free worker
+        for(i = 0; i < numWorkers && nextJob < numArgs && !interrupted; i++)
+        {
+            if(workers[i].pid > 0)
+                continue;
+
+            int job = nextJob++;
+            int fd = outFd == -1 ? 1 : outFd;
+
+            workers[i].capture = -1;
+            if(capture)
+            {
+                workers[i].capture = memfd_create("parallel", MFD_CLOEXEC);
+                if(workers[i].capture == -1)
+                {
+                    perror("parallel");
+                    interrupted = 1;
+                    failed++;
+                    break;
+                }
+                fd = workers[i].capture;
+            }
+
+            workers[i].job = job;
+            workers[i].pid = startJob(jobWords(call->arena, words, numWords, args[job]), fd);
+            if(workers[i].pid == -1)
+            {
+                failed++;
+                if(workers[i].capture != -1)
+                    close(workers[i].capture);
+                workers[i].pid = 0;
+                if(keepOrder)
+                    kept[job].done = 1;
+                continue;
+            }
+
+            workers[i].pidfd = syscall(SYS_pidfd_open, workers[i].pid, 0);
+            running++;
+        }
+
+        // Wait for any running command to exit
+        int numPolls = 0, unwatched = 0;
+        for(i = 0; i < numWorkers; i++)
+        {
+            polls[i].fd = workers[i].pid > 0 ? workers[i].pidfd : -1;
+            polls[i].events = POLLIN;
+            polls[i].revents = 0;
+            if(workers[i].pid > 0 && workers[i].pidfd == -1)
+                unwatched = 1;
+            if(workers[i].pid > 0)
+                numPolls++;
+        }
+
+        if(numPolls > 0 && poll(polls, numWorkers, unwatched ? PARALLEL_POLL_MS : -1) == -1 && errno != EINTR)
+        {
+            perror("parallel");
+            break;
+        }
+
+        // Reap what exited and refill its worker on the next round
+        for(i = 0; i < numWorkers; i++)
+        {
+            int status;
+
+            if(workers[i].pid <= 0 || (workers[i].pidfd != -1 && !(polls[i].revents & POLLIN)))
+                continue;
+            if(waitpid(workers[i].pid, &status, WNOHANG) <= 0)
+                continue;
+
+            TRACE(TRACE_EXIT, 0, workers[i].pid, status, NULL);
+
+            if(workers[i].pidfd != -1)
+                close(workers[i].pidfd);
+            workers[i].pid = 0;
+            running--;
+
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failed++;
+            if(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+                interrupted = 1;
+
+            if(workers[i].capture == -1)
+                continue;
+
+            size_t len;
+            char *data = takeOutput(workers[i].capture, &len);
+
+            if(keepOrder)
+            {
+                kept[workers[i].job].data = data;
+                kept[workers[i].job].len = len;
+                kept[workers[i].job].done = 1;
+            }
+            else
+            {
+                outWrite(call->out, data, len);
+                free(data);
+            }
+        }
+
+        // Write the outputs that are next in order
+        while(keepOrder && nextOutput < numArgs && kept[nextOutput].done)
+        {
+            outWrite(call->out, kept[nextOutput].data, kept[nextOutput].len);
+            free(kept[nextOutput].data);
+            nextOutput++;
+        }
+    }
+
+    // After ctrl-c some args never ran: write what the commands that did run produced
+    for(; keepOrder && nextOutput < numArgs; nextOutput++)
+    {
+        outWrite(call->out, kept[nextOutput].data, kept[nextOutput].len);
+        free(kept[nextOutput].data);
+    }
+
+    free(workers);
+    free(polls);
+    free(kept);
+    if(argData != 0)
+    {
+        free(argData);
+        free(args);
+    }
+
+    return failed > PARALLEL_MAX_FAILED ? PARALLEL_MAX_FAILED : failed;
+}
@@ -0,0 +1,454 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The test and [ builtins. Up to four arguments are decided by their number,
+ *      as POSIX requires (so `test -n` or `test ! = x` mean what they say); longer
+ *      expressions are read by a small recursive descent parser with !, -a, -o and parentheses
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "wish.h"
+
+// The words being tested and the position of the parser
+struct testState
+{
+    char **args;
+    int numArgs;
+    int pos;
+    int error;      // set once a message was displayed, the exit value is then 2
+};
+
+static int testOr(struct testState *state);
+
+
+/********************
+ * testError
+ * Description: Reports an invalid expression
+ * -----
+ * Input: state - the parser state
+ *        message - the message, formatted with arg
+ *        arg - the word at fault
+ * Output: Returns 0, the value of the failed expression
+ * ******************/
+
+static int testError(struct testState *state, const char *message, const char *arg)
+{
+    if(!state->error)
+    {
+        fprintf(stderr, "test: ");
+        fprintf(stderr, message, arg);
+        fprintf(stderr, "\n");
+    }
+
+    state->error = 1;
+    return 0;
+}
+
+
+/********************
+ * isUnary
+ * Description: Tells if a word is a unary operator (file tests, -z, -n)
+ * -----
+ * Input: op - the word
+ * Output: Returns 1 for a unary operator, otherwise 0
+ * ******************/
+
+static int isUnary(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghkLnprsStuwxzGO", op[1]) != 0;
+}
+
+
+/********************
+ * isBinary
+ * Description: Tells if a word is a binary operator. -a and -o are handled by the parser
+ * -----
+ * Input: op - the word
+ * Output: Returns 1 for a binary operator, otherwise 0
+ * ******************/
+
+static int isBinary(const char *op)
+{
+    static const char *OPERATORS[] =
+    {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", 0
+    };
+    int i;
+
+    for(i = 0; OPERATORS[i] != 0; i++)
+    {
+        if(strcmp(op, OPERATORS[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * testInteger
+ * Description: Reads an integer operand. Blanks around the number are allowed
+ * -----
+ * Input: state - the parser state
+ *        arg - the operand
+ *        value - set to its value
+ * Output: Returns -1 if the operand is not an integer (a message is displayed), otherwise 0
+ * ******************/
+
+static int testInteger(struct testState *state, const char *arg, long long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    while(*end == ' ' || *end == '\t')
+        end++;
+
+    if(end == arg || *end != '\0' || errno == ERANGE)
+    {
+        testError(state, "%s: integer expression expected", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * testUnary
+ * Description: Evaluates a unary operator
+ * -----
+ * Input: op - the operator
+ *        arg - the operand
+ * Output: Returns 1 if the test succeeds, otherwise 0
+ * ******************/
+
+static int testUnary(const char *op, const char *arg)
+{
+    struct stat info;
+
+    switch(op[1])
+    {
+        case 'z': return arg[0] == '\0';
+        case 'n': return arg[0] != '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode);
+    }
+
+    if(stat(arg, &info) != 0)
+        return 0;
+
+    switch(op[1])
+    {
+        case 'b': return S_ISBLK(info.st_mode);
+        case 'c': return S_ISCHR(info.st_mode);
+        case 'd': return S_ISDIR(info.st_mode);
+        case 'f': return S_ISREG(info.st_mode);
+        case 'p': return S_ISFIFO(info.st_mode);
+        case 'S': return S_ISSOCK(info.st_mode);
+        case 'g': return (info.st_mode & S_ISGID) != 0;
+        case 'u': return (info.st_mode & S_ISUID) != 0;
+        case 'k': return (info.st_mode & S_ISVTX) != 0;
+        case 's': return info.st_size > 0;
+        case 'G': return info.st_gid == getegid();
+        case 'O': return info.st_uid == geteuid();
+    }
+
+    // -e
+    return 1;
+}
+
+
+/********************
+ * testBinary
+ * Description: Evaluates a binary operator
+ * -----
+ * Input: state - the parser state
+ *        left - the left operand
+ *        op - the operator
+ *        right - the right operand
+ * Output: Returns 1 if the test succeeds, otherwise 0
+ * ******************/
+
+static int testBinary(struct testState *state, const char *left, const char *op, const char *right)
+{
+    struct stat leftInfo, rightInfo;
+    long long a, b;
+
+    if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if(strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+    if(strcmp(op, "<") == 0)
+        return strcmp(left, right) < 0;
+    if(strcmp(op, ">") == 0)
+        return strcmp(left, right) > 0;
+
+    // File comparisons: a file that does not exist is older than any file
+    if(op[1] == 'n' && op[2] == 't')
+        return stat(left, &leftInfo) == 0 && (stat(right, &rightInfo) != 0 ||
+            leftInfo.st_mtim.tv_sec > rightInfo.st_mtim.tv_sec ||
+            (leftInfo.st_mtim.tv_sec == rightInfo.st_mtim.tv_sec && leftInfo.st_mtim.tv_nsec > rightInfo.st_mtim.tv_nsec));
+    if(op[1] == 'o' && op[2] == 't')
+        return stat(right, &rightInfo) == 0 && (stat(left, &leftInfo) != 0 ||
+            leftInfo.st_mtim.tv_sec < rightInfo.st_mtim.tv_sec ||
+            (leftInfo.st_mtim.tv_sec == rightInfo.st_mtim.tv_sec && leftInfo.st_mtim.tv_nsec < rightInfo.st_mtim.tv_nsec));
+    if(op[1] == 'e' && op[2] == 'f')
+        return stat(left, &leftInfo) == 0 && stat(right, &rightInfo) == 0 &&
+            leftInfo.st_dev == rightInfo.st_dev && leftInfo.st_ino == rightInfo.st_ino;
+
+    // Integer comparisons
+    if(testInteger(state, left, &a) == -1 || testInteger(state, right, &b) == -1)
+        return 0;
+
+    if(strcmp(op, "-eq") == 0) return a == b;
+    if(strcmp(op, "-ne") == 0) return a != b;
+    if(strcmp(op, "-lt") == 0) return a < b;
+    if(strcmp(op, "-le") == 0) return a <= b;
+    if(strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+
+/********************
+ * testPrimary
+ * Description: Parses and evaluates a primary: ( expression ), a unary test, a binary test
+ *      or a lone string
+ * -----
+ * Input: state - the parser state
+ * Output: Returns 1 if the primary is true, otherwise 0
+ * ******************/
+
+static int testPrimary(struct testState *state)
+{
+    char **args = state->args + state->pos;
+    int left = state->numArgs - state->pos;
+
+    if(left <= 0)
+        return testError(state, "%s: argument expected", state->pos > 0 ? args[-1] : "test");
+
+    // A binary operator comes first, so `test -f = -f` compares strings
+    if(left >= 3 && isBinary(args[1]))
+    {
+        state->pos += 3;
+        return testBinary(state, args[0], args[1], args[2]);
+    }
+
+    if(strcmp(args[0], "(") == 0)
+    {
+        state->pos++;
+        int value = testOr(state);
+        if(state->pos >= state->numArgs || strcmp(state->args[state->pos], ")") != 0)
+            return testError(state, "%s", "')' expected");
+
+        state->pos++;
+        return value;
+    }
+
+    if(left >= 2 && isUnary(args[0]))
+    {
+        state->pos += 2;
+        return testUnary(args[0], args[1]);
+    }
+
+    state->pos++;
+    return args[0][0] != '\0';
+}
+
+
+/********************
+ * testNot
+ * Description: Parses and evaluates ! primary
+ * -----
+ * Input: state - the parser state
+ * Output: Returns 1 if the expression is true, otherwise 0
+ * ******************/
+
+static int testNot(struct testState *state)
+{
+    if(state->pos < state->numArgs && strcmp(state->args[state->pos], "!") == 0)
+    {
+        state->pos++;
+        return !testNot(state);
+    }
+
+    return testPrimary(state);
+}
+
+
+/********************
+ * testAnd
+ * Description: Parses and evaluates expressions joined by -a
+ * -----
+ * Input: state - the parser state
+ * Output: Returns 1 if the expression is true, otherwise 0
+ * ******************/
+
+static int testAnd(struct testState *state)
+{
+    int value = testNot(state);
+
+    while(state->pos < state->numArgs && strcmp(state->args[state->pos], "-a") == 0)
+    {
+        state->pos++;
+        value = testNot(state) && value;
+    }
+
+    return value;
+}
+
+
+/********************
+ * testOr
+ * Description: Parses and evaluates expressions joined by -o, the lowest precedence
+ * -----
+ * Input: state - the parser state
+ * Output: Returns 1 if the expression is true, otherwise 0
+ * ******************/
+
+static int testOr(struct testState *state)
+{
+    int value = testAnd(state);
+
+    while(state->pos < state->numArgs && strcmp(state->args[state->pos], "-o") == 0)
+    {
+        state->pos++;
+        value = testAnd(state) || value;
+    }
+
+    return value;
+}
+
+
+/********************
+ * testCount
+ * Description: Evaluates up to four arguments by their number, as POSIX specifies, and
+ *      anything longer with the expression parser
+ * -----
+ * Input: state - the parser state, pos is the first argument
+ * Output: Returns 1 if the expression is true, otherwise 0
+ * ******************/
+
+static int testCount(struct testState *state)
+{
+    char **args = state->args + state->pos;
+    int count = state->numArgs - state->pos;
+
+    switch(count)
+    {
+        case 0:
+            return 0;
+
+        case 1:
+            state->pos++;
+            return args[0][0] != '\0';
+
+        case 2:
+            if(strcmp(args[0], "!") == 0)
+            {
+                state->pos++;
+                return !testCount(state);
+            }
+            if(isUnary(args[0]))
+            {
+                state->pos += 2;
+                return testUnary(args[0], args[1]);
+            }
+            return testError(state, "%s: unary operator expected", args[0]);
+
+        case 3:
+            if(isBinary(args[1]))
+            {
+                state->pos += 3;
+                return testBinary(state, args[0], args[1], args[2]);
+            }
+            if(strcmp(args[1], "-a") == 0 || strcmp(args[1], "-o") == 0)
+                break;
+            if(strcmp(args[0], "!") == 0)
+            {
+                state->pos++;
+                return !testCount(state);
+            }
+            if(strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0)
+            {
+                state->numArgs--;
+                state->pos++;
+                int value = testCount(state);
+                state->numArgs++;
+                state->pos++;
+                return value;
+            }
+            return testError(state, "%s: binary operator expected", args[1]);
+
+        case 4:
+            if(strcmp(args[0], "!") == 0)
+            {
+                state->pos++;
+                return !testCount(state);
+            }
+            if(strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0)
+            {
+                state->numArgs--;
+                state->pos++;
+                int value = testCount(state);
+                state->numArgs++;
+                state->pos++;
+                return value;
+            }
+            break;
+    }
+
+    return testOr(state);
+}
+
+
+/********************
+ * builtIn_test
+ * Description: The test and [ builtins. [ needs ] as its last argument
+ * -----
+ * Input: call - the words of the command
+ * Output: Returns 0 if the expression is true, 1 if it is false, 2 if it is not valid
+ * ******************/
+
+int builtIn_test(struct builtinCall *call)
+{
+    struct testState state;
+
+    state.args = call->argList + 1;
+    state.numArgs = call->numArgs - 1;
+    state.pos = 0;
+    state.error = 0;
+
+    if(strcmp(call->argList[0], "[") == 0)
+    {
+        if(state.numArgs == 0 || strcmp(state.args[state.numArgs - 1], "]") != 0)
+        {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        state.numArgs--;
+    }
+
+    int value = testCount(&state);
+
+    if(!state.error && state.pos < state.numArgs)
+        testError(&state, "%s: too many arguments", state.args[state.pos]);
+
+    if(state.error)
+        return 2;
+
+    return value ? 0 : 1;
+}
@@ -0,0 +1,891 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The builtin commands and their dispatch table. Besides the commands that
+ *      change the shell itself (exit, cd, status, hash, wait, exec) and parallel, the common utilities echo,
+ *      printf, test/[, pwd, true and false run inside the shell, so scripts full of them never fork,
+ *      and so do cat, cp and tee (see builtin_files.c).
+ *      The utilities may be turned off with `enable -n name` to run the programs instead
+ *      (a name with a / always runs the program)
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "wish.h"
+
+// Flags of a builtin
+#define BUILTIN_UTILITY    1    // also exists as a program, may be turned off with enable -n
+#define BUILTIN_KEEPSTATUS 2    // does not change STATUS (the original builtins exit, cd and status)
+#define BUILTIN_SHELL      4    // changes the shell itself, no effect inside a pipeline
+#define BUILTIN_STREAM     8    // reads its input to the end, only runs where the shell waits for it
+#define BUILTIN_REDIRECTS  16   // applies its redirections to the shell itself (exec)
+
+// A builtin command
+struct builtin
+{
+    const char *name;
+    int (*run)(struct builtinCall *call);
+    int flags;
+};
+
+static int builtIn_exit(struct builtinCall *call);
+static int builtIn_cdCall(struct builtinCall *call);
+static int builtIn_status(struct builtinCall *call);
+static int builtIn_hashCall(struct builtinCall *call);
+static int builtIn_enable(struct builtinCall *call);
+static int builtIn_true(struct builtinCall *call);
+static int builtIn_false(struct builtinCall *call);
+static int builtIn_echo(struct builtinCall *call);
+static int builtIn_printf(struct builtinCall *call);
+static int builtIn_pwd(struct builtinCall *call);
+static int builtIn_wait(struct builtinCall *call);
+static int builtIn_exec(struct builtinCall *call);
+
+// The dispatch table, sorted by name for the binary search
+static const struct builtin BUILTINS[] =
+{
+    {"[",       builtIn_test,       BUILTIN_UTILITY},
+    {"cat",     builtIn_cat,        BUILTIN_UTILITY | BUILTIN_STREAM},
+    {"cd",      builtIn_cdCall,     BUILTIN_KEEPSTATUS | BUILTIN_SHELL},
+    {"cp",      builtIn_cp,         BUILTIN_UTILITY},
+    {"echo",    builtIn_echo,       BUILTIN_UTILITY},
+    {"enable",  builtIn_enable,     0},
+    {"exec",    builtIn_exec,       BUILTIN_SHELL | BUILTIN_REDIRECTS},
+    {"exit",    builtIn_exit,       BUILTIN_KEEPSTATUS | BUILTIN_SHELL},
+    {"false",   builtIn_false,      BUILTIN_UTILITY},
+    {"hash",    builtIn_hashCall,   0},
+    {"parallel", builtIn_parallel,  0},
+    {"printf",  builtIn_printf,     BUILTIN_UTILITY},
+    {"pwd",     builtIn_pwd,        BUILTIN_UTILITY},
+    {"status",  builtIn_status,     BUILTIN_KEEPSTATUS},
+    {"tee",     builtIn_tee,        BUILTIN_UTILITY | BUILTIN_STREAM},
+    {"test",    builtIn_test,       BUILTIN_UTILITY},
+    {"true",    builtIn_true,       BUILTIN_UTILITY},
+    {"wait",    builtIn_wait,       BUILTIN_KEEPSTATUS | BUILTIN_SHELL},
+};
+
+#define NUM_BUILTINS (int)(sizeof(BUILTINS) / sizeof(BUILTINS[0]))
+
+// Set for the builtins turned off with enable -n
+static char disabled[NUM_BUILTINS];
+
+
+/********************
+ * lookupBuiltin
+ * Description: Finds a name in the dispatch table, whether it is enabled or not. Compiled
+ *      commands look their builtin up once, see ast.c
+ * -----
+ * Input: name - the command name
+ * Output: Returns the index of the builtin, or -1
+ * ******************/
+
+int lookupBuiltin(const char *name)
+{
+    int low = 0, high = NUM_BUILTINS - 1;
+
+    while(low <= high)
+    {
+        int middle = (low + high) / 2;
+        int order = strcmp(name, BUILTINS[middle].name);
+
+        if(order == 0)
+            return middle;
+        if(order < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+
+    return -1;
+}
+
+
+/********************
+ * findBuiltin
+ * Description: Tells if a command runs inside the shell
+ * -----
+ * Input: name - the command name
+ * Output: Returns the index of the builtin, or -1 if the command is a program
+ * ******************/
+
+int findBuiltin(const char *name)
+{
+    return builtinEnabled(lookupBuiltin(name));
+}
+
+
+/********************
+ * builtinEnabled
+ * Description: Checks a builtin found by lookupBuiltin against enable -n
+ * -----
+ * Input: index - the index of the builtin, or -1
+ * Output: Returns the index if the builtin runs inside the shell, otherwise -1
+ * ******************/
+
+int builtinEnabled(int index)
+{
+    if(index == -1 || disabled[index])
+        return -1;
+
+    return index;
+}
+
+
+/********************
+ * builtinKeepsStatus
+ * Description: Tells if a builtin leaves STATUS alone, like exit, cd and status always did
+ * -----
+ * Input: index - the index of the builtin
+ * Output: Returns 1 if STATUS is not changed by the builtin, otherwise 0
+ * ******************/
+
+int builtinKeepsStatus(int index)
+{
+    return (BUILTINS[index].flags & BUILTIN_KEEPSTATUS) != 0;
+}
+
+
+/********************
+ * builtinIsUtility
+ * Description: Tells if a builtin only reads its arguments and writes its output, so it may
+ *      run inside the shell wherever a program could (see substitute.c)
+ * -----
+ * Input: index - the index of the builtin
+ * Output: Returns 1 for the utility builtins, otherwise 0
+ * ******************/
+
+int builtinIsUtility(int index)
+{
+    return (BUILTINS[index].flags & BUILTIN_UTILITY) != 0;
+}
+
+
+/********************
+ * builtinRedirectsShell
+ * Description: Tells if a builtin applies its redirections to the shell itself, so they must
+ *      not be undone once it returns
+ * -----
+ * Input: index - the index of the builtin
+ * Output: Returns 1 for exec, otherwise 0
+ * ******************/
+
+int builtinRedirectsShell(int index)
+{
+    return (BUILTINS[index].flags & BUILTIN_REDIRECTS) != 0;
+}
+
+
+/********************
+ * builtinStreams
+ * Description: Tells if a builtin reads its input until it ends, which may take forever
+ * -----
+ * Input: index - the index of the builtin
+ * Output: Returns 1 for cat and tee, otherwise 0
+ * ******************/
+
+int builtinStreams(int index)
+{
+    return (BUILTINS[index].flags & BUILTIN_STREAM) != 0;
+}
+
+
+/********************
+ * runBuiltin
+ * Description: Runs a builtin inside the shell. Inside a pipeline of several commands the
+ *      builtins that change the shell itself (exit and cd) have no effect, as each stage of
+ *      a pipeline behaves like a separate process
+ * -----
+ * Input: index - the index of the builtin
+ *        call - the words, input and output of the command
+ * Output: Returns the exit value of the builtin
+ * ******************/
+
+int runBuiltin(int index, struct builtinCall *call)
+{
+    if(call->inPipeline && (BUILTINS[index].flags & BUILTIN_SHELL))
+        return 0;
+
+    return BUILTINS[index].run(call);
+}
+
+
+// ..............
+// Built in: exit
+static int builtIn_exit(struct builtinCall *call)
+{
+    // Clean up shell and exit the program. Refer to utility.c for details of this function
+    exitShell(call->arena, 0);
+    return 0;
+}
+
+
+// ............
+// Built in: cd
+static int builtIn_cdCall(struct builtinCall *call)
+{
+    // Call the built in cd program found in utility.c. Pass the first argument after "cd" (may be NULL)
+    builtIn_cd(call->argList[1]);
+    return 0;
+}
+
+
+// ................
+// Built in: status
+static int builtIn_status(struct builtinCall *call)
+{
+    // Display specific message depending on if the signal was terminated by signal or not
+    if(WIFSIGNALED(STATUS))
+        outPrintf(call->out, "terminated by signal %d\n", WTERMSIG(STATUS));
+    else
+        outPrintf(call->out, "exit value %d\n", WEXITSTATUS(STATUS));
+
+    // The resources used by the last command, if it was measured (time or WISH_TIME)
+    if(LAST_USAGE.valid)
+        usagePrint(call->out, &LAST_USAGE);
+
+    return 0;
+}
+
+
+// ..............
+// Built in: hash
+static int builtIn_hashCall(struct builtinCall *call)
+{
+    // Show or clear the command hash table. Refer to pathcache.c for details
+    return builtIn_hash(call->argList, call->out);
+}
+
+
+/********************
+ * builtIn_wait
+ * Description: The wait builtin. `wait` waits for every background job, `wait PID...` for the
+ *      jobs of the processes and `wait -n` for the next job to finish. STATUS becomes the wait
+ *      status of the job waited for (0 for every job), exit value 127 if there is no such job
+ *      and 130 if ctrl-c interrupted the wait. Refer to waitJob in events.c
+ * -----
+ * Input: call - the words of the command
+ * Output: Returns the exit value, STATUS is set
+ * ******************/
+
+static int builtIn_wait(struct builtinCall *call)
+{
+    char **args = call->argList + 1;
+    int status = 0, result = 0;
+
+    if(*args != 0 && strcmp(*args, "-n") == 0)
+    {
+        result = waitJob(0, &status);
+        if(result == -1)
+            status = W_EXITCODE(127, 0);
+    }
+    else if(*args == 0)
+    {
+        while(numJobs() > 0 && (result = waitJob(0, &status)) == 0)
+            ;
+        status = 0;
+    }
+
+    for(; *args != 0 && result != 1 && strcmp(*args, "-n") != 0; args++)
+    {
+        char *end;
+        long pid = strtol(*args, &end, 10);
+
+        if(*end != '\0' || pid <= 0 || end == *args)
+        {
+            fprintf(stderr, "wait: %s: not a process ID\n", *args);
+            status = W_EXITCODE(2, 0);
+            continue;
+        }
+
+        result = waitJob((pid_t)pid, &status);
+        if(result == -1)
+        {
+            fprintf(stderr, "wait: pid %ld is not a job of this shell\n", pid);
+            status = W_EXITCODE(127, 0);
+        }
+    }
+
+    // Interrupted by ctrl-c, like a command terminated by SIGINT would leave $?
+    if(result == 1)
+        status = W_EXITCODE(128 + SIGINT, 0);
+
+    STATUS = status;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+
+/********************
+ * builtIn_enable
+ * Description: The enable builtin. `enable -n name...` turns utilities off so their programs
+ *      run instead, `enable name...` turns them back on. With no name, lists the builtins
+ *      that are on (or off, with -n)
+ * -----
+ * Input: call - the words and output of the command
+ * Output: Returns 1 if a name is not a utility builtin, otherwise 0
+ * ******************/
+
+static int builtIn_enable(struct builtinCall *call)
+{
+    int i, off = 0, result = 0;
+    char **args = call->argList + 1;
+
+    if(*args != 0 && strcmp(*args, "-n") == 0)
+    {
+        off = 1;
+        args++;
+    }
+
+    if(*args == 0)
+    {
+        for(i = 0; i < NUM_BUILTINS; i++)
+        {
+            if(disabled[i] == off)
+                outPrintf(call->out, "enable %s%s\n", off ? "-n " : "", BUILTINS[i].name);
+        }
+        return 0;
+    }
+
+    for(; *args != 0; args++)
+    {
+        i = lookupBuiltin(*args);
+        if(i == -1 || !(BUILTINS[i].flags & BUILTIN_UTILITY))
+        {
+            fprintf(stderr, "enable: %s: not a utility builtin\n", *args);
+            result = 1;
+        }
+        else
+            disabled[i] = off;
+    }
+
+    return result;
+}
+
+
+// ..............
+// Built in: true
+static int builtIn_true(struct builtinCall *call)
+{
+    return 0;
+}
+
+
+// ...............
+// Built in: false
+static int builtIn_false(struct builtinCall *call)
+{
+    return 1;
+}
+
+
+// .............
+// Built in: pwd
+static int builtIn_pwd(struct builtinCall *call)
+{
+    char path[PATH_MAX];
+
+    if(getcwd(path, sizeof(path)) == 0)
+    {
+        perror("pwd");
+        return 1;
+    }
+
+    outPrintf(call->out, "%s\n", path);
+    return 0;
+}
+
+
+/********************
+ * putEscaped
+ * Description: Writes a string, replacing backslash escapes (\n, \t, \\, octal and the like)
+ * -----
+ * Input: out - the output
+ *        str - the string
+ *        zeroOctal - 1 if octal escapes start with \0 (echo, printf %b), 0 for \NNN (printf format)
+ * Output: Returns 1 if \c was found, which ends all output, otherwise 0
+ * ******************/
+
+static int putEscaped(struct output *out, const char *str, int zeroOctal)
+{
+    const char *run = str;
+
+    while(*str)
+    {
+        if(*str != '\\' || str[1] == '\0')
+        {
+            str++;
+            continue;
+        }
+
+        // Write the characters before the escape at once
+        outWrite(out, run, str - run);
+        str++;
+
+        char c = *str++;
+        switch(c)
+        {
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case 'e': c = '\033'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'v': c = '\v'; break;
+            case '\\': break;
+            case 'c': return 1;
+
+            default:
+                // Octal value: \0NNN or \NNN
+                if((zeroOctal && c == '0') || (!zeroOctal && c >= '0' && c <= '7'))
+                {
+                    int digits = 0, value = zeroOctal ? 0 : c - '0';
+                    while(digits < (zeroOctal ? 3 : 2) && *str >= '0' && *str <= '7')
+                    {
+                        value = value * 8 + (*str++ - '0');
+                        digits++;
+                    }
+                    c = (char)value;
+                }
+
+                // Not an escape: keep the backslash
+                else
+                {
+                    outWrite(out, "\\", 1);
+                }
+                break;
+        }
+
+        outWrite(out, &c, 1);
+        run = str;
+    }
+
+    outWrite(out, run, str - run);
+    return 0;
+}
+
+
+/********************
+ * builtIn_echo
+ * Description: The echo builtin, like the echo program: -n leaves out the newline, -e
+ *      replaces backslash escapes and -E does not
+ * -----
+ * Input: call - the words and output of the command
+ * Output: Returns 0
+ * ******************/
+
+static int builtIn_echo(struct builtinCall *call)
+{
+    char **args = call->argList + 1;
+    int newline = 1, escapes = 0;
+
+    // Options are only recognized if every letter is one of n, e and E
+    while(*args != 0 && (*args)[0] == '-' && (*args)[1] != '\0' && strspn(*args + 1, "neE") == strlen(*args + 1))
+    {
+        const char *c;
+        for(c = *args + 1; *c; c++)
+        {
+            if(*c == 'n')
+                newline = 0;
+            else
+                escapes = (*c == 'e');
+        }
+        args++;
+    }
+
+    for(; *args != 0; args++)
+    {
+        if(escapes)
+        {
+            if(putEscaped(call->out, *args, 1))
+                return 0;
+        }
+        else
+            outWrite(call->out, *args, strlen(*args));
+
+        if(args[1] != 0)
+            outWrite(call->out, " ", 1);
+    }
+
+    if(newline)
+        outWrite(call->out, "\n", 1);
+
+    return 0;
+}
+
+
+/********************
+ * printfNumber
+ * Description: Converts a printf argument to a number. A leading quote gives the value of
+ *      the character that follows, like the printf program
+ * -----
+ * Input: arg - the argument, or NULL if the arguments ran out (the value is 0)
+ *        isFloat - 1 to convert to a double
+ *        integer - set to the integer value
+ *        real - set to the floating point value
+ * Output: Returns -1 if the argument is not a valid number (a message is displayed), otherwise 0
+ * ******************/
+
+static int printfNumber(const char *arg, int isFloat, long long *integer, double *real)
+{
+    char *end;
+
+    *integer = 0;
+    *real = 0;
+    if(arg == 0 || *arg == '\0')
+        return 0;
+
+    if(arg[0] == '\'' || arg[0] == '"')
+    {
+        *integer = (unsigned char)arg[1];
+        *real = *integer;
+        return 0;
+    }
+
+    errno = 0;
+    if(isFloat)
+        *real = strtod(arg, &end);
+    else if(arg[0] == '-')
+        *integer = strtoll(arg, &end, 0);
+    else
+        *integer = (long long)strtoull(arg, &end, 0);
+
+    if(*end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * printfOnce
+ * Description: Writes the printf format once, taking the arguments it needs. A * width or
+ *      precision is taken from the arguments and written into the directive, so every
+ *      conversion is handed to outPrintf with a single value
+ * -----
+ * Input: out - the output
+ *        format - the format
+ *        args - the arguments left, advanced past the ones used
+ *        result - set to 1 if an argument was not valid
+ * Output: Returns 1 if \c was found, -1 if the format is not valid, otherwise 0
+ * ******************/
+
+static int printfOnce(struct output *out, const char *format, char ***args, int *result)
+{
+    // The directive being built, with the length modifier the argument needs
+    char spec[64];
+    long long integer;
+    double real;
+    const char *run = format;
+
+    while(*format)
+    {
+        if(*format == '\\')
+        {
+            // Copy one escape sequence (at most \NNN) and let putEscaped replace it
+            const char *start = format;
+            char escape[8];
+
+            outWrite(out, run, format - run);
+
+            format++;
+            if(*format >= '0' && *format <= '7')
+            {
+                while(format - start < 4 && *format >= '0' && *format <= '7')
+                    format++;
+            }
+            else if(*format != '\0')
+                format++;
+
+            memcpy(escape, start, format - start);
+            escape[format - start] = '\0';
+            if(putEscaped(out, escape, 0))
+                return 1;
+
+            run = format;
+            continue;
+        }
+
+        if(*format != '%')
+        {
+            format++;
+            continue;
+        }
+
+        outWrite(out, run, format - run);
+
+        if(format[1] == '%')
+        {
+            outWrite(out, "%", 1);
+            format += 2;
+            run = format;
+            continue;
+        }
+
+        // %[flags][width][.precision]conversion
+        int len = 0;
+        spec[len++] = *format++;
+        while(*format && strchr("-+ #0", *format) && len < 8)
+            spec[len++] = *format++;
+
+        if(*format == '*')
+        {
+            if(printfNumber(**args, 0, &integer, &real) == -1)
+                *result = 1;
+            if(**args)
+                (*args)++;
+            len += snprintf(spec + len, 16, "%d", (int)integer);
+            format++;
+        }
+        else
+        {
+            while(*format >= '0' && *format <= '9' && len < 24)
+                spec[len++] = *format++;
+        }
+
+        if(*format == '.')
+        {
+            format++;
+            if(*format == '*')
+            {
+                if(printfNumber(**args, 0, &integer, &real) == -1)
+                    *result = 1;
+                if(**args)
+                    (*args)++;
+
+                // A negative precision is taken as if it was left out
+                if(integer >= 0)
+                    len += snprintf(spec + len, 16, ".%d", (int)integer);
+                format++;
+            }
+            else
+            {
+                spec[len++] = '.';
+                while(*format >= '0' && *format <= '9' && len < 48)
+                    spec[len++] = *format++;
+            }
+        }
+
+        char conversion = *format;
+        if(conversion == '\0' || strchr("diouxXcsbfeEgGaA", conversion) == 0)
+        {
+            fprintf(stderr, "printf: %%%c: invalid directive\n", conversion ? conversion : ' ');
+            return -1;
+        }
+        format++;
+
+        const char *arg = **args;
+        if(arg != 0)
+            (*args)++;
+
+        // Integer conversions take a long long, %b and %c are written as strings
+        if(strchr("diouxX", conversion))
+        {
+            spec[len++] = 'l';
+            spec[len++] = 'l';
+        }
+        spec[len++] = (conversion == 'b' || conversion == 'c') ? 's' : conversion;
+        spec[len] = '\0';
+
+        if(conversion == 'b')
+        {
+            // %b: the argument with its escapes replaced
+            struct output escaped;
+            outInit(&escaped, -1);
+            int stop = putEscaped(&escaped, arg ? arg : "", 1);
+            outWrite(&escaped, "", 1);
+            outPrintf(out, spec, escaped.data);
+            outRelease(&escaped);
+
+            if(stop)
+                return 1;
+        }
+        else if(conversion == 'c')
+        {
+            char first[2] = {arg ? arg[0] : '\0', '\0'};
+            outPrintf(out, spec, first);
+        }
+        else if(conversion == 's')
+            outPrintf(out, spec, arg ? arg : "");
+        else
+        {
+            int isFloat = strchr("feEgGaA", conversion) != 0;
+            if(printfNumber(arg, isFloat, &integer, &real) == -1)
+                *result = 1;
+
+            if(isFloat)
+                outPrintf(out, spec, real);
+            else
+                outPrintf(out, spec, integer);
+        }
+
+        run = format;
+    }
+
+    outWrite(out, run, format - run);
+    return 0;
+}
+
+
+/********************
+ * builtIn_printf
+ * Description: The printf builtin, like the printf program. The format is used again as long
+ *      as arguments are left
+ * -----
+ * Input: call - the words and output of the command
+ * Output: Returns 1 if an argument was not valid, 2 for a missing or invalid format, otherwise 0
+ * ******************/
+
+static int builtIn_printf(struct builtinCall *call)
+{
+    int result = 0;
+
+    if(call->argList[1] == 0)
+    {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = call->argList[1];
+    char **args = call->argList + 2;
+
+    while(1)
+    {
+        char **before = args;
+
+        int stop = printfOnce(call->out, format, &args, &result);
+        if(stop == -1)
+            return 2;
+
+        // Stop at \c, once the arguments are used up, or if the format takes none
+        if(stop == 1 || *args == 0 || args == before)
+            break;
+    }
+
+    return result;
+}
+
+
+/********************
+ * builtIn_exec
+ * Description: The exec builtin. Without a command, its redirections are applied to the shell
+ *      itself and stay for every command after it: after `exec >>log 2>&1` the commands write
+ *      to the log without opening it again. With a command, the program replaces the shell
+ * -----
+ * Input: call - the words of the command and the plan holding its redirections
+ * Output: Returns 0, 1 if a descriptor can not be redirected, 126 or 127 if the program can
+ *        not be run (a script exits with that value instead)
+ * ******************/
+
+static int builtIn_exec(struct builtinCall *call)
+{
+    struct spawnPlan *plan = call->plan;
+    struct stat info;
+    const char *path = 0;
+    int i, j, fdFlags;
+
+    // A program that can not run is found before the shell changes anything. Like sh, a
+    // script stops there, a terminal user gets the prompt back
+    if(call->numArgs > 1)
+    {
+        int error = 0;
+
+        path = pathLookup(call->argList[1]);
+        if(path == 0)
+            error = ENOENT;
+        else if(stat(path, &info) == -1)
+            error = errno;
+        else if(!S_ISREG(info.st_mode) || access(path, X_OK) == -1)
+            error = EACCES;
+
+        if(error != 0)
+        {
+            fprintf(stderr, "exec: %s: %s\n", call->argList[1], strerror(error));
+            if(!INTERACTIVE)
+                exitShell(call->arena, error == ENOENT ? 127 : 126);
+            return error == ENOENT ? 127 : 126;
+        }
+    }
+
+    // The shell's own descriptors (script, event loop, jobs) are close-on-exec, like the
+    // descriptors the plan opened
+    for(i = 0; plan != 0 && i < plan->numActions; i++)
+    {
+        int fd = plan->actions[i].fd;
+
+        for(j = 0; j < plan->numActions && plan->actions[j].srcFd != fd; j++)
+            ;
+
+        if(j == plan->numActions && (fdFlags = fcntl(fd, F_GETFD)) != -1 && (fdFlags & FD_CLOEXEC))
+        {
+            fprintf(stderr, "exec: %d: file descriptor used by the shell\n", fd);
+            return 1;
+        }
+
+        // Commands read from stdin are buffered by the shell and watched by the event loop
+        if(fd == 0 && path == 0 && inputStream() == 0)
+        {
+            fprintf(stderr, "exec: 0: the shell reads its commands from it\n");
+            return 1;
+        }
+    }
+
+    // What the shell already buffered goes to the descriptors it was written for
+    fflush(stdout);
+    fflush(stderr);
+
+    for(i = 0; plan != 0 && i < plan->numActions; i++)
+    {
+        if(dup2(plan->actions[i].srcFd, plan->actions[i].fd) == -1)
+        {
+            fprintf(stderr, "exec: %d: %s\n", plan->actions[i].fd, strerror(errno));
+            return 1;
+        }
+    }
+
+    if(path == 0)
+    {
+        if(SPAWN_MODE == SPAWN_SERVER)
+            restartSpawnServer();
+        return 0;
+    }
+
+    // The program gets the signals a child of the shell would have
+    struct sigaction default_action, oldInt, oldTstp, oldPipe;
+    sigset_t oldMask;
+    memset(&default_action, 0, sizeof(default_action));
+    default_action.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &default_action, &oldInt);
+    sigaction(SIGTSTP, &default_action, &oldTstp);
+    sigaction(SIGPIPE, &default_action, &oldPipe);
+    sigprocmask(SIG_SETMASK, &CHILD_MASK, &oldMask);
+
+    execv(path, call->argList + 1);
+
+    // The exec failed anyway (a bad executable format): the shell takes its signals back
+    int error = errno;
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    sigaction(SIGINT, &oldInt, NULL);
+    sigaction(SIGTSTP, &oldTstp, NULL);
+    sigaction(SIGPIPE, &oldPipe, NULL);
+
+    fprintf(stderr, "exec: %s: %s\n", call->argList[1], strerror(error));
+    if(!INTERACTIVE)
+        exitShell(call->arena, 126);
+    return 126;
+}
@@ -0,0 +1,787 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The event loop of the wish shell. Instead of signal handlers and
+ *      polling every background process before each prompt, the shell blocks
+ *      SIGCHLD, SIGINT and SIGTSTP, reads them from a signalfd, and watches every
+ *      child through a pidfd. stdin, the signalfd and the pidfds are multiplexed
+ *      with epoll, so finished jobs are reaped and reported the moment they exit
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "wish.h"
+
+// Tags stored in the epoll data for the non-child file descriptors
+#define EVENT_STDIN      ((uint64_t)-1)
+#define EVENT_SIGNAL     ((uint64_t)-2)
+
+// Every other tag is a pidfd: the index of the process in the upper 32 bits and the slot of
+// its background job in the job table (see jobs.c), or FOREGROUND_SLOT, in the lower 32 bits
+#define FOREGROUND_SLOT 0xfffffff0u
+#define CHILD_TAG(slot, proc) (((uint64_t)(proc) << 32) | (uint32_t)(slot))
+#define TAG_SLOT(tag) ((uint32_t)(tag))
+#define TAG_PROC(tag) ((int)((tag) >> 32))
+
+// Maximum number of events handled per epoll_wait call
+#define MAX_EVENTS 32
+
+// File descriptors kept free for redirections. Children beyond that are found through SIGCHLD
+#define FD_RESERVE 32
+
+static int epollFd = -1;
+static int signalFd = -1;
+
+// Set if stdin could be added to the epoll set (regular files can not)
+static int stdinWatched = 0;
+
+// Cleared if the kernel does not support pidfd_open. SIGCHLD is used instead
+static int usePidfd = 1;
+
+// Number of background processes that could not get a pidfd
+static int unwatched = 0;
+
+// Highest descriptor a pidfd may use, set from RLIMIT_NOFILE
+static long pidfdLimit = 1024 - FD_RESERVE;
+
+// The processes of the foreground pipeline being waited on, and how many are not reaped yet
+static struct jobProc *fgProcs = 0;
+static int fgCapacity = 0;
+static int fgNum = 0;
+static int fgRemaining = 0;
+
+// Set if the last process gives STATUS (not the case when the pipeline ends with a builtin)
+static int fgSetsStatus = 0;
+
+// The resources used by the foreground processes reaped so far
+static struct rusage fgUsage;
+
+// Set when ctrl-z arrives while a foreground process runs. The message is shown once it finishes
+static int TSTP_MESSAGE = 0;
+
+// The wait builtin: what it waits for, and the wait status of the job that ended the wait
+#define WAIT_IDLE 0
+#define WAIT_JOB  1     // the job of waitPid
+#define WAIT_NEXT 2     // any job (wait -n)
+static int waitMode = WAIT_IDLE;
+static pid_t waitPid = 0;
+static int waitDone = 0;
+static int waitStatus = 0;
+
+// Set when ctrl-c arrives during the wait builtin
+static int waitInterrupted = 0;
+
+// Set when ctrl-c arrives at any time, read by the loops of ast.c
+static int interruptSeen = 0;
+
+// The last jobs that finished, so wait PID still finds a job reported before the wait began
+#define DONE_REMEMBERED 64
+static pid_t donePids[DONE_REMEMBERED];
+static int doneStatus[DONE_REMEMBERED];
+static int doneNext = 0;
+
+
+/********************
+ * openPidfd
+ * Description: Opens a pidfd for a child process. glibc does not provide a wrapper for all
+ *      versions, so the system call is used directly
+ * -----
+ * Input: pid - the process ID of the child
+ * Output: Returns the pidfd, or -1 if pidfds are unavailable
+ * ******************/
+
+static int openPidfd(pid_t pid)
+{
+    if(!usePidfd)
+        return -1;
+
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    // Older kernels: fall back to SIGCHLD for every child from now on
+    if(fd == -1 && errno == ENOSYS)
+        usePidfd = 0;
+
+    // Do not let pidfds use up the descriptors needed for redirections
+    if(fd >= pidfdLimit)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+
+/********************
+ * closeWatched
+ * Description: Removes a pidfd from the epoll set and closes it. Closing alone is not enough:
+ *      a child being spawned holds a copy of the descriptor until its exec completes, which
+ *      keeps the epoll registration alive after the shell has already resumed
+ * -----
+ * Input: fd - the pidfd to stop watching
+ * Output: NA
+ * ******************/
+
+static void closeWatched(int fd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+
+/********************
+ * raiseFd
+ * Description: Moves a descriptor of the event loop to SHELL_FD_MIN or above
+ * -----
+ * Input: fd - the close-on-exec descriptor
+ * Output: Returns the new descriptor, or fd itself if it could not be moved
+ * ******************/
+
+static int raiseFd(int fd)
+{
+    int moved;
+
+    if(fd >= SHELL_FD_MIN || (moved = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN)) == -1)
+        return fd;
+
+    close(fd);
+    return moved;
+}
+
+
+/********************
+ * initEvents
+ * Description: Blocks the signals the shell handles, creates the signalfd and the epoll set,
+ *      and adds stdin (or the connection of a served session, see serve.c) to it. SIGINT and
+ *      SIGTSTP are also ignored, so spawned children inherit that disposition; Linux still
+ *      queues blocked signals to the signalfd even when ignored
+ * -----
+ * Input: NA
+ * Output: Returns -1 if the event loop could not be set up, otherwise 0
+ * ******************/
+
+int initEvents()
+{
+    sigset_t handled;
+    struct sigaction ignore_action;
+    struct epoll_event event;
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        pidfdLimit = (long)limit.rlim_cur - FD_RESERVE;
+
+    memset(&ignore_action, 0, sizeof(ignore_action));
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore_action, NULL);
+    sigaction(SIGTSTP, &ignore_action, NULL);
+
+    // Block the signals, they will be read from the signalfd instead
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGCHLD);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &handled, NULL);
+
+    signalFd = signalfd(-1, &handled, SFD_NONBLOCK | SFD_CLOEXEC);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(signalFd == -1 || epollFd == -1)
+    {
+        perror("Error setting up the event loop");
+        return -1;
+    }
+
+    // Out of the way of the low numbers scripts redirect for good, as in exec 3>file
+    signalFd = raiseFd(signalFd);
+    epollFd = raiseFd(epollFd);
+
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_SIGNAL;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+    // stdin may be a regular file, which epoll refuses. It is then always considered ready.
+    // It is only armed while waiting for a command line (see waitForInput), otherwise input
+    // typed ahead, or a closed pipe, would wake up every wait for a foreground process
+    event.events = EPOLLONESHOT;
+    event.data.u64 = EVENT_STDIN;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, inputStream(), &event) == 0)
+        stdinWatched = 1;
+
+    return 0;
+}
+
+
+/********************
+ * watchChild
+ * Description: Adds a process of a background job to the epoll set using a pidfd
+ * -----
+ * Input: slot - the slot of the job in the job table
+ *        proc - the index of the process in the job
+ *        pid - the process ID of the child
+ * Output: Returns the pidfd, or -1 if the child will be found through SIGCHLD instead
+ * ******************/
+
+int watchChild(int slot, int proc, pid_t pid)
+{
+    struct epoll_event event;
+
+    int fd = openPidfd(pid);
+    if(fd == -1)
+    {
+        unwatched++;
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = CHILD_TAG(slot, proc);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    return fd;
+}
+
+
+/********************
+ * reapProcess
+ * Description: Reaps a process of a job or of the foreground pipeline if it has finished,
+ *      and stops watching it. wait4 also returns the resources the process used
+ * -----
+ * Input: proc - the process, its status is set once it is reaped
+ *        usage - set to the resource usage of the process, may be NULL
+ * Output: Returns 1 if the process was reaped, otherwise 0
+ * ******************/
+
+static int reapProcess(struct jobProc *proc, struct rusage *usage)
+{
+    if(proc->done)
+        return 0;
+
+    proc->status = 0;
+    if(wait4(proc->pid, &proc->status, WNOHANG, usage) == 0)
+        return 0;
+
+    TRACE(TRACE_EXIT, 0, proc->pid, proc->status, NULL);
+
+    proc->done = 1;
+    if(proc->pidfd != -1)
+    {
+        closeWatched(proc->pidfd);
+        proc->pidfd = -1;
+    }
+
+    return 1;
+}
+
+
+/********************
+ * reportBackground
+ * Description: Reaps a process of a background job if it has finished. Once every process
+ *      of the job is done, displays its done message with the status of the last process
+ * -----
+ * Input: slot - the slot of the job in the job table
+ *        i - the index of the process in the job
+ * Output: Returns 1 if the done message was displayed, otherwise 0
+ * ******************/
+
+static int reportBackground(int slot, int i)
+{
+    struct job *job = jobAt(slot);
+
+    // The job may already be gone if several of its processes were reported at once
+    if(job->livePos == -1 || i >= job->numProcs)
+        return 0;
+
+    int hadPidfd = job->procs[i].pidfd != -1;
+    if(!reapProcess(&job->procs[i], NULL))
+        return 0;
+
+    if(!hadPidfd)
+        unwatched--;
+
+    if(i == job->numProcs - 1)
+        job->status = job->procs[i].status;
+
+    if(--job->remaining > 0)
+        return 0;
+
+    BACK_STATUS = job->status;
+
+    donePids[doneNext] = job->pid;
+    doneStatus[doneNext] = job->status;
+    doneNext = (doneNext + 1) % DONE_REMEMBERED;
+
+    // The job the wait builtin is waiting for
+    if(!waitDone && (waitMode == WAIT_NEXT || (waitMode == WAIT_JOB && job->pid == waitPid)))
+    {
+        waitDone = 1;
+        waitStatus = job->status;
+    }
+
+    // Terminated by a signal? Display signal termination message
+    if(WIFSIGNALED(BACK_STATUS))
+        printf("background pid %d is done: terminated by %d\n", job->pid, WTERMSIG(BACK_STATUS));
+    // Otherwise, it exited normally. Display the normal exit message
+    else
+        printf("background pid %d is done: exit value %d\n", job->pid, WEXITSTATUS(BACK_STATUS));
+    fflush(stdout);
+
+    // Return the slot to the job table
+    jobRemove(slot);
+
+    return 1;
+}
+
+
+/********************
+ * reportForeground
+ * Description: Reaps a process of the foreground pipeline if it has finished. The status of
+ *      the last process becomes STATUS, if it is the last command of the pipeline
+ * -----
+ * Input: i - the index of the process in the pipeline
+ * Output: NA
+ * ******************/
+
+static void reportForeground(int i)
+{
+    struct rusage usage;
+
+    if(i >= fgNum || !reapProcess(&fgProcs[i], &usage))
+        return;
+
+    usageAdd(&fgUsage, &usage);
+
+    if(i == fgNum - 1 && fgSetsStatus)
+        STATUS = fgProcs[i].status;
+
+    fgRemaining--;
+}
+
+
+/********************
+ * reportTSTP
+ * Description: Displays the foreground-only mode message after ctrl-z
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+static void reportTSTP()
+{
+    if(TSTP_FLAG)
+        printf("\nEntering foreground-only mode (& is now ignored)\n");
+    else
+        printf("\nExiting foreground-only mode\n");
+    fflush(stdout);
+
+    TSTP_MESSAGE = 0;
+}
+
+
+/********************
+ * handleSignals
+ * Description: Reads every pending signal from the signalfd
+ * -----
+ * Input: NA
+ * Output: Returns 1 if a message was displayed, otherwise 0
+ * ******************/
+
+static int handleSignals()
+{
+    int i, j, printed = 0;
+    struct signalfd_siginfo info;
+
+    while(read(signalFd, &info, sizeof(info)) == sizeof(info))
+    {
+        TRACE(TRACE_SIGNAL, 0, info.ssi_pid, info.ssi_signo, sigabbrev_np(info.ssi_signo));
+
+        // Ctrl-z toggles foreground-only mode
+        if(info.ssi_signo == SIGTSTP)
+        {
+            TSTP_FLAG = !TSTP_FLAG;
+            TSTP_MESSAGE = 1;
+
+            // Wait for the foreground process to finish before displaying the message
+            if(fgRemaining == 0 && waitMode == WAIT_IDLE)
+            {
+                reportTSTP();
+                printed = 1;
+            }
+        }
+
+        // A child changed state. Normally its pidfd reports it, but children that could
+        // not be given a pidfd have to be checked here
+        else if(info.ssi_signo == SIGCHLD)
+        {
+            for(i = 0; i < fgNum; i++)
+            {
+                if(fgProcs[i].pidfd == -1)
+                    reportForeground(i);
+            }
+
+            // Walk the live jobs from the end, reaping may move the last job into position i
+            for(i = numJobs() - 1; i >= 0 && unwatched > 0; i--)
+            {
+                int slot = liveJob(i);
+                struct job *job = jobAt(slot);
+
+                for(j = job->numProcs - 1; j >= 0; j--)
+                {
+                    if(job->procs[j].pidfd == -1 && !job->procs[j].done && reportBackground(slot, j))
+                    {
+                        printed = 1;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // SIGINT is delivered to the foreground process directly by the terminal. It only
+        // interrupts the wait builtin and the loops
+        else if(info.ssi_signo == SIGINT)
+        {
+            interruptSeen = 1;
+            if(waitMode != WAIT_IDLE)
+                waitInterrupted = 1;
+        }
+    }
+
+    return printed;
+}
+
+
+/********************
+ * dispatchEvents
+ * Description: Waits for events and handles signals and finished children
+ * -----
+ * Input: timeout - milliseconds to wait, -1 to block until something happens
+ * Output: Returns 1 if stdin is ready to read, otherwise 0
+ * ******************/
+
+static int dispatchEvents(int timeout)
+{
+    int i, printed = 0, ready = 0;
+    struct epoll_event events[MAX_EVENTS];
+
+    int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+
+    for(i = 0; i < numEvents; i++)
+    {
+        uint64_t tag = events[i].data.u64;
+
+        if(tag == EVENT_STDIN)
+            ready = 1;
+        else if(tag == EVENT_SIGNAL)
+            printed |= handleSignals();
+        else if(TAG_SLOT(tag) == FOREGROUND_SLOT)
+            reportForeground(TAG_PROC(tag));
+        else
+            printed |= reportBackground(TAG_SLOT(tag), TAG_PROC(tag));
+    }
+
+    // Reprint the prompt if a message was displayed while the user was at it
+    if(printed && fgRemaining == 0 && waitMode == WAIT_IDLE && INTERACTIVE)
+        write(1, ":", 1);
+
+    return ready;
+}
+
+
+/********************
+ * waitForInput
+ * Description: Blocks until stdin can be read, reporting finished background processes
+ *      and signals as they arrive. A script with no background jobs skips the event loop
+ *      entirely, signals are then handled during the next foreground wait
+ * -----
+ * Input: NA
+ * Output: NA - returns once a command line can be read
+ * ******************/
+
+void waitForInput()
+{
+    struct epoll_event event;
+
+    if(!INTERACTIVE && numJobs() == 0)
+        return;
+
+    // Already buffered input, or stdin that can not be watched: only handle pending events
+    if(inputPending() || !stdinWatched)
+    {
+        dispatchEvents(0);
+        return;
+    }
+
+    // Arm stdin for a single event
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = EVENT_STDIN;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, inputStream(), &event);
+
+    while(!dispatchEvents(-1))
+        ;
+}
+
+
+/********************
+ * waitForeground
+ * Description: Waits for every process of a foreground pipeline to finish and sets STATUS.
+ *      Background processes finishing in the meantime are reported immediately
+ * -----
+ * Input: pids - the process IDs of the pipeline
+ *        numPids - the number of processes
+ *        setStatus - 1 if the last process is the last command of the pipeline and gives
+ *            STATUS, 0 if the caller has already set STATUS
+ *        usage - set to the total resource usage of the processes, may be NULL
+ * Output: NA - STATUS holds the exit status of the pipeline
+ * ******************/
+
+void waitForeground(pid_t *pids, int numPids, int setStatus, struct rusage *usage)
+{
+    struct epoll_event event;
+    int i;
+
+    if(numPids > fgCapacity)
+    {
+        fgCapacity = numPids * 2;
+        fgProcs = realloc(fgProcs, sizeof(struct jobProc) * fgCapacity);
+        if(fgProcs == 0)
+        {
+            perror("Error allocating memory");
+            exit(1);
+        }
+    }
+
+    fgNum = fgRemaining = numPids;
+    fgSetsStatus = setStatus;
+    memset(&fgUsage, 0, sizeof(fgUsage));
+    for(i = 0; i < numPids; i++)
+    {
+        fgProcs[i].pid = pids[i];
+        fgProcs[i].done = 0;
+        fgProcs[i].pidfd = openPidfd(pids[i]);
+        if(fgProcs[i].pidfd != -1)
+        {
+            event.events = EPOLLIN;
+            event.data.u64 = CHILD_TAG(FOREGROUND_SLOT, i);
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fgProcs[i].pidfd, &event);
+        }
+    }
+
+    // The processes may have finished before they could be watched
+    for(i = 0; i < numPids; i++)
+        reportForeground(i);
+
+    while(fgRemaining > 0)
+        dispatchEvents(-1);
+
+    fgNum = 0;
+    if(usage != 0)
+        *usage = fgUsage;
+
+    // Display message if the foreground process was terminated by a signal (ctrl-c)
+    if(WIFSIGNALED(STATUS))
+    {
+        printf("terminated by signal %d\n", WTERMSIG(STATUS));
+        fflush(stdout);
+    }
+
+    // Foreground-only mode changed while the process ran
+    if(TSTP_MESSAGE)
+        reportTSTP();
+}
+
+
+/********************
+ * waitJob
+ * Description: Blocks until a background job finishes, for the wait builtin. Only the event
+ *      loop runs meanwhile: the job's pidfds (or SIGCHLD) wake it up, nothing is polled
+ * -----
+ * Input: pid - a process of the job to wait for, or 0 for any job
+ *        status - set to the wait status of the job that finished
+ * Output: Returns 0 once a job finished, -1 if pid is not a job (or there is no job at all
+ *        when pid is 0), 1 if ctrl-c interrupted the wait
+ * ******************/
+
+int waitJob(pid_t pid, int *status)
+{
+    if(pid != 0)
+    {
+        int i, slot = jobFind(pid);
+
+        // Already finished: its status is given once
+        if(slot == -1)
+        {
+            for(i = 0; i < DONE_REMEMBERED; i++)
+            {
+                if(donePids[i] == pid)
+                {
+                    donePids[i] = 0;
+                    *status = doneStatus[i];
+                    return 0;
+                }
+            }
+            return -1;
+        }
+
+        waitMode = WAIT_JOB;
+        waitPid = jobAt(slot)->pid;
+    }
+    else
+    {
+        if(numJobs() == 0)
+            return -1;
+
+        waitMode = WAIT_NEXT;
+    }
+
+    waitDone = 0;
+    waitInterrupted = 0;
+    while(!waitDone && !waitInterrupted)
+        dispatchEvents(-1);
+
+    waitMode = WAIT_IDLE;
+
+    // Foreground-only mode changed during the wait
+    if(TSTP_MESSAGE)
+        reportTSTP();
+
+    if(!waitDone)
+        return 1;
+
+    *status = waitStatus;
+    return 0;
+}
+
+
+/********************
+ * interruptPending
+ * Description: Tells if ctrl-c was pressed since interruptClear. The signals are read as they
+ *      arrive while the shell waits, a loop that only runs builtins never waits and asks for
+ *      them to be read now
+ * -----
+ * Input: poll - 1 to read the pending signals first
+ * Output: Returns 1 if ctrl-c was pressed, otherwise 0
+ * ******************/
+
+int interruptPending(int poll)
+{
+    if(poll && signalFd != -1)
+        handleSignals();
+
+    return interruptSeen;
+}
+
+
+/********************
+ * waitReadable
+ * Description: Blocks until a descriptor can be read, for a builtin reading the terminal.
+ *      The shell does not die of ctrl-c, so the builtin would otherwise wait for input
+ *      through it. Other signals are handled as they arrive
+ * -----
+ * Input: fd - the descriptor
+ * Output: Returns -1 if ctrl-c was pressed first, otherwise 0
+ * ******************/
+
+int waitReadable(int fd)
+{
+    struct pollfd fds[2];
+    int seen = interruptSeen;
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = signalFd;
+    fds[1].events = POLLIN;
+
+    interruptSeen = 0;
+    while(1)
+    {
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            handleSignals();
+            if(interruptSeen)
+                return -1;
+        }
+
+        if(fds[0].revents != 0)
+            break;
+    }
+
+    interruptSeen |= seen;
+    return 0;
+}
+
+
+/********************
+ * interruptClear
+ * Description: Forgets an earlier ctrl-c, before a loop starts
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void interruptClear()
+{
+    interruptSeen = 0;
+}
+
+
+/********************
+ * resetEvents
+ * Description: Gives a forked copy of the shell (a command substitution, see substitute.c)
+ *      an event loop of its own. The epoll set is shared with the shell otherwise, and the
+ *      jobs of the shell are not children of the copy
+ * -----
+ * Input: NA
+ * Output: Returns -1 if the event loop could not be set up, otherwise 0
+ * ******************/
+
+int resetEvents()
+{
+    int i;
+
+    close(epollFd);
+    close(signalFd);
+
+    while(numJobs() > 0)
+    {
+        int slot = liveJob(0);
+        struct job *job = jobAt(slot);
+
+        for(i = 0; i < job->numProcs; i++)
+        {
+            if(job->procs[i].pidfd != -1)
+                close(job->procs[i].pidfd);
+        }
+        jobRemove(slot);
+    }
+
+    fgNum = fgRemaining = 0;
+    unwatched = 0;
+    stdinWatched = 0;
+    waitMode = WAIT_IDLE;
+    interruptSeen = 0;
+
+    return initEvents();
+}
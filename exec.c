@@ -0,0 +1,1086 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Runs the pipelines found by the parser. Every external stage is started
+ *      at once, connected to its neighbours with pipes, and the shell then waits for all
+ *      of them (or records them as one background job). Builtin stages run inside the
+ *      shell once the external stages are started, with their < and > redirections opened
+ *      by the shell (see builtins.c). When a builtin writes into a pipe its
+ *      output is collected in anonymous memory and handed to the pipe with vmsplice, so
+ *      the pages are referenced by the pipe instead of being copied through write().
+ *      Pipe buffers may be resized with the WISH_PIPE_SIZE environment variable (F_SETPIPE_SZ).
+ *      Pipelines prefixed with `time`, or every foreground command when WISH_TIME is set,
+ *      are measured (see usage.c)
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "wish.h"
+
+// Size of the memory first mapped for the output of a builtin
+#define OUTPUT_INITIAL 65536
+
+// Pipe buffer size requested with F_SETPIPE_SZ, 0 keeps the kernel default
+static int pipeSize = 0;
+
+// Set by WISH_TIME: the usage of every foreground command is recorded for `status`
+static int timeAlways = 0;
+
+
+/********************
+ * initExec
+ * Description: Reads the pipe buffer size from the WISH_PIPE_SIZE environment variable
+ *      (in bytes, the kernel rounds it up to a power of two pages), and WISH_TIME which
+ *      turns on the measuring of every foreground command. SIGPIPE is ignored so
+ *      that a builtin writing to a pipe nobody reads gets EPIPE instead of killing the shell;
+ *      children get the default action back (see spawn.c)
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void initExec()
+{
+    struct sigaction ignore_action;
+    char *size = getenv("WISH_PIPE_SIZE");
+
+    if(size != 0)
+        pipeSize = atoi(size);
+
+    if(getenv("WISH_TIME") != 0)
+        timeAlways = 1;
+
+    memset(&ignore_action, 0, sizeof(ignore_action));
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore_action, NULL);
+}
+
+
+/********************
+ * makePipe
+ * Description: Creates a close-on-exec pipe between two stages, sized as requested
+ * -----
+ * Input: fds - set to the read and write ends
+ * Output: Returns -1 if the pipe could not be created (a message is displayed), otherwise 0
+ * ******************/
+
+static int makePipe(int fds[2])
+{
+    if(pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("Error creating pipe");
+        fds[0] = fds[1] = -1;
+        return -1;
+    }
+
+    // A size above /proc/sys/fs/pipe-max-size is refused, the default size is kept then
+    if(pipeSize > 0)
+        fcntl(fds[1], F_SETPIPE_SZ, pipeSize);
+
+    return 0;
+}
+
+
+/********************
+ * outInit
+ * Description: Prepares the output of a builtin. Output written to a descriptor goes through
+ *      the small buffer inside the output, so a builtin makes one write() per line or less
+ * -----
+ * Input: out - the output to initialize
+ *        fd - the descriptor written to, or -1 to collect the output in memory
+ * Output: NA
+ * ******************/
+
+void outInit(struct output *out, int fd)
+{
+    out->fd = fd;
+    out->len = 0;
+
+    if(fd != -1)
+    {
+        out->data = out->buffer;
+        out->cap = OUTPUT_BUFFER;
+    }
+    else
+    {
+        out->data = 0;
+        out->cap = 0;
+    }
+}
+
+
+/********************
+ * writeAll
+ * Description: Writes every byte to a descriptor. Errors (a closed pipe) drop the output
+ * -----
+ * Input: fd - the descriptor
+ *        data - the bytes to write
+ *        len - the number of bytes
+ * Output: NA
+ * ******************/
+
+static void writeAll(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            return;
+
+        data += written;
+        len -= written;
+    }
+}
+
+
+/********************
+ * outFlush
+ * Description: Writes the buffered output of a builtin to its descriptor
+ * -----
+ * Input: out - the output
+ * Output: NA
+ * ******************/
+
+void outFlush(struct output *out)
+{
+    if(out->fd == -1 || out->len == 0)
+        return;
+
+    writeAll(out->fd, out->data, out->len);
+    out->len = 0;
+}
+
+
+/********************
+ * outRelease
+ * Description: Frees the memory of a collected output
+ * -----
+ * Input: out - the output, its fd is -1
+ * Output: NA
+ * ******************/
+
+void outRelease(struct output *out)
+{
+    if(out->fd == -1 && out->data != 0)
+        munmap(out->data, out->cap);
+
+    outInit(out, -1);
+}
+
+
+/********************
+ * outReserve
+ * Description: Makes room in the memory of a collected output. The memory is mapped directly,
+ *      page aligned, so it can be spliced into a pipe and unmapped without copying
+ * -----
+ * Input: out - the output, its fd is -1
+ *        len - the number of bytes about to be added
+ * Output: NA
+ * ******************/
+
+static void outReserve(struct output *out, size_t len)
+{
+    size_t newCap;
+    void *data;
+
+    if(out->len + len <= out->cap)
+        return;
+
+    newCap = out->cap ? out->cap * 2 : OUTPUT_INITIAL;
+    while(out->len + len > newCap)
+        newCap *= 2;
+
+    if(out->data == 0)
+        data = mmap(NULL, newCap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        data = mremap(out->data, out->cap, newCap, MREMAP_MAYMOVE);
+
+    if(data == MAP_FAILED)
+    {
+        perror("Error allocating memory");
+        exit(1);
+    }
+
+    out->data = data;
+    out->cap = newCap;
+}
+
+
+/********************
+ * outWrite
+ * Description: Writes the output of a builtin
+ * -----
+ * Input: out - the output
+ *        data - the bytes to write
+ *        len - the number of bytes
+ * Output: NA
+ * ******************/
+
+void outWrite(struct output *out, const char *data, size_t len)
+{
+    if(out->fd != -1)
+    {
+        if(out->len + len > out->cap)
+            outFlush(out);
+
+        // Too large for the buffer: written directly
+        if(len >= out->cap)
+        {
+            writeAll(out->fd, data, len);
+            return;
+        }
+
+        memcpy(out->data + out->len, data, len);
+        out->len += len;
+        return;
+    }
+
+    outReserve(out, len);
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+
+/********************
+ * outPrintf
+ * Description: Formats the output of a builtin, like printf
+ * -----
+ * Input: out - the output
+ *        format - printf format, followed by its arguments
+ * Output: NA
+ * ******************/
+
+void outPrintf(struct output *out, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    // Format into the buffer, flushing it first if the text does not fit
+    if(out->fd != -1)
+    {
+        va_start(args, format);
+        len = vsnprintf(out->data + out->len, out->cap - out->len, format, args);
+        va_end(args);
+
+        if(len >= 0 && (size_t)len < out->cap - out->len)
+        {
+            out->len += len;
+            return;
+        }
+
+        outFlush(out);
+        va_start(args, format);
+        if(len >= 0 && (size_t)len < out->cap)
+            out->len = vsnprintf(out->data, out->cap, format, args);
+        else
+            vdprintf(out->fd, format, args);
+        va_end(args);
+        return;
+    }
+
+    // Format straight into the collected output, growing it if the text does not fit
+    va_start(args, format);
+    len = vsnprintf(0, 0, format, args);
+    va_end(args);
+
+    outReserve(out, len + 1);
+    va_start(args, format);
+    vsnprintf(out->data + out->len, len + 1, format, args);
+    va_end(args);
+    out->len += len;
+}
+
+
+/********************
+ * pushOutput
+ * Description: Hands the collected output of a builtin to a pipe with vmsplice. The pipe
+ *      takes references to the pages, so the memory is unmapped afterwards without being
+ *      copied. If the pipe fills up before the next stage reads it, a child process is forked
+ *      to feed the rest, so the shell never blocks on a pipe another builtin has to drain
+ * -----
+ * Input: out - the collected output, it is released
+ *        fd - the write end of the pipe
+ * Output: Returns the pid of the feeding child, or 0 if all the output fit in the pipe
+ * ******************/
+
+static pid_t pushOutput(struct output *out, int fd)
+{
+    struct iovec iov;
+    size_t done = 0;
+    pid_t pid = 0;
+
+    while(done < out->len)
+    {
+        iov.iov_base = out->data + done;
+        iov.iov_len = out->len - done;
+
+        ssize_t moved = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+        if(moved > 0)
+            done += moved;
+        else if(moved == -1 && errno == EINTR)
+            continue;
+        else
+            break;
+    }
+
+    // The pipe is full: the child writes the rest, blocking as long as needed
+    if(done < out->len && errno == EAGAIN)
+    {
+        pid = fork();
+        if(pid == 0)
+        {
+            sigprocmask(SIG_SETMASK, &CHILD_MASK, NULL);
+
+            // Keep only the pipe, other pipe ends held here would hide the end of file from readers
+            if(fd != 1)
+            {
+                dup2(fd, 1);
+                fd = 1;
+            }
+            close_range(3, ~0U, 0);
+
+            while(done < out->len)
+            {
+                iov.iov_base = out->data + done;
+                iov.iov_len = out->len - done;
+
+                ssize_t moved = vmsplice(fd, &iov, 1, 0);
+                if(moved > 0)
+                    done += moved;
+                else if(moved == -1 && errno != EINTR)
+                    _exit(1);
+            }
+            _exit(0);
+        }
+        else if(pid == -1)
+        {
+            perror("Error forking");
+            pid = 0;
+        }
+        else
+            TRACE(TRACE_FORK, 0, pid, -1, "output feeder");
+    }
+
+    outRelease(out);
+
+    return pid;
+}
+
+
+/********************
+ * openRedirects
+ * Description: Adds the redirections of a command to its plan, expanding each target
+ * -----
+ * Input: arena - the arena of the command line
+ *        plan - the plan of the command, its pipes already added
+ *        cmd - the command
+ * Output: Returns -1 if a file could not be opened (a message is displayed), otherwise 0
+ * ******************/
+
+static int openRedirects(struct arena *arena, struct spawnPlan *plan, struct command *cmd)
+{
+    int i;
+
+    // Open the redirection targets in the order they were found
+    for(i = 0; i < cmd->numRedirects; i++)
+    {
+        struct redirect *redirect = &cmd->redirects[i];
+
+        // <& and >& make fd a copy of another descriptor, given by its number
+        if(redirect->kind == REDIRECT_DUP)
+        {
+            char *target = expandWord(arena, redirect->target);
+            if(target == 0)
+                target = "";
+
+            // A descriptor redirected earlier in the plan, or one the shell has open for its
+            // commands. The shell's own descriptors are close-on-exec and are not for commands
+            int srcFd = -1, fdFlags;
+            if(target[0] != '\0' && strspn(target, "0123456789") == strlen(target) && strlen(target) < 8)
+            {
+                int number = atoi(target);
+
+                srcFd = planSource(plan, number);
+                if(srcFd == -1 && (fdFlags = fcntl(number, F_GETFD)) != -1 && !(fdFlags & FD_CLOEXEC))
+                    srcFd = number;
+            }
+
+            if(srcFd == -1)
+            {
+                printf("%s: bad file descriptor\n", target);
+                fflush(stdout);
+
+                return -1;
+            }
+
+            if(planDup(plan, redirect->fd, srcFd) == -1)
+            {
+                printf("too many redirections\n");
+                fflush(stdout);
+
+                return -1;
+            }
+
+            TRACE(TRACE_REDIRECT, 0, 0, redirect->fd, "duplicate");
+            continue;
+        }
+
+        // Here-documents and here-strings are given as input without a file name
+        if(redirect->kind != REDIRECT_FILE)
+        {
+            size_t len;
+            char *text;
+
+            if(redirect->kind == REDIRECT_HEREDOC)
+                text = expandHere(arena, redirect->target, &len);
+            else
+            {
+                char *word = expandWord(arena, redirect->target);
+                len = word ? strlen(word) : 0;
+                text = arenaAlloc(arena, len + 1);
+                memcpy(text, word ? word : "", len);
+                text[len++] = '\n';
+            }
+
+            if(planHere(plan, redirect->fd, text, len) == -1)
+            {
+                perror("Error creating here-document");
+                return -1;
+            }
+
+            TRACE(TRACE_REDIRECT, 0, 0, redirect->fd, redirect->kind == REDIRECT_HEREDOC ? "here-document" : "here-string");
+            continue;
+        }
+
+        char *target = expandWord(arena, redirect->target);
+        if(target == 0)
+            target = "";
+
+        if(planOpen(plan, redirect->fd, target, redirect->flags) == -1)
+        {
+            printf("cannot open %s for %s\n", target, (redirect->flags & O_ACCMODE) == O_RDONLY ? "input" : "output");
+            fflush(stdout);
+
+            return -1;
+        }
+
+        TRACE(TRACE_REDIRECT, 0, 0, redirect->fd, target);
+    }
+
+    return 0;
+}
+
+
+/********************
+ * runBuiltinCommand
+ * Description: Runs one builtin inside the shell. Its redirections are opened just as for an
+ *      external command, and the builtin reads and writes the descriptors the child would
+ *      have had. Output going into the pipe to the next command is collected and spliced
+ * -----
+ * Input: arena - the arena of the command line
+ *        cmd - the command, its words are expanded
+ *        index - the builtin, as found by findBuiltin
+ *        in - the read end of the pipe from the previous command, or -1
+ *        out - the write end of the pipe to the next command, or -1
+ *        inPipeline - 1 if the command is part of a pipeline of several commands
+ *        feeder - set to the pid of the process feeding the pipe, or 0 (see pushOutput)
+ * Output: Returns the exit value of the builtin, 1 if a redirection failed
+ * ******************/
+
+static int runBuiltinCommand(struct arena *arena, struct command *cmd, int index, int in, int out,
+    int inPipeline, pid_t *feeder)
+{
+    struct spawnPlan plan;
+    struct builtinCall call;
+    struct output output;
+    int result, outFd, errFd, savedErr;
+
+    *feeder = 0;
+
+    // Connect the pipes first, so a redirection of the same stream replaces the pipe
+    planInit(&plan, cmd->words, 0);
+    if(in != -1)
+        planDup(&plan, 0, in);
+    if(out != -1)
+        planDup(&plan, 1, out);
+
+    if(openRedirects(arena, &plan, cmd) == -1)
+    {
+        planClose(&plan);
+        return 1;
+    }
+
+    outFd = planSource(&plan, 1);
+    if(outFd == -1)
+        outInit(&output, 1);
+    else if(outFd == out)
+        outInit(&output, -1);
+    else
+        outInit(&output, outFd);
+
+    call.arena = arena;
+    call.argList = cmd->words;
+    call.numArgs = cmd->numWords;
+    call.in = planSource(&plan, 0);
+    if(call.in == -1)
+        call.in = 0;
+    call.out = &output;
+    call.inPipeline = inPipeline;
+    call.plan = &plan;
+
+    // Builtins write their errors to stderr, it is redirected for the time of the call
+    errFd = builtinRedirectsShell(index) ? -1 : planSource(&plan, 2);
+    if(errFd != -1)
+    {
+        fflush(stderr);
+        savedErr = fcntl(2, F_DUPFD_CLOEXEC, 3);
+        dup2(errFd, 2);
+    }
+
+    // Refer to builtins.c for details of each builtin
+    result = runBuiltin(index, &call);
+
+    if(errFd != -1)
+    {
+        fflush(stderr);
+        if(savedErr == -1)
+            close(2);
+        else
+        {
+            dup2(savedErr, 2);
+            close(savedErr);
+        }
+    }
+
+    if(output.fd == -1)
+        *feeder = pushOutput(&output, out);
+    else
+        outFlush(&output);
+
+    planClose(&plan);
+    return result;
+}
+
+
+/********************
+ * planCommand
+ * Description: Plans the descriptors of one stage of a pipeline: its pipes, then its
+ *      redirections
+ * -----
+ * Input: arena - the arena of the command line
+ *        plan - the plan to fill in
+ *        cmd - the command, its words are expanded
+ *        in - the read end of the pipe from the previous command, or -1
+ *        out - the write end of the pipe to the next command, or -1
+ *        background - 1 if the pipeline runs in the background
+ * Output: Returns -1 if a redirection failed (a message is displayed and the plan is
+ *        closed), otherwise 0
+ * ******************/
+
+static int planCommand(struct arena *arena, struct spawnPlan *plan, struct command *cmd, int in, int out,
+    int background)
+{
+    int result;
+
+    planInit(plan, cmd->words, background);
+
+    // Connect the pipes first, so a redirection of the same stream replaces the pipe
+    if(in != -1)
+        planDup(plan, 0, in);
+    if(out != -1)
+        planDup(plan, 1, out);
+
+    result = openRedirects(arena, plan, cmd);
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // Background Process Redirection
+    // Description: stdin and stdout of a background pipeline that are neither redirected nor
+    //      connected to another command go to /dev/null, so the background processes do not
+    //      interfere with other foreground processes
+    if(result == 0 && background && !planHas(plan, 0))
+        result = redirectStdin(plan);
+    if(result == 0 && background && !planHas(plan, 1))
+        result = redirectStdout(plan);
+
+    if(result == -1)
+        planClose(plan);
+
+    return result;
+}
+
+
+/********************
+ * launchCommand
+ * Description: Starts one external command of a pipeline with the spawn engine
+ * -----
+ * Input: arena - the arena of the command line
+ *        cmd - the command, its words are expanded
+ *        in - the read end of the pipe from the previous command, or -1
+ *        out - the write end of the pipe to the next command, or -1
+ *        background - 1 if the pipeline runs in the background
+ *        usage - the usage of a measured pipeline, the time to exec is added. NULL if not measured
+ * Output: Returns the pid of the command, or -1 if it could not be started (a message is displayed)
+ * ******************/
+
+static pid_t launchCommand(struct arena *arena, struct command *cmd, int in, int out, int background,
+    struct usage *usage)
+{
+    long long start = 0;
+    pid_t pid;
+
+    // Describes the command being launched and its redirections. Refer to spawn.c for details
+    struct spawnPlan plan;
+
+    // The redirection was unsucessful, nothing is launched
+    if(planCommand(arena, &plan, cmd, in, out, background) == -1)
+        return -1;
+
+    // Launch the command with the selected spawn engine. Refer to spawn.c for details.
+    // A measured command is timed until its exec, posix_spawn only returns after the exec
+    if(usage != 0)
+    {
+        plan.waitExec = 1;
+        start = clockNow();
+    }
+
+    pid = spawnCommand(&plan);
+
+    if(usage != 0 && pid != -1)
+        usageSpawned(usage, clockNow() - start);
+
+    // The shell's copies of the redirection files are no longer needed
+    planClose(&plan);
+
+    // The command could not be started at all
+    if(pid == -1)
+    {
+        printf("%s: %s\n", cmd->words[0], errno == ENOENT ? "no such file or directory" : strerror(errno));
+        fflush(stdout);
+    }
+
+    return pid;
+}
+
+
+/********************
+ * closePipes
+ * Description: Closes the shell's copies of pipe ends in a forked copy of the shell. The
+ *      other stages of the pipeline, and the builtins waiting to run, would never see their
+ *      end of file while the copy holds them. Only the close-on-exec pipes belong to the
+ *      shell, those redirected with exec are kept
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+static void closePipes()
+{
+    struct dirent *entry;
+    struct stat info;
+    int fd, flags;
+
+    DIR *dir = opendir("/proc/self/fd");
+    if(dir == 0)
+        return;
+
+    while((entry = readdir(dir)) != 0)
+    {
+        fd = atoi(entry->d_name);
+        if(fd > 2 && fd != dirfd(dir) && (flags = fcntl(fd, F_GETFD)) != -1 && (flags & FD_CLOEXEC) &&
+            fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode))
+            close(fd);
+    }
+    closedir(dir);
+}
+
+
+/********************
+ * launchCompound
+ * Description: Starts an if, while, until or for that is a stage of a pipeline, redirected
+ *      or run in the background. It runs in a forked copy of the shell, like a command
+ *      substitution, with the descriptors of its plan in place of stdin, stdout and stderr
+ * -----
+ * Input: arena - the arena of the command line
+ *        cmd - the stage: the compound and its redirections
+ *        in - the read end of the pipe from the previous command, or -1
+ *        out - the write end of the pipe to the next command, or -1
+ *        background - 1 if the pipeline runs in the background
+ * Output: Returns the pid of the copy, or -1 if it could not be started (a message is displayed)
+ * ******************/
+
+static pid_t launchCompound(struct arena *arena, struct command *cmd, int in, int out, int background)
+{
+    struct spawnPlan plan;
+    struct sigaction default_action;
+    int i;
+
+    if(planCommand(arena, &plan, cmd, in, out, background) == -1)
+        return -1;
+
+    // Output buffered by the shell must not be written twice
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        for(i = 0; i < plan.numActions; i++)
+        {
+            if(dup2(plan.actions[i].srcFd, plan.actions[i].fd) == -1)
+            {
+                perror("dup2");
+                _exit(1);
+            }
+        }
+        planClose(&plan);
+        closePipes();
+
+        // Ctrl-c at the terminal is for the foreground only. A stage whose reader went away
+        // dies like any command would
+        if(background)
+            setpgid(0, 0);
+        memset(&default_action, 0, sizeof(default_action));
+        default_action.sa_handler = SIG_DFL;
+        sigaction(SIGPIPE, &default_action, NULL);
+
+        // Refer to utility.c, exit in the compound leaves only this copy
+        if(enterSubshell() == -1)
+            _exit(1);
+
+        runCompound(arena, cmd->compound);
+
+        fflush(stdout);
+        _exit(WIFSIGNALED(STATUS) ? 128 + WTERMSIG(STATUS) : WEXITSTATUS(STATUS));
+    }
+
+    planClose(&plan);
+
+    if(pid == -1)
+        perror("Error forking");
+    else
+        TRACE(TRACE_FORK, 0, pid, -1, "compound");
+
+    return pid;
+}
+
+
+/********************
+ * closeFd
+ * Description: Closes a descriptor if it is open
+ * -----
+ * Input: fd - the descriptor, or -1
+ * Output: NA
+ * ******************/
+
+static void closeFd(int fd)
+{
+    if(fd != -1)
+        close(fd);
+}
+
+
+/********************
+ * finishUsage
+ * Description: Ends the measuring of a foreground pipeline. `time` displays the usage on
+ *      stderr, and it is kept for the status builtin
+ * -----
+ * Input: pipeline - the pipeline
+ *        usage - the usage being measured, NULL if the pipeline was not measured
+ *        children - the total usage of the processes of the pipeline
+ *        record - 1 if the usage replaces the one shown by status
+ * Output: NA
+ * ******************/
+
+static void finishUsage(struct pipeline *pipeline, struct usage *usage, struct rusage *children, int record)
+{
+    struct output out;
+
+    if(usage == 0)
+    {
+        // The last command was not measured, status has nothing to show
+        if(record)
+            LAST_USAGE.valid = 0;
+        return;
+    }
+
+    usageFinish(usage, children);
+
+    if(pipeline->timed)
+    {
+        outInit(&out, 2);
+        usagePrint(&out, usage);
+        outFlush(&out);
+    }
+
+    if(record)
+        LAST_USAGE = *usage;
+}
+
+
+/********************
+ * commandBuiltin
+ * Description: Tells if an expanded command runs inside the shell. A compiled command had its
+ *      builtin looked up once (see ast.c), enable -n is still checked every time. A builtin
+ *      that reads its input to the end (cat, tee) only runs inside the shell where the shell
+ *      waits for it anyway, elsewhere its program runs
+ * -----
+ * Input: cmd - the command, its words expanded
+ *        waited - 1 for the last command of a foreground pipeline, otherwise 0
+ * Output: Returns the index of the builtin, or -1 if the command is a program
+ * ******************/
+
+static int commandBuiltin(struct command *cmd, int waited)
+{
+    int index;
+
+    if(cmd->builtin == BUILTIN_UNRESOLVED)
+        index = findBuiltin(cmd->words[0]);
+    else
+        index = builtinEnabled(cmd->builtin);
+
+    if(index != -1 && !waited && builtinStreams(index))
+        return -1;
+
+    return index;
+}
+
+
+/********************
+ * runPipeline
+ * Description: Runs every command of a pipeline. External commands are started in order,
+ *      all running at once, then the builtins run inside the shell. A foreground pipeline
+ *      is waited for and its last command gives STATUS; a background pipeline becomes one job.
+ *      A foreground pipeline may also be measured, see finishUsage
+ * -----
+ * Input: arena - the arena of the command line
+ *        pipeline - the parsed pipeline
+ * Output: NA
+ * ******************/
+
+void runPipeline(struct arena *arena, struct pipeline *pipeline)
+{
+    int i, numPids = 0, lastPid = -1;
+    int n = pipeline->numCommands;
+    int prevRead = -1;
+    pid_t feeder;
+
+    // The status of the last command when it is not an external process
+    int lastStatus = W_EXITCODE(0, 0);
+
+    // The resources used by a measured pipeline and by its processes. Refer to usage.c for details
+    struct usage usage;
+    struct usage *measure = 0;
+    struct rusage children;
+
+    memset(&children, 0, sizeof(children));
+    if(!pipeline->background && (pipeline->timed || timeAlways))
+    {
+        measure = &usage;
+        usageStart(measure);
+    }
+
+    // A lone builtin runs directly, writing to stdout
+    if(n == 1 && pipeline->commands[0].compound == 0)
+    {
+        struct command *cmd = &pipeline->commands[0];
+        if(cmd->numSlots != 0)
+            cmd->numWords = expandWords(arena, cmd->words, cmd->numWords);
+
+        // `time` alone measures nothing
+        if(cmd->numWords == 0 && pipeline->timed)
+        {
+            finishUsage(pipeline, measure, &children, 0);
+            return;
+        }
+
+        int index = cmd->numWords > 0 ? commandBuiltin(cmd, !pipeline->background) : -1;
+        if(index != -1)
+        {
+            int result = runBuiltinCommand(arena, cmd, index, -1, -1, 0, &feeder);
+
+            // exit, cd and status leave the status and usage of the last command alone
+            if(!builtinKeepsStatus(index))
+                STATUS = W_EXITCODE(result & 0xff, 0);
+            finishUsage(pipeline, measure, &children, !builtinKeepsStatus(index));
+            return;
+        }
+    }
+
+    // The processes started, the descriptors of every builtin, and which builtin each command is
+    pid_t *pids = arenaAlloc(arena, sizeof(pid_t) * n * 2);
+    int *ins = arenaAlloc(arena, sizeof(int) * n);
+    int *outs = arenaAlloc(arena, sizeof(int) * n);
+    int *builtin = arenaAlloc(arena, sizeof(int) * n);
+
+    for(i = 0; i < n; i++)
+    {
+        struct command *cmd = &pipeline->commands[i];
+        int pipeFds[2] = {-1, -1};
+
+        builtin[i] = -1;
+
+        // Connect the command to the next one
+        if(i < n - 1 && makePipe(pipeFds) == -1)
+        {
+            closeFd(prevRead);
+            n = i;
+            lastStatus = W_EXITCODE(1, 0);
+            break;
+        }
+
+        // Expand $$, $?, $!, $NAME and ${NAME} and remove quotes. Refer to expand.c for details
+        if(n > 1 && cmd->numSlots != 0)
+            cmd->numWords = expandWords(arena, cmd->words, cmd->numWords);
+
+        // Nothing left to run: the words expanded to nothing ($UNSET) or there were only
+        // redirections. Like sh, the redirections are still made and the command succeeds
+        if(cmd->compound == 0 && cmd->numWords <= 0)
+        {
+            struct spawnPlan plan;
+
+            planInit(&plan, cmd->words, 0);
+            int failed = openRedirects(arena, &plan, cmd) == -1;
+            planClose(&plan);
+
+            closeFd(prevRead);
+            closeFd(pipeFds[1]);
+            if(i == n - 1)
+                lastStatus = W_EXITCODE(failed, 0);
+        }
+
+        // Builtins run once every external command is started
+        else if(cmd->compound == 0 && (builtin[i] = commandBuiltin(cmd, i == n - 1 && !pipeline->background)) != -1)
+        {
+            ins[i] = prevRead;
+            outs[i] = pipeFds[1];
+        }
+
+        else
+        {
+            pid_t pid = cmd->compound != 0 ? launchCompound(arena, cmd, prevRead, pipeFds[1], pipeline->background) :
+                launchCommand(arena, cmd, prevRead, pipeFds[1], pipeline->background, measure);
+            if(pid != -1)
+            {
+                if(i == n - 1)
+                    lastPid = numPids;
+                pids[numPids++] = pid;
+            }
+            else if(i == n - 1)
+                lastStatus = W_EXITCODE(1, 0);
+
+            // The shell's copies of the pipe ends are no longer needed
+            closeFd(prevRead);
+            closeFd(pipeFds[1]);
+        }
+
+        prevRead = pipeFds[0];
+    }
+
+    // Run the builtins, output for the next command goes into memory and is spliced into the pipe
+    for(i = 0; i < n; i++)
+    {
+        if(builtin[i] == -1)
+            continue;
+
+        int result = runBuiltinCommand(arena, &pipeline->commands[i], builtin[i], ins[i], outs[i], 1, &feeder);
+        if(feeder > 0)
+            pids[numPids++] = feeder;
+
+        closeFd(outs[i]);
+        closeFd(ins[i]);
+
+        if(i == n - 1)
+            lastStatus = W_EXITCODE(result, 0);
+    }
+
+    // The last command's process is kept last, it gives the status of the pipeline
+    if(lastPid != -1 && lastPid != numPids - 1)
+    {
+        pid_t swap = pids[lastPid];
+        pids[lastPid] = pids[numPids - 1];
+        pids[numPids - 1] = swap;
+    }
+
+    if(numPids == 0)
+    {
+        STATUS = lastStatus;
+        finishUsage(pipeline, measure, &children, !pipeline->background);
+    }
+
+    // If the pipeline runs in the foreground, then wait for it to complete. Refer to events.c
+    else if(!pipeline->background)
+    {
+        if(lastPid == -1)
+            STATUS = lastStatus;
+        waitForeground(pids, numPids, lastPid != -1, measure ? &children : 0);
+        finishUsage(pipeline, measure, &children, 1);
+    }
+
+    // Otherwise, record the pipeline as one job in the job table and watch each of its
+    // processes from the event loop. Refer to jobs.c and events.c for details
+    else
+    {
+        int slot = jobAdd(pids, numPids);
+        struct job *job = jobAt(slot);
+
+        for(i = 0; i < numPids; i++)
+            job->procs[i].pidfd = watchChild(slot, i, pids[i]);
+
+        // Remember the process ID for $!
+        LAST_BG_PID = job->pid;
+
+        printf("background pid is %d\n", job->pid);
+        fflush(stdout);
+    }
+}
+
+
+/********************
+ * runList
+ * Description: Runs the pipelines of a command list in order. A pipeline after && only runs
+ *      if STATUS is 0, after || only if it is not; a skipped pipeline leaves STATUS alone, so
+ *      `a && b || c` runs c when a or b fails. Compound commands run through ast.c
+ * -----
+ * Input: arena - the arena of the command line
+ *        list - the parsed command list
+ * Output: NA
+ * ******************/
+
+void runList(struct arena *arena, struct commandList *list)
+{
+    int i;
+
+    for(i = 0; i < list->numPipelines; i++)
+    {
+        struct pipeline *pipeline = &list->pipelines[i];
+
+        if(pipeline->connector == LIST_AND && STATUS != 0)
+            continue;
+        if(pipeline->connector == LIST_OR && STATUS == 0)
+            continue;
+
+        if(pipeline->compound != 0)
+            runCompound(arena, pipeline->compound);
+        else
+            runPipeline(arena, pipeline);
+    }
+}
@@ -0,0 +1,446 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Word expansion. Each word produced by the lexer is expanded in a single
+ *      pass: quotes and backslash escapes are removed, and $$, $?, $!, $NAME and ${NAME}
+ *      are replaced by their values. $(commands) is replaced by the output of the commands
+ *      (see substitute.c). The bodies of here-documents have an expansion of their own,
+ *      where quotes are ordinary characters. The result is written into a buffer that grows in
+ *      the line arena, so words of any length are handled
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "wish.h"
+
+extern char **environ;
+
+// The shell's process ID, formatted once at startup
+static char shellPid[24];
+
+// The process ID of the last background command, for $!
+pid_t LAST_BG_PID = 0;
+
+
+// The word being written
+struct expandBuffer
+{
+    struct arena *arena;
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+
+/********************
+ * initExpand
+ * Description: Caches the process ID of the shell for $$
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void initExpand()
+{
+    snprintf(shellPid, sizeof(shellPid), "%d", (int)getpid());
+}
+
+
+/********************
+ * putBytes
+ * Description: Appends characters to the expanded word, growing it in place when possible
+ * -----
+ * Input: out - the word being written
+ *        bytes - the characters to add
+ *        len - the number of characters
+ * Output: NA
+ * ******************/
+
+static void putBytes(struct expandBuffer *out, const char *bytes, size_t len)
+{
+    // Keep room for the null terminator
+    if(out->len + len + 1 > out->cap)
+    {
+        size_t newCap = out->cap * 2;
+        while(out->len + len + 1 > newCap)
+            newCap *= 2;
+
+        out->data = arenaRealloc(out->arena, out->data, out->len, newCap);
+        out->cap = newCap;
+    }
+
+    memcpy(out->data + out->len, bytes, len);
+    out->len += len;
+}
+
+
+/********************
+ * lookupVariable
+ * Description: Finds an environment variable from a name that is not null terminated
+ * -----
+ * Input: name - the first character of the name
+ *        len - the length of the name
+ * Output: Returns the value of the variable, or NULL if it is not set
+ * ******************/
+
+static const char *lookupVariable(const char *name, size_t len)
+{
+    char **env;
+    for(env = environ; *env != 0; env++)
+    {
+        if(strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * isNameChar
+ * Description: Tells if a character may appear in a variable name
+ * -----
+ * Input: c - the character
+ *        first - 1 if it would be the first character of the name
+ * Output: Returns 1 if the character is allowed, otherwise 0
+ * ******************/
+
+static int isNameChar(char c, int first)
+{
+    if(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        return 1;
+
+    return !first && c >= '0' && c <= '9';
+}
+
+
+/********************
+ * closingParen
+ * Description: Finds the parenthesis that ends a command substitution. Quotes and escapes
+ *      inside it are skipped the same way the lexer skipped them
+ * -----
+ * Input: word - the word being expanded
+ *        i - index of the first character after the $(
+ * Output: Returns the index of the closing parenthesis, or -1 if there is none
+ * ******************/
+
+static int closingParen(const char *word, int i)
+{
+    int depth = 1;
+    char quote = 0;
+
+    for(; word[i] != '\0'; i++)
+    {
+        char c = word[i];
+
+        if(c == '\\' && quote != '\'' && word[i + 1] != '\0')
+            i++;
+        else if(quote != 0)
+        {
+            if(c == quote)
+                quote = 0;
+        }
+        else if(c == '\'' || c == '"')
+            quote = c;
+        else if(c == '(')
+            depth++;
+        else if(c == ')' && --depth == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/********************
+ * expandDollar
+ * Description: Expands the $ construct that starts at word[i]
+ * -----
+ * Input: out - the word being written
+ *        word - the word being expanded
+ *        i - index of the $ in word
+ * Output: Returns the index of the first character after the construct
+ * ******************/
+
+static int expandDollar(struct expandBuffer *out, const char *word, int i)
+{
+    char number[24];
+    const char *value;
+    char c = word[i + 1];
+    int start, end;
+
+    // $$ - the process ID of the shell
+    if(c == '$')
+    {
+        putBytes(out, shellPid, strlen(shellPid));
+        return i + 2;
+    }
+
+    // $? - the exit value of the last foreground command, 128 + the signal if it was killed
+    if(c == '?')
+    {
+        int value = WIFSIGNALED(STATUS) ? 128 + WTERMSIG(STATUS) : WEXITSTATUS(STATUS);
+        putBytes(out, number, snprintf(number, sizeof(number), "%d", value));
+        return i + 2;
+    }
+
+    // $! - the process ID of the last background command
+    if(c == '!')
+    {
+        if(LAST_BG_PID != 0)
+            putBytes(out, number, snprintf(number, sizeof(number), "%d", (int)LAST_BG_PID));
+        return i + 2;
+    }
+
+    // $(commands) - the output of the commands
+    if(c == '(')
+    {
+        int close = closingParen(word, i + 2);
+        size_t len;
+
+        // No closing parenthesis: keep the text as it is
+        if(close == -1)
+        {
+            putBytes(out, "$", 1);
+            return i + 1;
+        }
+
+        value = substitute(out->arena, word + i + 2, close - i - 2, &len);
+        putBytes(out, value, len);
+        return close + 1;
+    }
+
+    // ${NAME}
+    if(c == '{')
+    {
+        start = end = i + 2;
+        while(isNameChar(word[end], end == start))
+            end++;
+
+        // Not a valid name or no closing brace: keep the text as it is
+        if(word[end] != '}' || end == start)
+        {
+            putBytes(out, "$", 1);
+            return i + 1;
+        }
+
+        value = lookupVariable(word + start, end - start);
+        if(value != 0)
+            putBytes(out, value, strlen(value));
+        return end + 1;
+    }
+
+    // $NAME
+    if(isNameChar(c, 1))
+    {
+        start = end = i + 1;
+        while(isNameChar(word[end], end == start))
+            end++;
+
+        value = lookupVariable(word + start, end - start);
+        if(value != 0)
+            putBytes(out, value, strlen(value));
+        return end;
+    }
+
+    // A lone $ is an ordinary character
+    putBytes(out, "$", 1);
+    return i + 1;
+}
+
+
+/********************
+ * wordIsLiteral
+ * Description: Tells if a word is used exactly as typed, with nothing to expand or remove
+ * -----
+ * Input: word - the word with its quotes
+ * Output: Returns 1 if expandWord would return the word itself, otherwise 0
+ * ******************/
+
+int wordIsLiteral(const char *word)
+{
+    return strpbrk(word, "$'\"\\") == 0;
+}
+
+
+/********************
+ * expandWord
+ * Description: Expands a word produced by the lexer in a single pass. Quotes and backslash
+ *      escapes are removed; $ constructs are expanded outside of single quotes. Inside double
+ *      quotes a backslash only escapes $ ` " and \
+ * -----
+ * Input: arena - the arena the result is allocated from
+ *        word - the word with its quotes
+ * Output: Returns the expanded word. Returns NULL if an unquoted word expanded to nothing,
+ *        in which case the word should be dropped from the argument list
+ * ******************/
+
+char *expandWord(struct arena *arena, char *word)
+{
+    struct expandBuffer out;
+    char quote = 0;
+    int quoted = 0;
+    int i = 0;
+
+    // Nothing to expand or remove
+    if(wordIsLiteral(word))
+        return word;
+
+    out.arena = arena;
+    out.len = 0;
+    out.cap = strlen(word) + 32;
+    out.data = arenaAlloc(arena, out.cap);
+
+    while(word[i] != '\0')
+    {
+        // Copy a run of characters with no special meaning at once
+        int run = i;
+        while(word[run] != '\0' && word[run] != '$' && word[run] != '\\' && word[run] != '"' && word[run] != '\'')
+            run++;
+
+        if(run > i)
+        {
+            putBytes(&out, word + i, run - i);
+            i = run;
+            continue;
+        }
+
+        char c = word[i];
+
+        // Inside single quotes everything up to the closing quote is literal
+        if(quote == '\'')
+        {
+            if(c == '\'')
+                quote = 0;
+            else
+                putBytes(&out, word + i, 1);
+            i++;
+        }
+
+        // Backslash escapes
+        else if(c == '\\' && word[i + 1] != '\0')
+        {
+            // Inside double quotes most backslashes are kept literally
+            if(quote == '"' && strchr("$`\"\\", word[i + 1]) == 0)
+                putBytes(&out, word + i, 1);
+
+            putBytes(&out, word + i + 1, 1);
+            quoted = 1;
+            i += 2;
+        }
+
+        // Opening or closing quotes
+        else if(c == '"' || (c == '\'' && quote == 0))
+        {
+            quote = (quote == c) ? 0 : c;
+            quoted = 1;
+            i++;
+        }
+
+        else if(c == '$')
+            i = expandDollar(&out, word, i);
+
+        // Any other character (a single quote inside double quotes, a trailing backslash)
+        else
+        {
+            putBytes(&out, word + i, 1);
+            i++;
+        }
+    }
+
+    // An unquoted word that expanded to nothing disappears, like in other shells
+    if(out.len == 0 && !quoted)
+        return 0;
+
+    out.data[out.len] = '\0';
+    return out.data;
+}
+
+
+/********************
+ * expandHere
+ * Description: Expands the body of a here-document. Quotes are ordinary characters there:
+ *      only $ constructs are expanded, and a backslash only escapes $ ` \ and a newline
+ * -----
+ * Input: arena - the arena the result is allocated from
+ *        text - the body, as read by the lexer
+ *        len - set to the length of the result
+ * Output: Returns the expanded body
+ * ******************/
+
+char *expandHere(struct arena *arena, char *text, size_t *len)
+{
+    struct expandBuffer out;
+    int i = 0;
+
+    out.arena = arena;
+    out.len = 0;
+    out.cap = strlen(text) + 32;
+    out.data = arenaAlloc(arena, out.cap);
+
+    while(text[i] != '\0')
+    {
+        int run = i;
+        while(text[run] != '\0' && text[run] != '$' && text[run] != '\\')
+            run++;
+
+        if(run > i)
+        {
+            putBytes(&out, text + i, run - i);
+            i = run;
+        }
+        else if(text[i] == '$')
+            i = expandDollar(&out, text, i);
+        else if(text[i + 1] == '\n')
+            i += 2;
+        else if(text[i + 1] != '\0' && strchr("$`\\", text[i + 1]) != 0)
+        {
+            putBytes(&out, text + i + 1, 1);
+            i += 2;
+        }
+        else
+        {
+            putBytes(&out, text + i, 1);
+            i++;
+        }
+    }
+
+    out.data[out.len] = '\0';
+    *len = out.len;
+    return out.data;
+}
+
+
+/********************
+ * expandWords
+ * Description: Expands every word of an argument list in place. Words that expand to nothing
+ *      are removed and the list is kept NULL terminated
+ * -----
+ * Input: arena - the arena of the command line
+ *        argList - the words to expand
+ *        numArgs - the number of words
+ * Output: Returns the number of words left
+ * ******************/
+
+int expandWords(struct arena *arena, char **argList, int numArgs)
+{
+    int i, kept = 0;
+
+    for(i = 0; i < numArgs; i++)
+    {
+        char *word = expandWord(arena, argList[i]);
+        if(word != 0)
+            argList[kept++] = word;
+    }
+    argList[kept] = 0;
+
+    return kept;
+}
@@ -0,0 +1,344 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The background job table. A job is every process of a background pipeline.
+ *      Jobs live in slots whose index never changes while the job runs (the event loop uses
+ *      it to identify a pidfd). Free slots form a free list, live slots are kept in a dense
+ *      list for iteration, and a pid to slot hash index makes insertion, lookup and removal
+ *      O(1). Every array grows as needed
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "wish.h"
+
+// Starting sizes of the slot array and the hash index (the index must be a power of two)
+#define JOBS_INITIAL  64
+#define INDEX_INITIAL 128
+
+// The slots, the head of the free slot list and the number of slots allocated
+static struct job *slots = 0;
+static int freeHead = -1;
+static int numSlots = 0;
+
+// Dense list of the slots in use
+static int *live = 0;
+static int numLive = 0;
+
+// An entry of the hash index. slot is the job's slot + 1, 0 marks an empty bucket
+struct indexEntry
+{
+    pid_t pid;
+    int slot;
+};
+
+// Open addressing hash index from the pid of every process of every job to its slot
+static struct indexEntry *pidIndex = 0;
+static int indexSize = 0;
+static int numIndexed = 0;
+
+
+/********************
+ * growOrDie
+ * Description: realloc that terminates the shell if memory runs out
+ * -----
+ * Input: ptr - the memory to grow
+ *        size - the new size in bytes
+ * Output: Returns the resized memory
+ * ******************/
+
+static void *growOrDie(void *ptr, size_t size)
+{
+    void *result = realloc(ptr, size);
+    if(result == 0)
+    {
+        perror("Error growing the job table");
+        exit(1);
+    }
+
+    return result;
+}
+
+
+/********************
+ * hashPid
+ * Description: Finds the home bucket of a pid in the hash index
+ * -----
+ * Input: pid - the process ID
+ * Output: Returns the bucket index
+ * ******************/
+
+static int hashPid(pid_t pid)
+{
+    return (int)(((unsigned)pid * 2654435761u) & (unsigned)(indexSize - 1));
+}
+
+
+/********************
+ * indexInsert
+ * Description: Adds a pid to slot mapping to the hash index (linear probing)
+ * -----
+ * Input: pid - the process ID
+ *        slot - the slot holding the job
+ * Output: NA
+ * ******************/
+
+static void indexInsert(pid_t pid, int slot)
+{
+    int i = hashPid(pid);
+    while(pidIndex[i].slot != 0)
+        i = (i + 1) & (indexSize - 1);
+
+    pidIndex[i].pid = pid;
+    pidIndex[i].slot = slot + 1;
+    numIndexed++;
+}
+
+
+/********************
+ * growIndex
+ * Description: Doubles the hash index until it can take more entries while staying at most
+ *      half full, and re-inserts the processes of every live job
+ * -----
+ * Input: more - the number of entries about to be added
+ * Output: NA
+ * ******************/
+
+static void growIndex(int more)
+{
+    int i, j;
+
+    if(indexSize == 0)
+        indexSize = INDEX_INITIAL;
+    while((numIndexed + more) * 2 > indexSize)
+        indexSize *= 2;
+
+    free(pidIndex);
+    pidIndex = calloc(indexSize, sizeof(struct indexEntry));
+    if(pidIndex == 0)
+    {
+        perror("Error growing the job table");
+        exit(1);
+    }
+
+    numIndexed = 0;
+    for(i = 0; i < numLive; i++)
+    {
+        struct job *job = &slots[live[i]];
+        for(j = 0; j < job->numProcs; j++)
+            indexInsert(job->procs[j].pid, live[i]);
+    }
+}
+
+
+/********************
+ * indexRemove
+ * Description: Removes a pid from the hash index. The entries after it in the probe
+ *      sequence are shifted back so lookups never need tombstones
+ * -----
+ * Input: pid - the process ID
+ * Output: NA
+ * ******************/
+
+static void indexRemove(pid_t pid)
+{
+    int mask = indexSize - 1;
+    int i = hashPid(pid);
+
+    // Find the bucket of the pid
+    while(pidIndex[i].slot != 0 && pidIndex[i].pid != pid)
+        i = (i + 1) & mask;
+
+    if(pidIndex[i].slot == 0)
+        return;
+
+    numIndexed--;
+
+    // Shift back the following entries that would no longer be reachable
+    int j = i;
+    while(1)
+    {
+        pidIndex[i].slot = 0;
+
+        while(1)
+        {
+            j = (j + 1) & mask;
+            if(pidIndex[j].slot == 0)
+                return;
+
+            // The entry at j may move to i if its home bucket is not cyclically in (i, j]
+            int home = hashPid(pidIndex[j].pid);
+            if(i <= j ? (home <= i || home > j) : (home <= i && home > j))
+                break;
+        }
+
+        pidIndex[i] = pidIndex[j];
+        i = j;
+    }
+}
+
+
+/********************
+ * jobAdd
+ * Description: Records a new background job, growing the table as needed. The processes
+ *      are not watched yet, see watchChild in events.c
+ * -----
+ * Input: pids - the process IDs of the job, the last one is reported to the user
+ *        numPids - the number of processes
+ * Output: Returns the slot of the job
+ * ******************/
+
+int jobAdd(pid_t *pids, int numPids)
+{
+    int i, slot;
+
+    // No free slot left, double the slot array and the live list
+    if(freeHead == -1)
+    {
+        int newSize = numSlots ? numSlots * 2 : JOBS_INITIAL;
+        slots = growOrDie(slots, sizeof(struct job) * newSize);
+        live = growOrDie(live, sizeof(int) * newSize);
+
+        // Chain the new slots onto the free list
+        for(i = newSize - 1; i >= numSlots; i--)
+        {
+            slots[i].pid = -5;
+            slots[i].procs = 0;
+            slots[i].numProcs = 0;
+            slots[i].livePos = -1;
+            slots[i].nextFree = freeHead;
+            freeHead = i;
+        }
+        numSlots = newSize;
+    }
+
+    // Keep the hash index at most half full
+    if((numIndexed + numPids) * 2 > indexSize)
+        growIndex(numPids);
+
+    slot = freeHead;
+    freeHead = slots[slot].nextFree;
+
+    struct job *job = &slots[slot];
+    job->procs = growOrDie(0, sizeof(struct jobProc) * numPids);
+    job->numProcs = job->remaining = numPids;
+    job->pid = pids[numPids - 1];
+    job->status = 0;
+    job->livePos = numLive;
+    live[numLive++] = slot;
+
+    for(i = 0; i < numPids; i++)
+    {
+        job->procs[i].pid = pids[i];
+        job->procs[i].pidfd = -1;
+        job->procs[i].done = 0;
+        indexInsert(pids[i], slot);
+    }
+
+    return slot;
+}
+
+
+/********************
+ * jobFind
+ * Description: Finds the job a process ID belongs to
+ * -----
+ * Input: pid - the process ID
+ * Output: Returns the slot of the job, or -1 if the pid is not a background job
+ * ******************/
+
+int jobFind(pid_t pid)
+{
+    if(indexSize == 0)
+        return -1;
+
+    int i = hashPid(pid);
+    while(pidIndex[i].slot != 0)
+    {
+        if(pidIndex[i].pid == pid)
+            return pidIndex[i].slot - 1;
+
+        i = (i + 1) & (indexSize - 1);
+    }
+
+    return -1;
+}
+
+
+/********************
+ * jobRemove
+ * Description: Removes a finished job and returns its slot to the free list
+ * -----
+ * Input: slot - the slot of the job
+ * Output: NA
+ * ******************/
+
+void jobRemove(int slot)
+{
+    int i;
+    for(i = 0; i < slots[slot].numProcs; i++)
+        indexRemove(slots[slot].procs[i].pid);
+
+    // Move the last live job into the removed job's place in the live list
+    int pos = slots[slot].livePos;
+    live[pos] = live[--numLive];
+    slots[live[pos]].livePos = pos;
+
+    free(slots[slot].procs);
+    slots[slot].pid = -5;
+    slots[slot].procs = 0;
+    slots[slot].numProcs = 0;
+    slots[slot].livePos = -1;
+    slots[slot].nextFree = freeHead;
+    freeHead = slot;
+}
+
+
+/********************
+ * jobAt
+ * Description: Gives access to the job held in a slot
+ * -----
+ * Input: slot - the slot of the job
+ * Output: Returns a pointer to the job
+ * ******************/
+
+struct job *jobAt(int slot)
+{
+    return &slots[slot];
+}
+
+
+/********************
+ * numJobs
+ * Description: Counts the running background jobs
+ * -----
+ * Input: NA
+ * Output: Returns the number of live jobs
+ * ******************/
+
+int numJobs()
+{
+    return numLive;
+}
+
+
+/********************
+ * liveJob
+ * Description: Iterates the running background jobs. Removing the job just visited moves the
+ *      last job into its position, so iterate from the end when removing while iterating
+ * -----
+ * Input: i - position in the live list, from 0 to numJobs() - 1
+ * Output: Returns the slot of the i-th live job
+ * ******************/
+
+int liveJob(int i)
+{
+    return live[i];
+}
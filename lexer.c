@@ -0,0 +1,708 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The command line lexer. Input is consumed straight from the input
+ *      buffer (see buffer_io.c) in a single pass, so lines of any length are split in
+ *      linear time. Words are delimited by spaces and tabs, the < << <<< > >> <& >& & | ; && ||
+ *      operators are separate words even without spaces around them (a word of digits right
+ *      before a redirection joins it: 2>, 3<&0), and single quotes, double quotes,
+ *      backslash escapes and backslash-newline continuations are understood. Words keep
+ *      their quotes (so a quoted ">" is never an operator); word expansion (see expand.c)
+ *      removes them once the operators have been found. A $( command substitution ) is kept
+ *      whole inside its word, up to the matching parenthesis, blanks, operators and newlines
+ *      included; expand.c runs it. The body of a <<DELIMITER here-document, the lines that
+ *      follow the command line, takes the place of the delimiter word, so the parser and the
+ *      script cache see a here-document as one line. Runs of ordinary characters are
+ *      skipped with a vectorized byte classifier (AVX2 or SSE2, with a scalar fallback),
+ *      and comment lines are skipped with memchr
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEXER_X86 1
+#endif
+
+#include "wish.h"
+
+// The bytes that end a run of ordinary characters outside of quotes, and inside double quotes
+static const char PLAIN_STOP[] = " \t\n'\"\\<>&|;()";
+static const char DQUOTE_STOP[] = "\"\\()";
+
+// Scalar lookup tables for the same sets, built on first use
+static unsigned char plainTable[256];
+static unsigned char dquoteTable[256];
+
+// Set while lines are lexed without running them, their errors are not reported
+static int quiet = 0;
+
+// The scanner selected for this CPU
+static size_t (*scanBytes)(const char *data, size_t len, const char *set, const unsigned char *table) = 0;
+
+
+/********************
+ * scanScalar
+ * Description: Finds the first byte that belongs to a set, one byte at a time
+ * -----
+ * Input: data - the bytes to scan
+ *        len - the number of bytes
+ *        set - the bytes to look for (not used, the table holds the same set)
+ *        table - lookup table, non zero for the bytes to look for
+ * Output: Returns the index of the first byte found, or len if there is none
+ * ******************/
+
+static size_t scanScalar(const char *data, size_t len, const char *set, const unsigned char *table)
+{
+    size_t i = 0;
+    while(i < len && !table[(unsigned char)data[i]])
+        i++;
+
+    return i;
+}
+
+
+#ifdef LEXER_X86
+
+/********************
+ * scanSSE2
+ * Description: Finds the first byte that belongs to a set, 16 bytes at a time
+ * -----
+ * Input: see scanScalar
+ * Output: Returns the index of the first byte found, or len if there is none
+ * ******************/
+
+__attribute__((target("sse2")))
+static size_t scanSSE2(const char *data, size_t len, const char *set, const unsigned char *table)
+{
+    size_t i = 0;
+    int j, setLen = strlen(set);
+
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i found = _mm_setzero_si128();
+
+        for(j = 0; j < setLen; j++)
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(block, _mm_set1_epi8(set[j])));
+
+        int mask = _mm_movemask_epi8(found);
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    // Finish the tail one byte at a time
+    return i + scanScalar(data + i, len - i, set, table);
+}
+
+
+/********************
+ * scanAVX2
+ * Description: Finds the first byte that belongs to a set, 32 bytes at a time
+ * -----
+ * Input: see scanScalar
+ * Output: Returns the index of the first byte found, or len if there is none
+ * ******************/
+
+__attribute__((target("avx2")))
+static size_t scanAVX2(const char *data, size_t len, const char *set, const unsigned char *table)
+{
+    size_t i = 0;
+    int j, setLen = strlen(set);
+
+    for(; i + 32 <= len; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i found = _mm256_setzero_si256();
+
+        for(j = 0; j < setLen; j++)
+            found = _mm256_or_si256(found, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(set[j])));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(found);
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + scanSSE2(data + i, len - i, set, table);
+}
+
+#endif
+
+
+/********************
+ * initLexer
+ * Description: Builds the lookup tables and selects the fastest scanner for this CPU
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+static void initLexer()
+{
+    const char *c;
+
+    for(c = PLAIN_STOP; *c; c++)
+        plainTable[(unsigned char)*c] = 1;
+    for(c = DQUOTE_STOP; *c; c++)
+        dquoteTable[(unsigned char)*c] = 1;
+
+    scanBytes = scanScalar;
+
+#ifdef LEXER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        scanBytes = scanAVX2;
+    else if(__builtin_cpu_supports("sse2"))
+        scanBytes = scanSSE2;
+#endif
+}
+
+
+// The word being built and the list of finished words
+struct lexState
+{
+    struct arena *arena;
+    char *word;         // NULL when between words
+    size_t wordLen;
+    size_t wordCap;
+    char **words;
+    int numWords;
+    int capacity;
+};
+
+
+/********************
+ * appendBytes
+ * Description: Adds characters to the word being built. The word is the most recent arena
+ *      allocation, so it normally grows in place
+ * -----
+ * Input: lex - the lexer state
+ *        bytes - the characters to add
+ *        len - the number of characters
+ * Output: NA
+ * ******************/
+
+static void appendBytes(struct lexState *lex, const char *bytes, size_t len)
+{
+    if(lex->word == 0)
+    {
+        lex->wordCap = 32;
+        lex->wordLen = 0;
+        lex->word = arenaAlloc(lex->arena, lex->wordCap);
+    }
+
+    // Keep room for the null terminator
+    if(lex->wordLen + len + 1 > lex->wordCap)
+    {
+        size_t newCap = lex->wordCap * 2;
+        while(lex->wordLen + len + 1 > newCap)
+            newCap *= 2;
+
+        lex->word = arenaRealloc(lex->arena, lex->word, lex->wordLen, newCap);
+        lex->wordCap = newCap;
+    }
+
+    memcpy(lex->word + lex->wordLen, bytes, len);
+    lex->wordLen += len;
+}
+
+
+/********************
+ * pushWord
+ * Description: Adds a finished word to the word list
+ * -----
+ * Input: lex - the lexer state
+ *        word - the null terminated word
+ * Output: NA
+ * ******************/
+
+static void pushWord(struct lexState *lex, char *word)
+{
+    // Leave room for the word and the NULL terminator
+    if(lex->numWords + 1 >= lex->capacity)
+    {
+        lex->words = arenaRealloc(lex->arena, lex->words, sizeof(char *) * lex->capacity, sizeof(char *) * lex->capacity * 2);
+        lex->capacity *= 2;
+    }
+
+    lex->words[lex->numWords++] = word;
+    lex->words[lex->numWords] = 0;
+}
+
+
+/********************
+ * endWord
+ * Description: Finishes the word being built, if any
+ * -----
+ * Input: lex - the lexer state
+ * Output: NA
+ * ******************/
+
+static void endWord(struct lexState *lex)
+{
+    if(lex->word == 0)
+        return;
+
+    lex->word[lex->wordLen] = '\0';
+    pushWord(lex, lex->word);
+    lex->word = 0;
+}
+
+
+/********************
+ * startsSubstitution
+ * Description: Tells if a ( opens a command substitution: the word so far ends with a $
+ *      that is not escaped
+ * -----
+ * Input: lex - the lexer state
+ * Output: Returns 1 if the ( follows an unescaped $, otherwise 0
+ * ******************/
+
+static int startsSubstitution(struct lexState *lex)
+{
+    size_t i;
+
+    if(lex->word == 0 || lex->wordLen == 0 || lex->word[lex->wordLen - 1] != '$')
+        return 0;
+
+    // An odd number of backslashes escapes the $
+    for(i = lex->wordLen - 1; i > 0 && lex->word[i - 1] == '\\'; i--)
+        ;
+
+    return (lex->wordLen - 1 - i) % 2 == 0;
+}
+
+
+/********************
+ * wordIsNumber
+ * Description: Tells if the word being built is made of digits only, like the 2 of 2>
+ * -----
+ * Input: lex - the lexer state
+ * Output: Returns 1 if there is a word and it is a number, otherwise 0
+ * ******************/
+
+static int wordIsNumber(struct lexState *lex)
+{
+    if(lex->word == 0 || lex->wordLen == 0)
+        return 0;
+
+    lex->word[lex->wordLen] = '\0';
+    return strspn(lex->word, "0123456789") == lex->wordLen;
+}
+
+
+/********************
+ * joinOperator
+ * Description: Grows an operator with the operator character that follows it: && and ||,
+ *      << and <<<, >>, and the <& and >& duplications. A file descriptor before the
+ *      operator is kept: 2> becomes 2>> or 2>&
+ * -----
+ * Input: arena - the arena of the command line
+ *        op - the operator word just pushed
+ *        c - the operator character that follows it
+ * Output: Returns the longer operator, allocated from the arena, or NULL if c starts a new word
+ * ******************/
+
+static char *joinOperator(struct arena *arena, const char *op, char c)
+{
+    const char *name = op + strspn(op, "0123456789");
+    size_t len = strlen(op);
+
+    if(!((c == '&' && strcmp(op, "&") == 0) || (c == '|' && strcmp(op, "|") == 0) ||
+        (c == '<' && (strcmp(name, "<") == 0 || strcmp(name, "<<") == 0)) ||
+        (c == '>' && strcmp(name, ">") == 0) ||
+        (c == '&' && (strcmp(name, "<") == 0 || strcmp(name, ">") == 0))))
+        return 0;
+
+    char *joined = arenaAlloc(arena, len + 2);
+    memcpy(joined, op, len);
+    joined[len] = c;
+    joined[len + 1] = '\0';
+
+    return joined;
+}
+
+
+/********************
+ * readRawLine
+ * Description: Reads one line of input as it is, for the body of a here-document
+ * -----
+ * Input: arena - the arena the line is allocated from
+ *        len - set to the length of the line, without its newline
+ * Output: Returns the null terminated line, or NULL at the end of the input
+ * ******************/
+
+static char *readRawLine(struct arena *arena, size_t *len)
+{
+    char *data, *line = 0;
+    size_t cap = 0;
+    int numBytes;
+
+    *len = 0;
+    while((numBytes = inputPeek(&data)) > 0)
+    {
+        char *end = memchr(data, '\n', numBytes);
+        size_t take = end ? (size_t)(end - data) : (size_t)numBytes;
+
+        if(line == 0 || *len + take + 1 > cap)
+        {
+            size_t newCap = cap ? cap * 2 : 128;
+            while(*len + take + 1 > newCap)
+                newCap *= 2;
+
+            line = line ? arenaRealloc(arena, line, *len, newCap) : arenaAlloc(arena, newCap);
+            cap = newCap;
+        }
+
+        memcpy(line + *len, data, take);
+        *len += take;
+        inputConsume(end ? (int)take + 1 : numBytes);
+
+        if(end)
+            break;
+    }
+
+    if(line != 0)
+        line[*len] = '\0';
+
+    return line;
+}
+
+
+/********************
+ * readHereDocuments
+ * Description: Reads the bodies of the here-documents of a line, which follow it in the
+ *      input, and puts each body in place of its delimiter word. A quoted delimiter keeps
+ *      the body literal: its \, $ and ` are escaped so expandHere leaves them alone
+ * -----
+ * Input: lex - the lexer state, its words are the finished line
+ * Output: NA
+ * ******************/
+
+static void readHereDocuments(struct lexState *lex)
+{
+    int i, j;
+
+    for(i = 0; i + 1 < lex->numWords; i++)
+    {
+        char *word = lex->words[i + 1];
+
+        // An operator can not be a delimiter, the parser reports it
+        const char *op = redirectOperator(lex->words[i]);
+        if(op == 0 || strcmp(op, "<<") != 0 || word[0] == '\0' || strchr("<>&|;", word[0]) != 0)
+            continue;
+
+        // The delimiter without its quotes
+        int quoted = strpbrk(word, "'\"\\") != 0;
+        char *delimiter = arenaAlloc(lex->arena, strlen(word) + 1);
+        size_t delimLen = 0;
+        for(j = 0; word[j] != '\0'; j++)
+        {
+            if(word[j] == '\\' && word[j + 1] != '\0')
+                delimiter[delimLen++] = word[++j];
+            else if(word[j] != '\'' && word[j] != '"')
+                delimiter[delimLen++] = word[j];
+        }
+        delimiter[delimLen] = '\0';
+
+        // The lines up to the delimiter, or the end of the input
+        lex->word = 0;
+        char *line;
+        size_t len;
+        while((line = readRawLine(lex->arena, &len)) != 0 && strcmp(line, delimiter) != 0)
+        {
+            for(j = 0; quoted && j < (int)len; j++)
+            {
+                if(strchr("\\$`", line[j]) != 0)
+                    appendBytes(lex, "\\", 1);
+                appendBytes(lex, line + j, 1);
+            }
+            if(!quoted)
+                appendBytes(lex, line, len);
+            appendBytes(lex, "\n", 1);
+        }
+
+        if(lex->word == 0)
+            appendBytes(lex, "", 0);
+        lex->word[lex->wordLen] = '\0';
+        lex->words[i + 1] = lex->word;
+        lex->word = 0;
+        i++;
+    }
+}
+
+
+/********************
+ * lexLine
+ * Description: Reads one logical command line from the input buffer and splits it into words.
+ *      A quoted newline or a backslash-newline continues the line onto the next input line
+ * -----
+ * Input: arena - the arena of the command line, every word is allocated from it
+ *        wordsOut - set to the NULL terminated word list
+ * Output: Returns the number of words, -1 if the input ended before anything was read, or
+ *        LEX_ERROR if it ended inside quotes or a command substitution (a message is displayed)
+ * ******************/
+
+int lexLine(struct arena *arena, char ***wordsOut)
+{
+    struct lexState lex;
+    char *data;
+    int numBytes, readAny = 0;
+
+    // 0 outside of quotes, otherwise the quote character that is open
+    char quote = 0;
+
+    // Set when a backslash was the last byte of the buffer
+    int escaped = 0;
+
+    // Set once the line is known to be a comment
+    int comment = 0;
+
+    // Set when the last word is an operator and nothing came after it yet: & or | may become
+    // && or ||, < may become << or <<<, > may become >>, and < or > may become <& or >&
+    int lastOp = 0;
+
+    // Inside a command substitution: the parentheses open, and the quote open inside it
+    int subDepth = 0;
+    char subQuote = 0;
+    int subEscaped = 0;
+
+    if(scanBytes == 0)
+        initLexer();
+
+    lex.arena = arena;
+    lex.word = 0;
+    lex.numWords = 0;
+    lex.capacity = 16;
+    lex.words = arenaAlloc(arena, sizeof(char *) * lex.capacity);
+    lex.words[0] = 0;
+    *wordsOut = lex.words;
+
+    while((numBytes = inputPeek(&data)) > 0)
+    {
+        int i = 0;
+        readAny = 1;
+
+        // A backslash split from the character it escapes by the end of the buffer
+        if(escaped)
+        {
+            escaped = 0;
+            if(data[0] != '\n')
+            {
+                appendBytes(&lex, "\\", 1);
+                appendBytes(&lex, data, 1);
+            }
+            i = 1;
+        }
+
+        while(i < numBytes)
+        {
+            char c, *joined;
+            int joinOp = lastOp;
+            lastOp = 0;
+
+            // A comment line is skipped up to its newline without building any word
+            if(comment)
+            {
+                char *end = memchr(data + i, '\n', numBytes - i);
+                if(end == 0)
+                {
+                    i = numBytes;
+                    continue;
+                }
+
+                inputConsume(end - data + 1);
+                return 0;
+            }
+
+            // A # at the start of the first word makes the whole line a comment
+            if(data[i] == '#' && lex.word == 0 && lex.numWords == 0 && quote == 0)
+            {
+                comment = 1;
+                continue;
+            }
+
+            // A command substitution is copied as it is, expand.c finds its end again
+            if(subDepth > 0)
+            {
+                c = data[i];
+
+                if(subEscaped)
+                    subEscaped = 0;
+                else if(c == '\\' && subQuote != '\'')
+                    subEscaped = 1;
+                else if(subQuote != 0)
+                {
+                    if(c == subQuote)
+                        subQuote = 0;
+                }
+                else if(c == '\'' || c == '"')
+                    subQuote = c;
+                else if(c == '(')
+                    subDepth++;
+                else if(c == ')')
+                    subDepth--;
+
+                appendBytes(&lex, data + i, 1);
+                i++;
+                continue;
+            }
+
+            // Inside single quotes nothing is special but the closing quote
+            if(quote == '\'')
+            {
+                char *end = memchr(data + i, '\'', numBytes - i);
+                int stop = end ? (int)(end - data) + 1 : numBytes;
+
+                appendBytes(&lex, data + i, stop - i);
+                i = stop;
+                if(end)
+                    quote = 0;
+                continue;
+            }
+
+            // Copy the run of ordinary characters up to the next special one
+            size_t run = scanBytes(data + i, numBytes - i, quote ? DQUOTE_STOP : PLAIN_STOP, quote ? dquoteTable : plainTable);
+            if(run > 0)
+            {
+                appendBytes(&lex, data + i, run);
+                i += run;
+                continue;
+            }
+
+            c = data[i];
+
+            // Backslash: escapes the next character, or joins the next line if followed by a newline
+            if(c == '\\')
+            {
+                if(i + 1 == numBytes)
+                {
+                    escaped = 1;
+                    i++;
+                }
+                else
+                {
+                    if(data[i + 1] != '\n')
+                        appendBytes(&lex, data + i, 2);
+                    i += 2;
+                }
+            }
+
+            // Double quote: opens or closes a double quoted part of the word
+            else if(c == '"')
+            {
+                quote = quote ? 0 : '"';
+                appendBytes(&lex, data + i, 1);
+                i++;
+            }
+
+            // Single quote: opens a single quoted part of the word
+            else if(c == '\'')
+            {
+                quote = '\'';
+                appendBytes(&lex, data + i, 1);
+                i++;
+            }
+
+            // Parentheses are ordinary characters, unless they open a command substitution
+            else if(c == '(' || c == ')')
+            {
+                if(c == '(' && startsSubstitution(&lex))
+                    subDepth = 1;
+                appendBytes(&lex, data + i, 1);
+                i++;
+            }
+
+            // Unquoted blanks end the word
+            else if(c == ' ' || c == '\t')
+            {
+                endWord(&lex);
+                i++;
+            }
+
+            // Unquoted newline ends the command line
+            else if(c == '\n')
+            {
+                endWord(&lex);
+                inputConsume(i + 1);
+                readHereDocuments(&lex);
+                *wordsOut = lex.words;
+                return lex.numWords;
+            }
+
+            // Operators are words of their own, and an operator character right after one may
+            // grow it (see joinOperator)
+            else if(joinOp && (joined = joinOperator(arena, lex.words[lex.numWords - 1], c)) != 0)
+            {
+                lex.words[lex.numWords - 1] = joined;
+                lastOp = 1;
+                i++;
+            }
+
+            // A word of digits right before < or > is the file descriptor of the redirection: 2>
+            else if((c == '<' || c == '>') && wordIsNumber(&lex))
+            {
+                appendBytes(&lex, &c, 1);
+                endWord(&lex);
+                lastOp = 1;
+                i++;
+            }
+            else
+            {
+                endWord(&lex);
+                pushWord(&lex, arenaStrndup(arena, data + i, 1));
+                lastOp = 1;
+                i++;
+            }
+        }
+
+        inputConsume(numBytes);
+    }
+
+    // End of input
+    if(quote || subDepth > 0)
+    {
+        if(!quiet)
+        {
+            printf("unexpected end of file while looking for matching %c\n", subDepth > 0 ? ')' : quote);
+            fflush(stdout);
+        }
+        lex.numWords = 0;
+        lex.words[0] = 0;
+        *wordsOut = lex.words;
+        return LEX_ERROR;
+    }
+
+    // A backslash with nothing after it stands for itself
+    if(escaped)
+        appendBytes(&lex, "\\\\", 2);
+    endWord(&lex);
+
+    *wordsOut = lex.words;
+
+    if(!readAny)
+        return -1;
+
+    return lex.numWords;
+}
+
+
+/********************
+ * lexerQuiet
+ * Description: Turns the error messages of the lexer off or on. The script cache lexes the
+ *      lines a script did not reach, which must not report anything (see cacheFinish)
+ * -----
+ * Input: on - 1 to stay quiet, 0 to report errors again
+ * Output: NA
+ * ******************/
+
+void lexerQuiet(int on)
+{
+    quiet = on;
+}
@@ -0,0 +1,230 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Microbenchmarks of the per-line hot path of the shell: reading a line,
+ *      lexing and parsing it (parseNextLine), expanding its words (expandWords) and
+ *      rewinding the line arena (cleanBuffer). Representative lines are repeated in a
+ *      memory buffer given to the shell with inputOpenBuffer, so no command ever runs and
+ *      stdin is not involved. Reports ns/line and allocations/line for each input:
+ *      arena allocations, arena chunks taken from the heap, and every malloc call
+ *
+ *      Usage: ./microbench [lines] [repeats]
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "wish.h"
+
+// The shell state the modules expect. The shell defines it in wish.c
+int STATUS = 0;
+int BACK_STATUS = 0;
+int TSTP_FLAG = 0;
+int INTERACTIVE = 0;
+
+// Default number of lines per input, and of runs (the fastest run is reported)
+#define DEFAULT_LINES 100000
+#define DEFAULT_REPEATS 5
+
+// A representative command line
+struct benchInput
+{
+    const char *name;
+    const char *line;
+};
+
+static const struct benchInput INPUTS[] =
+{
+    {"simple",      "ls -la /tmp"},
+    {"redirect",    "sort -r < input.txt > output.txt"},
+    {"quoted",      "echo \"hello world\" 'single quoted' mixed\"quo\"ted \"a\\\"b\""},
+    {"expand",      "echo $$ ${HOME}/bin $? $! $USER-$$"},
+    {"pid",         "echo $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$ $$"},
+    {"pipeline",    "cat access.log | grep -v 404 | cut -d ' ' -f 1 | sort | uniq -c > counts.txt &"},
+    {"list",        "mkdir -p out && cd out || exit 1; touch a b c; ls -l > listing.txt"},
+    {"compound",    "for f in a b c; do if test -e $f; then echo $f; else echo none; fi; done"},
+    {"comment",     "# a comment line, skipped by the lexer without looking at its words"},
+    {"long",        0},
+};
+
+#define NUM_INPUTS (int)(sizeof(INPUTS) / sizeof(INPUTS[0]))
+
+// Every malloc, calloc and realloc made by the shell code, counted by the wrappers below
+static unsigned long mallocCalls = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+
+// ............................................
+// Allocation counters, wrapping glibc's malloc
+void *malloc(size_t size)
+{
+    mallocCalls++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    mallocCalls++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    mallocCalls++;
+    return __libc_realloc(ptr, size);
+}
+
+
+/********************
+ * buildInput
+ * Description: Fills a buffer with the same command line repeated
+ * -----
+ * Input: line - the command line, or NULL for a line of 200 words
+ *        numLines - the number of copies
+ *        len - set to the size of the buffer
+ * Output: Returns the buffer, allocated with malloc
+ * ******************/
+
+static char *buildInput(const char *line, int numLines, size_t *len)
+{
+    char longLine[4096];
+    int i;
+
+    if(line == 0)
+    {
+        size_t used = 0;
+        used += snprintf(longLine, sizeof(longLine), "printf");
+        for(i = 0; i < 200; i++)
+            used += snprintf(longLine + used, sizeof(longLine) - used, " word%d", i);
+        line = longLine;
+    }
+
+    size_t lineLen = strlen(line);
+    char *buffer = malloc((lineLen + 1) * numLines);
+    if(buffer == 0)
+    {
+        perror("Error allocating memory");
+        exit(1);
+    }
+
+    for(i = 0; i < numLines; i++)
+    {
+        memcpy(buffer + i * (lineLen + 1), line, lineLen);
+        buffer[i * (lineLen + 1) + lineLen] = '\n';
+    }
+
+    *len = (lineLen + 1) * numLines;
+    return buffer;
+}
+
+
+/********************
+ * runInput
+ * Description: Reads, parses and expands every line of the buffer, like the main loop of the
+ *      shell does before running a command
+ * -----
+ * Input: arena - the line arena
+ *        buffer - the lines
+ *        len - the size of the buffer
+ * Output: Returns the number of lines read
+ * ******************/
+
+static long runInput(struct arena *arena, char *buffer, size_t len)
+{
+    struct commandList list;
+    long numLines = 0;
+    int i, j, parsed;
+
+    inputOpenBuffer(buffer, len);
+
+    while((parsed = parseNextLine(arena, &list)) != PARSE_EOF)
+    {
+        for(j = 0; parsed == PARSE_OK && j < list.numPipelines; j++)
+        {
+            for(i = 0; i < list.pipelines[j].numCommands; i++)
+            {
+                struct command *cmd = &list.pipelines[j].commands[i];
+                cmd->numWords = expandWords(arena, cmd->words, cmd->numWords);
+            }
+        }
+
+        cleanBuffer(arena);
+        numLines++;
+    }
+
+    return numLines;
+}
+
+
+/********************
+ * Main method
+ * Description: Runs every input and displays one line of results per input
+ * -----
+ * Input: argv - optional number of lines per input and number of runs
+ * Output: Returns 0
+ * ******************/
+
+int main(int argc, char *argv[])
+{
+    int numLines = argc > 1 ? atoi(argv[1]) : DEFAULT_LINES;
+    int repeats = argc > 2 ? atoi(argv[2]) : DEFAULT_REPEATS;
+    int i, r;
+
+    if(numLines <= 0 || repeats <= 0)
+    {
+        fprintf(stderr, "usage: microbench [lines] [repeats]\n");
+        return 2;
+    }
+
+    // Cache the process ID used by $$ expansion. Refer to expand.c for details
+    initExpand();
+
+    printf("%-10s %10s %14s %14s %14s\n", "input", "ns/line", "arena/line", "chunks/line", "malloc/line");
+
+    for(i = 0; i < NUM_INPUTS; i++)
+    {
+        size_t len;
+        char *buffer = buildInput(INPUTS[i].line, numLines, &len);
+        double best = 0;
+        unsigned long arenaAllocs = 0, chunkAllocs = 0, mallocs = 0;
+
+        for(r = 0; r < repeats; r++)
+        {
+            // A fresh arena every run, so the first run also shows the arena growing
+            struct arena arena;
+            arenaInit(&arena);
+
+            unsigned long mallocsBefore = mallocCalls;
+            long long start = clockNow();
+            long lines = runInput(&arena, buffer, len);
+            double taken = (double)(clockNow() - start) / lines;
+
+            if(r == 0 || taken < best)
+                best = taken;
+
+            // Allocations do not depend on timing, the last run is reported
+            arenaAllocs = arena.allocs;
+            chunkAllocs = arena.heapAllocs;
+            mallocs = mallocCalls - mallocsBefore;
+
+            arenaFree(&arena);
+        }
+
+        printf("%-10s %10.1f %14.2f %14.4f %14.4f\n", INPUTS[i].name, best,
+            (double)arenaAllocs / numLines, (double)chunkAllocs / numLines, (double)mallocs / numLines);
+
+        free(buffer);
+    }
+
+    return 0;
+}
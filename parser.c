@@ -0,0 +1,329 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The command line parser. Turns the words found by the lexer into a
+ *      command list: pipelines separated by ;, &, && and ||. Each pipeline is made of the
+ *      commands separated by | operators, with the redirections of each command (<, >, >>, <<,
+ *      <<<, <& and >&, each with an optional file descriptor number as in 2>&1),
+ *      the time prefix and the & background operator. Operators are recognized before word
+ *      expansion, so a quoted "|", "<", ">", "&" or ";" is an ordinary argument.
+ *      parseNextLine reads and parses one line from any input, a memory buffer included. Lines
+ *      with if, while, until or for are handed to the compiler in ast.c
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "wish.h"
+
+
+/********************
+ * redirectOperator
+ * Description: Tells if a word is a redirection operator: <, >, >>, <<, <<<, <& or >&, with
+ *      the file descriptor number the lexer joined before it, as in 2> or 3<&
+ * -----
+ * Input: word - the word, with its quotes
+ * Output: Returns the operator part of the word, past the number, or NULL if it is not one
+ * ******************/
+
+const char *redirectOperator(const char *word)
+{
+    static const char *operators[] = { "<", ">", ">>", "<<", "<<<", "<&", ">&", 0 };
+    const char *name = word + strspn(word, "0123456789");
+    int i;
+
+    for(i = 0; operators[i] != 0; i++)
+    {
+        if(strcmp(name, operators[i]) == 0)
+            return name;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * parseCommand
+ * Description: Finds the redirections of one command and removes them from its words. They
+ *      can be anywhere among the words and are recorded left to right, the order they are
+ *      applied in: 2>&1 >file and >file 2>&1 differ
+ * -----
+ * Input: cmd - the command, words and numWords are set. The words are changed in place
+ * Output: Returns -1 if the command has too many redirections (a message is displayed),
+ *        otherwise 0 and the redirections of the command are recorded
+ * ******************/
+
+int parseCommand(struct command *cmd)
+{
+    int i, numArgs = 0;
+    char **argList = cmd->words;
+
+    cmd->numRedirects = 0;
+    cmd->compound = 0;
+
+    // Looked up and expanded when the command runs, unless ast.c compiles it
+    cmd->builtin = BUILTIN_UNRESOLVED;
+    cmd->numSlots = -1;
+
+    for(i = 0; i < cmd->numWords; i++)
+    {
+        const char *op = redirectOperator(argList[i]);
+
+        // Arguments are kept, moved down over the redirections already removed
+        if(op == 0)
+        {
+            argList[numArgs++] = argList[i];
+            continue;
+        }
+
+        // The pipes of the command take the last two file actions of its plan
+        if(cmd->numRedirects == MAX_ACTIONS - 2)
+        {
+            printf("too many redirections\n");
+            fflush(stdout);
+            return -1;
+        }
+
+        struct redirect *redirect = &cmd->redirects[cmd->numRedirects];
+
+        // Input operators default to fd 0 and output operators to fd 1
+        redirect->fd = op != argList[i] ? atoi(argList[i]) : (op[0] == '<' ? 0 : 1);
+        redirect->kind = REDIRECT_FILE;
+        redirect->flags = O_RDONLY;
+
+        // Per assignment specs, if the output file exists, truncate it away. >> appends to it
+        if(strcmp(op, ">") == 0)
+            redirect->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        else if(strcmp(op, ">>") == 0)
+            redirect->flags = O_WRONLY | O_CREAT | O_APPEND;
+
+        // The lexer put the body of a here-document in place of its delimiter
+        else if(strcmp(op, "<<") == 0)
+            redirect->kind = REDIRECT_HEREDOC;
+        else if(strcmp(op, "<<<") == 0)
+            redirect->kind = REDIRECT_HERESTRING;
+
+        // <& and >& make the fd a copy of another one, whose number is the target
+        else if(strcmp(op, "<&") == 0 || strcmp(op, ">&") == 0)
+            redirect->kind = REDIRECT_DUP;
+
+        // A missing file name is reported when the file is opened
+        redirect->target = i + 1 < cmd->numWords ? argList[++i] : "";
+
+        cmd->numRedirects++;
+    }
+    argList[numArgs] = 0;
+
+    cmd->numWords = numArgs;
+    return 0;
+}
+
+
+/********************
+ * parsePipeline
+ * Description: Splits the words of a command line into the commands of a pipeline. Each
+ *      | word is replaced by the NULL that terminates the command before it, so the commands
+ *      share the word list of the line
+ * -----
+ * Input: arena - the arena of the command line
+ *        words - the words of the line, with their quotes. The list is changed in place
+ *        numWords - the number of words
+ *        pipeline - the pipeline to fill in
+ * Output: Returns -1 if the line is not a valid pipeline (a message is displayed), otherwise 0
+ * ******************/
+
+int parsePipeline(struct arena *arena, char **words, int numWords, struct pipeline *pipeline)
+{
+    int i, start = 0, numCommands = 1;
+
+    pipeline->background = 0;
+    pipeline->timed = 0;
+    pipeline->compound = 0;
+
+    // `time` before the pipeline measures it as a whole. Refer to usage.c for details
+    if(numWords > 0 && strcmp(words[0], "time") == 0)
+    {
+        pipeline->timed = 1;
+        words++;
+        numWords--;
+    }
+
+    // Is the last command line argument the background process indicator?
+    if(numWords > 0 && strcmp(words[numWords - 1], "&") == 0)
+    {
+        // Check to ensure we are not in foreground-only mode
+        if(TSTP_FLAG != 1)
+            pipeline->background = 1;
+
+        // Remove the "&" operator from the list of arguments
+        words[--numWords] = 0;
+    }
+
+    for(i = 0; i < numWords; i++)
+    {
+        if(strcmp(words[i], "|") == 0)
+            numCommands++;
+    }
+
+    pipeline->commands = arenaAlloc(arena, sizeof(struct command) * numCommands);
+    pipeline->numCommands = 0;
+
+    // Cut the line at every | operator
+    for(i = 0; i <= numWords; i++)
+    {
+        if(i < numWords && strcmp(words[i], "|") != 0)
+            continue;
+
+        // Every command of a pipeline needs words, a lone one may be only redirections
+        if(i == start && numCommands > 1)
+        {
+            printf("syntax error near unexpected token `|'\n");
+            fflush(stdout);
+            return -1;
+        }
+
+        struct command *cmd = &pipeline->commands[pipeline->numCommands++];
+        words[i] = 0;
+        cmd->words = words + start;
+        cmd->numWords = i - start;
+        if(parseCommand(cmd) == -1)
+            return -1;
+
+        start = i + 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * listOperator
+ * Description: Tells if a word separates two pipelines of a command list
+ * -----
+ * Input: word - the word, with its quotes
+ * Output: Returns 1 for ;, &, && and ||, otherwise 0
+ * ******************/
+
+int listOperator(const char *word)
+{
+    return strcmp(word, ";") == 0 || strcmp(word, "&") == 0 || strcmp(word, "&&") == 0 ||
+        strcmp(word, "||") == 0;
+}
+
+
+/********************
+ * parseList
+ * Description: Splits the words of a command line into the pipelines of a command list. A
+ *      pipeline ends at ;, at & (which also puts it in the background), or at && and ||,
+ *      which make the next pipeline depend on its status. Like |, each operator is replaced
+ *      by the NULL that ends the words before it. A ; or & may end the line
+ * -----
+ * Input: arena - the arena of the command line
+ *        words - the words of the line, with their quotes. The list is changed in place
+ *        numWords - the number of words
+ *        list - the list to fill in
+ * Output: Returns -1 if the line is not a valid list (a message is displayed), otherwise 0
+ * ******************/
+
+int parseList(struct arena *arena, char **words, int numWords, struct commandList *list)
+{
+    int i, start = 0, numPipelines = 1, connector = LIST_ALWAYS;
+
+    for(i = 0; i < numWords; i++)
+    {
+        if(listOperator(words[i]))
+            numPipelines++;
+    }
+
+    list->pipelines = arenaAlloc(arena, sizeof(struct pipeline) * numPipelines);
+    list->numPipelines = 0;
+
+    for(i = 0; i <= numWords; i++)
+    {
+        if(i < numWords && !listOperator(words[i]))
+            continue;
+
+        // Every operator needs a pipeline before it, && and || one after it too
+        if(i == start && (i < numWords || connector != LIST_ALWAYS))
+        {
+            printf("syntax error near unexpected token `%s'\n", i < numWords ? words[i] : "newline");
+            fflush(stdout);
+            return -1;
+        }
+
+        // A ; or & at the very end
+        if(i == start)
+            break;
+
+        // & stays the last word of its pipeline, parsePipeline turns it into the background flag
+        int end = i;
+        const char *op = i < numWords ? words[i] : ";";
+        if(strcmp(op, "&") == 0)
+            end++;
+        else
+            words[i] = 0;
+
+        struct pipeline *pipeline = &list->pipelines[list->numPipelines++];
+        if(parsePipeline(arena, words + start, end - start, pipeline) == -1)
+            return -1;
+        pipeline->connector = connector;
+
+        if(strcmp(op, "&&") == 0)
+            connector = LIST_AND;
+        else if(strcmp(op, "||") == 0)
+            connector = LIST_OR;
+        else
+            connector = LIST_ALWAYS;
+
+        start = i + 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * parseNextLine
+ * Description: Reads the next command line from the input (stdin, a script, a -c string
+ *      or a memory buffer, see buffer_io.c) and parses it into a command list. The words
+ *      are not expanded yet, that happens when each command runs
+ * -----
+ * Input: arena - the arena of the command line, reset by the caller after the line
+ *        list - the command list to fill in
+ * Output: Returns PARSE_OK if the list is ready to run, PARSE_EMPTY for an empty line or
+ *        a comment, PARSE_ERROR if the line is not valid (a message is displayed), or
+ *        PARSE_EOF at the end of the input
+ * ******************/
+
+int parseNextLine(struct arena *arena, struct commandList *list)
+{
+    int numWords = 0;
+
+    // Split the line into words. Refer to buffer_io.c and lexer.c for details
+    char **words = getCommandLine(arena, &numWords);
+    if(words == 0)
+        return PARSE_EOF;
+
+    // The input ended inside quotes or a command substitution (see lexer.c)
+    if(numWords == LEX_ERROR)
+        return PARSE_ERROR;
+
+    // Empty lines and lines that start with the comment mark ( # ) are ignored completely
+    if(words[0] == 0 || words[0][0] == '#')
+        return PARSE_EMPTY;
+
+    // Control flow may go on over the next lines. Refer to ast.c for details
+    if(needsCompiler(words, numWords))
+        return compileLine(arena, words, numWords, list);
+
+    if(parseList(arena, words, numWords, list) == -1)
+        return PARSE_ERROR;
+
+    return PARSE_OK;
+}
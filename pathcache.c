@@ -0,0 +1,424 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The command hash table. The first time a command is run its program is
+ *      searched in the $PATH directories by the shell, and the absolute path is remembered,
+ *      so the spawn engine can execute it directly instead of trying every directory in the
+ *      child. The table is emptied when PATH changes, an entry is dropped when its program
+ *      is gone (ENOENT), and the `hash` builtin shows or clears it
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wish.h"
+
+// Starting size of the table (must be a power of two)
+#define PATH_INITIAL 64
+
+// Search path used when PATH is not set, like execvp
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// A remembered command. name and path share one allocation
+struct pathEntry
+{
+    char *name;         // NULL marks an empty bucket
+    char *path;
+    unsigned long hits;
+    int warmed;         // 1 if pathWarm added it, it is listed once it has been used
+};
+
+// Open addressing table from command name to absolute path
+static struct pathEntry *table = 0;
+static int tableSize = 0;
+static int numEntries = 0;
+
+// The PATH the table was built for
+static char *cachedPath = 0;
+
+// Lookups answered from the table, and lookups that had to search PATH
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+
+/********************
+ * hashName
+ * Description: FNV-1a hash of a command name
+ * -----
+ * Input: name - the command name
+ * Output: Returns the home bucket of the name
+ * ******************/
+
+static int hashName(const char *name)
+{
+    unsigned hash = 2166136261u;
+    while(*name)
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+    return (int)(hash & (unsigned)(tableSize - 1));
+}
+
+
+/********************
+ * findBucket
+ * Description: Finds the bucket of a name, or the empty bucket where it would go
+ * -----
+ * Input: name - the command name
+ * Output: Returns the bucket index
+ * ******************/
+
+static int findBucket(const char *name)
+{
+    int i = hashName(name);
+    while(table[i].name != 0 && strcmp(table[i].name, name) != 0)
+        i = (i + 1) & (tableSize - 1);
+
+    return i;
+}
+
+
+/********************
+ * pathClear
+ * Description: Forgets every remembered command. The hit and miss counters are kept
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void pathClear()
+{
+    int i;
+    for(i = 0; i < tableSize; i++)
+    {
+        free(table[i].name);
+        table[i].name = 0;
+    }
+
+    numEntries = 0;
+}
+
+
+/********************
+ * insertEntry
+ * Description: Remembers the path of a command, doubling the table when it is half full
+ * -----
+ * Input: name - the command name
+ *        path - the absolute path of its program
+ * Output: Returns the entry
+ * ******************/
+
+static struct pathEntry *insertEntry(const char *name, const char *path)
+{
+    int i;
+
+    if((numEntries + 1) * 2 > tableSize)
+    {
+        struct pathEntry *old = table;
+        int oldSize = tableSize;
+
+        tableSize = tableSize ? tableSize * 2 : PATH_INITIAL;
+        table = calloc(tableSize, sizeof(struct pathEntry));
+        if(table == 0)
+        {
+            perror("Error growing the command hash table");
+            exit(1);
+        }
+
+        for(i = 0; i < oldSize; i++)
+        {
+            if(old[i].name != 0)
+                table[findBucket(old[i].name)] = old[i];
+        }
+        free(old);
+    }
+
+    size_t nameLen = strlen(name) + 1;
+    size_t pathLen = strlen(path) + 1;
+
+    i = findBucket(name);
+    table[i].name = malloc(nameLen + pathLen);
+    if(table[i].name == 0)
+    {
+        perror("Error allocating memory");
+        exit(1);
+    }
+    table[i].path = table[i].name + nameLen;
+    memcpy(table[i].name, name, nameLen);
+    memcpy(table[i].path, path, pathLen);
+    table[i].hits = 0;
+    table[i].warmed = 0;
+    numEntries++;
+
+    return &table[i];
+}
+
+
+/********************
+ * pathForget
+ * Description: Drops a remembered command, after its program turned out to be gone. The
+ *      entries after it in the probe sequence are re-inserted so they stay reachable
+ * -----
+ * Input: name - the command name
+ * Output: NA
+ * ******************/
+
+void pathForget(const char *name)
+{
+    if(tableSize == 0)
+        return;
+
+    int i = findBucket(name);
+    if(table[i].name == 0)
+        return;
+
+    free(table[i].name);
+    table[i].name = 0;
+    numEntries--;
+
+    for(i = (i + 1) & (tableSize - 1); table[i].name != 0; i = (i + 1) & (tableSize - 1))
+    {
+        struct pathEntry moved = table[i];
+        table[i].name = 0;
+        table[findBucket(moved.name)] = moved;
+    }
+}
+
+
+/********************
+ * checkPath
+ * Description: Empties the table if PATH changed since it was filled
+ * -----
+ * Input: NA
+ * Output: Returns the current search path
+ * ******************/
+
+static const char *checkPath()
+{
+    const char *path = getenv("PATH");
+    if(path == 0)
+        path = DEFAULT_PATH;
+
+    if(cachedPath == 0 || strcmp(cachedPath, path) != 0)
+    {
+        pathClear();
+        free(cachedPath);
+        cachedPath = strdup(path);
+    }
+
+    return path;
+}
+
+
+/********************
+ * searchPath
+ * Description: Searches the directories of the search path for an executable file
+ * -----
+ * Input: search - the search path, directories separated by ':' (an empty one is the current directory)
+ *        name - the command name
+ *        result - set to the path of the program, at least PATH_MAX bytes
+ * Output: Returns 1 if found in an absolute directory, 2 if found in a relative one, otherwise 0
+ * ******************/
+
+static int searchPath(const char *search, const char *name, char *result)
+{
+    struct stat info;
+    size_t nameLen = strlen(name);
+
+    while(1)
+    {
+        const char *end = strchr(search, ':');
+        size_t dirLen = end ? (size_t)(end - search) : strlen(search);
+
+        if(dirLen + nameLen + 2 <= PATH_MAX)
+        {
+            if(dirLen == 0)
+                memcpy(result, name, nameLen + 1);
+            else
+            {
+                memcpy(result, search, dirLen);
+                result[dirLen] = '/';
+                memcpy(result + dirLen + 1, name, nameLen + 1);
+            }
+
+            if(stat(result, &info) == 0 && S_ISREG(info.st_mode) && access(result, X_OK) == 0)
+                return result[0] == '/' ? 1 : 2;
+        }
+
+        if(end == 0)
+            return 0;
+        search = end + 1;
+    }
+}
+
+
+/********************
+ * pathLookup
+ * Description: Finds the program of a command. Names with a / are used as they are; other
+ *      names come from the table, or are searched in PATH and remembered. Programs found in
+ *      a relative PATH directory are not remembered, as they depend on the current directory
+ * -----
+ * Input: name - the command name
+ * Output: Returns the path of the program (valid until the table changes), or NULL if it
+ *        can not be found
+ * ******************/
+
+const char *pathLookup(const char *name)
+{
+    static char found[PATH_MAX];
+
+    if(strchr(name, '/') != 0)
+        return name;
+
+    const char *search = checkPath();
+
+    if(numEntries > 0)
+    {
+        int i = findBucket(name);
+        if(table[i].name != 0)
+        {
+            hits++;
+            table[i].hits++;
+            return table[i].path;
+        }
+    }
+
+    misses++;
+
+    int where = searchPath(search, name, found);
+    if(where == 0)
+        return 0;
+    if(where == 2)
+        return found;
+
+    struct pathEntry *entry = insertEntry(name, found);
+    entry->hits = 1;
+    return entry->path;
+}
+
+
+/********************
+ * pathWarm
+ * Description: Fills the table with every program of the absolute PATH directories, the
+ *      first directory winning as in a search. wish --serve calls it before accepting
+ *      connections, so every session it forks starts with a warm table
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void pathWarm()
+{
+    char found[PATH_MAX];
+    struct dirent *entry;
+    struct stat info;
+    const char *search = checkPath();
+
+    while(1)
+    {
+        const char *end = strchr(search, ':');
+        size_t dirLen = end ? (size_t)(end - search) : strlen(search);
+        DIR *dir = 0;
+
+        // Relative directories depend on the current directory, they are never remembered
+        if(dirLen > 0 && search[0] == '/' && dirLen + 2 <= PATH_MAX)
+        {
+            memcpy(found, search, dirLen);
+            found[dirLen] = '\0';
+            dir = opendir(found);
+        }
+
+        while(dir != 0 && (entry = readdir(dir)) != 0)
+        {
+            size_t nameLen = strlen(entry->d_name);
+
+            if(entry->d_name[0] == '.' || dirLen + nameLen + 2 > PATH_MAX ||
+                (numEntries > 0 && table[findBucket(entry->d_name)].name != 0))
+                continue;
+
+            found[dirLen] = '/';
+            memcpy(found + dirLen + 1, entry->d_name, nameLen + 1);
+            if(stat(found, &info) == 0 && S_ISREG(info.st_mode) && access(found, X_OK) == 0)
+                insertEntry(entry->d_name, found)->warmed = 1;
+        }
+
+        if(dir != 0)
+            closedir(dir);
+
+        if(end == 0)
+            return;
+        search = end + 1;
+    }
+}
+
+
+/********************
+ * builtIn_hash
+ * Description: The hash builtin. With no argument, lists the remembered commands with the
+ *      number of times each was used, then the hit and miss counters. `hash -r` forgets
+ *      every command, `hash name...` searches the names again and remembers them
+ * -----
+ * Input: argList - the words of the command
+ *        out - where the builtin writes
+ * Output: Returns the exit value: 1 if a name was not found, otherwise 0
+ * ******************/
+
+int builtIn_hash(char **argList, struct output *out)
+{
+    int i, result = 0;
+
+    checkPath();
+
+    if(argList[1] == 0)
+    {
+        int shown = 0;
+
+        // The commands found ahead of time by pathWarm are not shown until they are used
+        for(i = 0; i < tableSize; i++)
+        {
+            if(table[i].name == 0 || (table[i].warmed && table[i].hits == 0))
+                continue;
+
+            if(shown++ == 0)
+                outPrintf(out, "hits\tcommand\n");
+            outPrintf(out, "%4lu\t%s\n", table[i].hits, table[i].path);
+        }
+
+        if(shown == 0)
+            outPrintf(out, "hash: hash table empty\n");
+
+        outPrintf(out, "lookups: %lu hits, %lu misses\n", hits, misses);
+        return 0;
+    }
+
+    for(i = 1; argList[i] != 0; i++)
+    {
+        if(strcmp(argList[i], "-r") == 0)
+        {
+            pathClear();
+            continue;
+        }
+
+        // Search the name again, even if it was remembered
+        pathForget(argList[i]);
+        if(pathLookup(argList[i]) == 0)
+        {
+            fprintf(stderr, "hash: %s: not found\n", argList[i]);
+            result = 1;
+        }
+
+        // Looking a name up through the builtin is not a use of the command
+        else if(numEntries > 0 && table[findBucket(argList[i])].name != 0)
+            table[findBucket(argList[i])].hits = 0;
+    }
+
+    return result;
+}
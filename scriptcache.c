@@ -0,0 +1,508 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The script cache. The first time a script runs, the words of its lines are
+ *      recorded as the shell lexes them and written to a compact binary file: a header holding the key of the
+ *      script (absolute path, size, mtime, device and inode), then a table of the lines, a
+ *      table of the words and one block of null terminated strings. Later runs of the same
+ *      script map that file and hand the parser the words of each line straight from it,
+ *      without lexing anything. The words still have their quotes, so they are expanded
+ *      and parsed exactly as if they had just been lexed. A script that changed, or a cache
+ *      that does not check out, falls back to the lexer (and a new cache file)
+ *
+ *      The files live in $WISH_CACHE, $XDG_CACHE_HOME/wish or ~/.cache/wish, one per script,
+ *      named after a hash of its path. WISH_CACHE=off turns the cache off
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "wish.h"
+
+#define CACHE_MAGIC   0x43485357u       // "WSHC"
+#define CACHE_VERSION 4
+
+// Larger scripts are not cached, the offsets of the file are 32 bits
+#define CACHE_MAX_SCRIPT (256 * 1024 * 1024)
+
+// The start of a cache file. The path follows it, null terminated and padded to 4 bytes,
+// then the line table, the word table and the strings
+struct cacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t scriptSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t pathLen;
+    uint32_t numLines;
+    uint32_t numWords;
+    uint32_t poolSize;
+};
+
+// A line of the script: its words in the word table, and the bytes it took in the script
+struct cacheLine
+{
+    uint32_t firstWord;
+    uint32_t numWords;
+    uint32_t numBytes;
+};
+
+// The cache being read, if any
+static struct cacheLine *lines = 0;
+static uint32_t *wordOffsets = 0;
+static char *pool = 0;
+static uint32_t numLines = 0;
+static uint32_t nextLine = 0;
+
+// A growing block of memory, used to build a cache file
+struct growBuffer
+{
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// The cache file being built from the lines the shell lexes, if any
+static struct
+{
+    int recording;
+    char *absolute;
+    char file[PATH_MAX];
+    struct cacheHeader header;
+    struct growBuffer lineTable;
+    struct growBuffer wordTable;
+    struct growBuffer strings;
+} writer;
+
+
+/********************
+ * cacheDirectory
+ * Description: Finds the directory of the cache files, and creates it when a file is written
+ * -----
+ * Input: dir - set to the directory
+ *        size - the size of dir
+ *        create - 1 to create the directory if needed
+ * Output: Returns 0 if the directory can be used, -1 if the cache is off
+ * ******************/
+
+static int cacheDirectory(char *dir, size_t size, int create)
+{
+    const char *chosen = getenv("WISH_CACHE");
+    const char *base;
+    int len;
+
+    if(chosen != 0 && (chosen[0] == '\0' || strcmp(chosen, "off") == 0))
+        return -1;
+
+    if(chosen != 0)
+        len = snprintf(dir, size, "%s", chosen);
+    else if((base = getenv("XDG_CACHE_HOME")) != 0 && base[0] == '/')
+        len = snprintf(dir, size, "%s/wish", base);
+    else if((base = getenv("HOME")) != 0 && base[0] == '/')
+    {
+        // ~/.cache may not exist yet either
+        snprintf(dir, size, "%s/.cache", base);
+        if(create)
+            mkdir(dir, 0700);
+        len = snprintf(dir, size, "%s/.cache/wish", base);
+    }
+    else
+        return -1;
+
+    if(len <= 0 || (size_t)len >= size)
+        return -1;
+
+    if(create && mkdir(dir, 0700) == -1 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+
+/********************
+ * cachePath
+ * Description: Names the cache file of a script: an FNV-1a hash of its absolute path
+ * -----
+ * Input: script - the absolute path of the script
+ *        file - set to the path of the cache file
+ *        size - the size of file
+ *        create - 1 to create the directory if needed
+ * Output: Returns 0, or -1 if the cache is off
+ * ******************/
+
+static int cachePath(const char *script, char *file, size_t size, int create)
+{
+    char dir[PATH_MAX];
+    uint64_t hash = 14695981039346656037ULL;
+    const char *c;
+
+    if(cacheDirectory(dir, sizeof(dir), create) == -1)
+        return -1;
+
+    for(c = script; *c != '\0'; c++)
+    {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+
+    int len = snprintf(file, size, "%s/%016llx.wshc", dir, (unsigned long long)hash);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+
+/********************
+ * cacheKey
+ * Description: Fills in the part of a header that identifies a script
+ * -----
+ * Input: header - the header, cleared first
+ *        script - the absolute path of the script
+ *        info - the status of the script
+ * Output: NA
+ * ******************/
+
+static void cacheKey(struct cacheHeader *header, const char *script, struct stat *info)
+{
+    memset(header, 0, sizeof(struct cacheHeader));
+    header->magic = CACHE_MAGIC;
+    header->version = CACHE_VERSION;
+    header->scriptSize = info->st_size;
+    header->mtimeSec = info->st_mtim.tv_sec;
+    header->mtimeNsec = info->st_mtim.tv_nsec;
+    header->dev = info->st_dev;
+    header->ino = info->st_ino;
+    header->pathLen = strlen(script);
+}
+
+
+/********************
+ * pathSpace
+ * Description: Tells how many bytes the path takes in a cache file
+ * -----
+ * Input: pathLen - the length of the path
+ * Output: Returns the length with its null terminator, rounded up to 4 bytes
+ * ******************/
+
+static size_t pathSpace(uint32_t pathLen)
+{
+    return ((size_t)pathLen + 1 + 3) & ~(size_t)3;
+}
+
+
+/********************
+ * cacheLoad
+ * Description: Maps the cache file of a script and checks it against the script. The
+ *      whole file is checked once, so reading a line needs no further checks
+ * -----
+ * Input: script - the path of the script, as given to the shell
+ *        info - the status of the open script
+ * Output: Returns 1 if the lines of the script will come from the cache, otherwise 0
+ * ******************/
+
+int cacheLoad(const char *script, struct stat *info)
+{
+    char file[PATH_MAX];
+    struct stat cacheInfo;
+    struct cacheHeader key;
+    uint32_t i;
+
+    char *absolute = realpath(script, NULL);
+    if(absolute == 0 || info->st_size > CACHE_MAX_SCRIPT || cachePath(absolute, file, sizeof(file), 0) == -1)
+    {
+        free(absolute);
+        return 0;
+    }
+
+    cacheKey(&key, absolute, info);
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if(fd == -1)
+    {
+        free(absolute);
+        return 0;
+    }
+
+    // Only a file written by this user is trusted
+    if(fstat(fd, &cacheInfo) == -1 || !S_ISREG(cacheInfo.st_mode) || cacheInfo.st_uid != geteuid() ||
+        (size_t)cacheInfo.st_size < sizeof(struct cacheHeader))
+    {
+        close(fd);
+        free(absolute);
+        return 0;
+    }
+
+    // Words point into the mapping, a private writable one so the words behave like lexed ones
+    char *data = mmap(NULL, cacheInfo.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        free(absolute);
+        return 0;
+    }
+
+    struct cacheHeader *header = (struct cacheHeader *)data;
+    size_t expected = sizeof(struct cacheHeader) + pathSpace(header->pathLen) +
+        sizeof(struct cacheLine) * (size_t)header->numLines + sizeof(uint32_t) * (size_t)header->numWords +
+        header->poolSize;
+
+    // The key: everything up to the counts must match, then the path itself
+    int valid = memcmp(header, &key, offsetof(struct cacheHeader, numLines)) == 0 &&
+        expected == (size_t)cacheInfo.st_size &&
+        memcmp(data + sizeof(struct cacheHeader), absolute, key.pathLen + 1) == 0;
+    free(absolute);
+
+    if(valid)
+    {
+        lines = (struct cacheLine *)(data + sizeof(struct cacheHeader) + pathSpace(header->pathLen));
+        wordOffsets = (uint32_t *)(lines + header->numLines);
+        pool = (char *)(wordOffsets + header->numWords);
+
+        // Every word must start, and end, inside the strings
+        valid = header->poolSize == 0 || pool[header->poolSize - 1] == '\0';
+        for(i = 0; valid && i < header->numLines; i++)
+            valid = lines[i].firstWord <= header->numWords && lines[i].numWords <= header->numWords - lines[i].firstWord;
+        for(i = 0; valid && i < header->numWords; i++)
+            valid = wordOffsets[i] < header->poolSize;
+    }
+
+    if(!valid)
+    {
+        munmap(data, cacheInfo.st_size);
+        lines = 0;
+        return 0;
+    }
+
+    numLines = header->numLines;
+    nextLine = 0;
+    return 1;
+}
+
+
+/********************
+ * cacheNextLine
+ * Description: Gives the words of the next line of a cached script, like lexLine
+ * -----
+ * Input: arena - the arena of the command line, the word list is allocated from it
+ *        wordsOut - set to the NULL terminated word list. The words stay in the mapping
+ *        numBytes - set to the bytes the line took in the script
+ * Output: Returns the number of words, or -1 at the end of the script
+ * ******************/
+
+int cacheNextLine(struct arena *arena, char ***wordsOut, int *numBytes)
+{
+    uint32_t i;
+
+    if(nextLine == numLines)
+        return -1;
+
+    struct cacheLine *line = &lines[nextLine++];
+    char **words = arenaAlloc(arena, sizeof(char *) * (line->numWords + 1));
+
+    for(i = 0; i < line->numWords; i++)
+        words[i] = pool + wordOffsets[line->firstWord + i];
+    words[line->numWords] = 0;
+
+    *wordsOut = words;
+    *numBytes = line->numBytes;
+    return line->numWords;
+}
+
+
+/********************
+ * growAppend
+ * Description: Adds bytes to a growing buffer
+ * -----
+ * Input: buffer - the buffer
+ *        data - the bytes
+ *        len - the number of bytes
+ * Output: Returns -1 if memory ran out, otherwise 0
+ * ******************/
+
+static int growAppend(struct growBuffer *buffer, const void *data, size_t len)
+{
+    if(buffer->len + len > buffer->cap)
+    {
+        size_t cap = buffer->cap ? buffer->cap : 4096;
+        while(cap < buffer->len + len)
+            cap *= 2;
+
+        char *grown = realloc(buffer->data, cap);
+        if(grown == 0)
+            return -1;
+
+        buffer->data = grown;
+        buffer->cap = cap;
+    }
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+
+/********************
+ * cacheDrop
+ * Description: Stops recording the lines of the script, nothing is written. The input of a
+ *      forked copy of the shell (a command substitution) is no longer the script
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void cacheDrop()
+{
+    free(writer.lineTable.data);
+    free(writer.wordTable.data);
+    free(writer.strings.data);
+    free(writer.absolute);
+    memset(&writer, 0, sizeof(writer));
+}
+
+
+/********************
+ * cacheStart
+ * Description: Starts recording the lines of a script that has no cache file yet. The
+ *      lines are taken as the shell lexes them (see cacheRecord), so the script is never
+ *      lexed twice, and the file is written once they are all known (see cacheFinish)
+ * -----
+ * Input: script - the path of the script, as given to the shell
+ *        info - the status of the open script
+ * Output: NA - nothing is recorded if the script can not be cached
+ * ******************/
+
+void cacheStart(const char *script, struct stat *info)
+{
+    cacheDrop();
+
+    char *absolute = realpath(script, NULL);
+    if(absolute == 0 || info->st_size > CACHE_MAX_SCRIPT || cachePath(absolute, writer.file, sizeof(writer.file), 1) == -1)
+    {
+        free(absolute);
+        return;
+    }
+
+    cacheKey(&writer.header, absolute, info);
+    writer.absolute = absolute;
+    writer.recording = 1;
+}
+
+
+/********************
+ * cacheRecord
+ * Description: Adds a line the shell just lexed to the cache being built
+ * -----
+ * Input: words - the words of the line, with their quotes
+ *        numWords - the number of words
+ *        numBytes - the bytes the lexer consumed for the line
+ * Output: NA - the recording stops if memory ran out
+ * ******************/
+
+void cacheRecord(char **words, int numWords, int numBytes)
+{
+    struct cacheLine line;
+    int i, failed = 0;
+
+    if(!writer.recording)
+        return;
+
+    line.firstWord = writer.wordTable.len / sizeof(uint32_t);
+    line.numWords = numWords;
+    line.numBytes = numBytes;
+
+    for(i = 0; i < numWords && !failed; i++)
+    {
+        uint32_t offset = writer.strings.len;
+        failed = growAppend(&writer.wordTable, &offset, sizeof(offset)) == -1 ||
+            growAppend(&writer.strings, words[i], strlen(words[i]) + 1) == -1;
+    }
+
+    if(failed || growAppend(&writer.lineTable, &line, sizeof(line)) == -1)
+    {
+        cacheDrop();
+        return;
+    }
+    writer.header.numLines++;
+}
+
+
+/********************
+ * cacheFinish
+ * Description: Writes the cache file of the script being recorded. A script that stops
+ *      early (exit) has the rest of its lines lexed here, quietly: they did not run, so
+ *      their errors are not reported. The file is written under a temporary name and
+ *      renamed, so a shell never maps a cache file that is only partly written
+ * -----
+ * Input: NA
+ * Output: NA - nothing is written if anything fails
+ * ******************/
+
+void cacheFinish()
+{
+    char temporary[PATH_MAX + 32];
+    struct arena arena;
+    char **words, *data;
+    int numWords = 0;
+
+    if(!writer.recording)
+        return;
+
+    arenaInit(&arena);
+    lexerQuiet(1);
+
+    int remaining = inputPeek(&data);
+    while(writer.recording && (numWords = lexLine(&arena, &words)) >= 0)
+    {
+        int left = inputPeek(&data);
+
+        cacheRecord(words, numWords, remaining - left);
+        remaining = left;
+        arenaReset(&arena);
+    }
+
+    // A script that ends inside quotes is lexed each time, so the error is reported
+    if(numWords == LEX_ERROR)
+        cacheDrop();
+
+    lexerQuiet(0);
+    arenaFree(&arena);
+
+    if(!writer.recording)
+        return;
+
+    struct cacheHeader *header = &writer.header;
+    header->numWords = writer.wordTable.len / sizeof(uint32_t);
+    header->poolSize = writer.strings.len;
+
+    snprintf(temporary, sizeof(temporary), "%s.%d", writer.file, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if(fd != -1)
+    {
+        static const char padding[4] = {0, 0, 0, 0};
+        size_t pathLen = header->pathLen + 1;
+
+        int failed = write(fd, header, sizeof(*header)) != sizeof(*header) ||
+            write(fd, writer.absolute, pathLen) != (ssize_t)pathLen ||
+            write(fd, padding, pathSpace(header->pathLen) - pathLen) != (ssize_t)(pathSpace(header->pathLen) - pathLen) ||
+            write(fd, writer.lineTable.data, writer.lineTable.len) != (ssize_t)writer.lineTable.len ||
+            write(fd, writer.wordTable.data, writer.wordTable.len) != (ssize_t)writer.wordTable.len ||
+            write(fd, writer.strings.data, writer.strings.len) != (ssize_t)writer.strings.len;
+
+        if(close(fd) == -1 || failed || rename(temporary, writer.file) == -1)
+            unlink(temporary);
+    }
+
+    cacheDrop();
+}
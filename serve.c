@@ -0,0 +1,271 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The command server (wish --serve path.sock). The shell listens on a UNIX
+ *      domain socket and forks a session for every connection, so several clients run at
+ *      the same time. A session is a complete shell whose input is the connection: the
+ *      client writes command lines exactly as in a script (redirections, pipelines, &,
+ *      $$ which is the pid of the session) and gets one record back for every line that
+ *      ran, in order:
+ *
+ *          status N            the exit value of the line, like $? (128 + N for signal N)
+ *          output LEN          followed by LEN bytes: what the line wrote to stdout and
+ *                              stderr, sent before its status when output is captured
+ *
+ *      Output is captured when the first line of the connection is "#!capture" (a comment
+ *      to any other shell), otherwise it goes to the stdout of the server. Commands read
+ *      /dev/null as stdin. The session ends when the client closes its side of the
+ *      connection, or with exit. Sessions are forked from the server before anything else
+ *      is set up, so each has its own event loop, jobs and spawn engine, and starts
+ *      without any exec or dynamic linking. The server fills the command hash table with
+ *      the programs of PATH first (see pathWarm), so no session searches PATH for them
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+
+#include "wish.h"
+
+// The first line of a connection that asks for the output of the commands
+#define CAPTURE_LINE "#!capture\n"
+
+// Set in a session: the connection, and the memfd that receives the output if captured
+int SERVING = 0;
+static int connFd = -1;
+static int captureFd = -1;
+
+
+/********************
+ * sendAll
+ * Description: Writes bytes to the client. A client that went away ends the session
+ * -----
+ * Input: data - the bytes
+ *        len - the number of bytes
+ * Output: NA
+ * ******************/
+
+static void sendAll(const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written = write(connFd, data, len);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            _exit(1);
+
+        data += written;
+        len -= written;
+    }
+}
+
+
+/********************
+ * startCapture
+ * Description: Reads the optional first line of the connection and, if it asks for the
+ *      output, makes a memfd stdout and stderr of the session
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+static void startCapture()
+{
+    char *data;
+    int len = strlen(CAPTURE_LINE);
+
+    // Wait until the first line is complete, or the input ends or differs from it
+    int numBytes = inputPeek(&data);
+    if(numBytes < len && numBytes > 0 && memcmp(data, CAPTURE_LINE, numBytes) == 0)
+        numBytes = inputFill(&data, len);
+
+    if(numBytes < len || memcmp(data, CAPTURE_LINE, len) != 0)
+        return;
+
+    inputConsume(len);
+
+    captureFd = memfd_create("wish-output", MFD_CLOEXEC);
+    if(captureFd == -1 || dup2(captureFd, 1) == -1 || dup2(captureFd, 2) == -1)
+    {
+        perror("wish: capture");
+        _exit(1);
+    }
+}
+
+
+/********************
+ * serveLine
+ * Description: Sends the records of the line that just ran: its captured output, then its
+ *      status. Called by the main loop after every command line of a session
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void serveLine()
+{
+    char header[64];
+    struct stat info;
+
+    if(captureFd != -1)
+    {
+        fflush(stdout);
+        fflush(stderr);
+
+        if(fstat(captureFd, &info) == 0 && info.st_size > 0)
+        {
+            off_t offset = 0;
+
+            sendAll(header, snprintf(header, sizeof(header), "output %lld\n", (long long)info.st_size));
+            while(offset < info.st_size)
+            {
+                if(sendfile(connFd, captureFd, &offset, info.st_size - offset) <= 0)
+                    _exit(1);
+            }
+
+            // Start again at the beginning for the next line
+            ftruncate(captureFd, 0);
+            lseek(captureFd, 0, SEEK_SET);
+        }
+    }
+
+    int value = WIFSIGNALED(STATUS) ? 128 + WTERMSIG(STATUS) : WEXITSTATUS(STATUS);
+    sendAll(header, snprintf(header, sizeof(header), "status %d\n", value));
+}
+
+
+/********************
+ * startSession
+ * Description: Turns a freshly forked process into the session of a connection
+ * -----
+ * Input: listenFd - the listening socket, closed
+ *        fd - the connection
+ * Output: NA
+ * ******************/
+
+static void startSession(int listenFd, int fd)
+{
+    struct sigaction default_action;
+
+    close(listenFd);
+
+    // The server does not wait for its sessions, a session waits for its children
+    memset(&default_action, 0, sizeof(default_action));
+    default_action.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &default_action, NULL);
+
+    // Commands must not read the connection
+    int nullFd = open("/dev/null", O_RDONLY);
+    if(nullFd != -1 && nullFd != 0)
+    {
+        dup2(nullFd, 0);
+        close(nullFd);
+    }
+
+    SERVING = 1;
+    INTERACTIVE = 0;
+    connFd = fd;
+    inputOpenStream(fd);
+    startCapture();
+}
+
+
+/********************
+ * serveSocket
+ * Description: Listens on a UNIX domain socket and forks a session for every connection.
+ *      The server itself never returns: the function returns in each session, which then
+ *      sets up the shell and reads its commands from the connection
+ * -----
+ * Input: path - the socket, replaced if it already exists
+ * Output: NA - returns in a session only
+ * ******************/
+
+void serveSocket(const char *path)
+{
+    struct sockaddr_un address;
+    struct sigaction ignore_action;
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "wish: %s: socket path too long\n", path);
+        exit(1);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    // Only the socket a previous server left behind is replaced, never another file
+    struct stat info;
+    if(lstat(path, &info) == 0)
+    {
+        if(!S_ISSOCK(info.st_mode))
+        {
+            fprintf(stderr, "wish: %s: not a socket\n", path);
+            exit(1);
+        }
+        unlink(path);
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd == -1 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(listenFd, SOMAXCONN) == -1)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    // Finished sessions are reaped by the kernel
+    memset(&ignore_action, 0, sizeof(ignore_action));
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGCHLD, &ignore_action, NULL);
+
+    // A client that disconnects early must not kill the server
+    sigaction(SIGPIPE, &ignore_action, NULL);
+
+    // Sessions inherit the command hash table, every program of PATH is already in it
+    pathWarm();
+
+    while(1)
+    {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd == -1)
+        {
+            if(errno != EINTR && errno != ECONNABORTED)
+            {
+                perror("wish: accept");
+                exit(1);
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            startSession(listenFd, fd);
+            return;
+        }
+
+        if(pid == -1)
+            perror("wish: session");
+
+        close(fd);
+    }
+}
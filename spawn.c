@@ -0,0 +1,533 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The spawn engine used to launch every external command.
+ *      A command is described by a spawn plan (its argument vector plus a list
+ *      of file actions) and the plan is applied in the child, so the shell
+ *      never has to touch its own stdin or stdout. Three engines are available:
+ *      posix_spawn (which glibc implements with clone(CLONE_VM | CLONE_VFORK)),
+ *      the classic fork + execv path and a pre-forked spawn server (see spawn_server.c),
+ *      selectable at compile time with -DWISH_SPAWN_DEFAULT and at runtime with the
+ *      WISH_SPAWN environment variable
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "wish.h"
+
+extern char **environ;
+
+// The spawn engine currently in use. See initSpawnMode below
+int SPAWN_MODE = WISH_SPAWN_DEFAULT;
+
+// The signal mask children start with (the shell's mask before the event loop blocked signals)
+sigset_t CHILD_MASK;
+
+
+/********************
+ * initSpawnMode
+ * Description: Selects the spawn engine from the WISH_SPAWN environment variable.
+ *      Recognized values are "posix", "fork" and "server". Anything else keeps the compile
+ *      time default. The server engine starts its helper here (see spawn_server.c).
+ *      Also records the signal mask that children will start with, so it must be called
+ *      before the event loop blocks any signals
+ * -----
+ * Input: NA
+ * Output: NA - SPAWN_MODE and CHILD_MASK will be set
+ * ******************/
+
+void initSpawnMode()
+{
+    sigprocmask(SIG_SETMASK, NULL, &CHILD_MASK);
+
+    char *mode = getenv("WISH_SPAWN");
+
+    if(mode == 0)
+        return;
+
+    if(strcmp(mode, "posix") == 0)
+        SPAWN_MODE = SPAWN_POSIX;
+    else if(strcmp(mode, "fork") == 0)
+        SPAWN_MODE = SPAWN_FORK;
+    else if(strcmp(mode, "server") == 0)
+        SPAWN_MODE = SPAWN_SERVER;
+
+    // The helper is forked now, while the shell is at its smallest
+    if(SPAWN_MODE == SPAWN_SERVER && startSpawnServer() == -1)
+        SPAWN_MODE = SPAWN_POSIX;
+}
+
+
+/********************
+ * planInit
+ * Description: Prepares an empty spawn plan for the provided argument vector
+ * -----
+ * Input: plan - the plan to initialize
+ *        argv - NULL terminated argument vector, argv[0] is the program
+ *        background - 1 if the command will run in the background, otherwise 0
+ * Output: NA - the plan has no file actions
+ * ******************/
+
+void planInit(struct spawnPlan *plan, char **argv, int background)
+{
+    plan->argv = argv;
+    plan->background = background;
+    plan->waitExec = 0;
+    plan->numActions = 0;
+}
+
+
+/********************
+ * planAdd
+ * Description: Records a file action. The actions are applied in order, so a descriptor
+ *      numbered like the fd of an earlier action, or like its own fd, is first moved up: in
+ *      3>&1 >file 2>&3 the shell's stdout would be replaced by the file before becoming fd 2.
+ *      A descriptor of the caller is copied rather than moved, the plan owns the copy
+ * -----
+ * Input: plan - the plan to add the action to, it has room for it
+ *        fd - the file descriptor number in the child
+ *        srcFd - the shell's descriptor
+ *        owned - 1 if the plan closes srcFd, 0 if it belongs to the caller
+ * Output: NA
+ * ******************/
+
+static void planAdd(struct spawnPlan *plan, int fd, int srcFd, int owned)
+{
+    while((srcFd == fd && owned) || planHas(plan, srcFd))
+    {
+        int moved = fcntl(srcFd, F_DUPFD_CLOEXEC, srcFd + 1);
+        if(moved == -1)
+            break;
+
+        if(owned)
+            close(srcFd);
+        srcFd = moved;
+        owned = 1;
+    }
+
+    plan->actions[plan->numActions].fd = fd;
+    plan->actions[plan->numActions].srcFd = srcFd;
+    plan->actions[plan->numActions].owned = owned;
+    plan->numActions++;
+}
+
+
+/********************
+ * planOpen
+ * Description: Opens a file in the parent and records that it should become
+ *      file descriptor fd in the child. The parent copy is close-on-exec, so it
+ *      never leaks into the spawned program
+ * -----
+ * Input: plan - the plan to add the action to
+ *        fd - the file descriptor number in the child (0 for stdin, 1 for stdout)
+ *        path - the file to open
+ *        flags - flags passed to open()
+ * Output: Returns -1 if the file could not be opened (errno is set), otherwise 0
+ * ******************/
+
+int planOpen(struct spawnPlan *plan, int fd, const char *path, int flags)
+{
+    // No more room for file actions
+    if(plan->numActions == MAX_ACTIONS)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+
+    int srcFd = open(path, flags | O_CLOEXEC, 0644);
+    if(srcFd == -1)
+        return -1;
+
+    planAdd(plan, fd, srcFd, 1);
+    return 0;
+}
+
+
+/********************
+ * writeHere
+ * Description: Writes the whole contents of a here-document or here-string
+ * -----
+ * Input: fd - the memfd or pipe
+ *        data - the contents
+ *        len - the number of bytes
+ * Output: Returns -1 if the write failed (errno is set), otherwise 0
+ * ******************/
+
+static int writeHere(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written == -1)
+            return -1;
+
+        data += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * planHere
+ * Description: Puts the contents of a here-document or here-string in an anonymous file and
+ *      records that it should become file descriptor fd in the child. Small contents go into
+ *      a pipe, which always holds HERE_PIPE_MAX bytes, larger ones into a memfd rewound to
+ *      its start. Nothing touches the filesystem either way
+ * -----
+ * Input: plan - the plan to add the action to
+ *        fd - the file descriptor number in the child
+ *        data - the contents
+ *        len - the number of bytes
+ * Output: Returns -1 if the file could not be made (errno is set), otherwise 0
+ * ******************/
+
+int planHere(struct spawnPlan *plan, int fd, const char *data, size_t len)
+{
+    int fds[2];
+
+    if(plan->numActions == MAX_ACTIONS)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+
+    if(len <= HERE_PIPE_MAX)
+    {
+        if(pipe2(fds, O_CLOEXEC) == -1)
+            return -1;
+
+        // The pipe can hold it all, the reader sees the end of file once it is read
+        if(writeHere(fds[1], data, len) == -1)
+        {
+            int saved = errno;
+            close(fds[0]);
+            close(fds[1]);
+            errno = saved;
+            return -1;
+        }
+        close(fds[1]);
+    }
+    else
+    {
+        fds[0] = memfd_create("wish-here", MFD_CLOEXEC);
+        if(fds[0] == -1)
+            return -1;
+
+        if(writeHere(fds[0], data, len) == -1 || lseek(fds[0], 0, SEEK_SET) == -1)
+        {
+            int saved = errno;
+            close(fds[0]);
+            errno = saved;
+            return -1;
+        }
+    }
+
+    planAdd(plan, fd, fds[0], 1);
+    return 0;
+}
+
+
+/********************
+ * planDup
+ * Description: Records that a descriptor the shell already has (a pipe end, or the source of
+ *      a <& or >& duplication) should become file descriptor fd in the child. The plan does
+ *      not take ownership of srcFd
+ * -----
+ * Input: plan - the plan to add the action to
+ *        fd - the file descriptor number in the child
+ *        srcFd - the shell's descriptor, it should be close-on-exec
+ * Output: Returns -1 if the plan is full, otherwise 0
+ * ******************/
+
+int planDup(struct spawnPlan *plan, int fd, int srcFd)
+{
+    if(plan->numActions == MAX_ACTIONS)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+
+    planAdd(plan, fd, srcFd, 0);
+    return 0;
+}
+
+
+/********************
+ * planHas
+ * Description: Tells if the plan already redirects a file descriptor
+ * -----
+ * Input: plan - the plan to search
+ *        fd - the file descriptor number in the child
+ * Output: Returns 1 if fd is redirected, otherwise 0
+ * ******************/
+
+int planHas(struct spawnPlan *plan, int fd)
+{
+    int i;
+    for(i = 0; i < plan->numActions; i++)
+    {
+        if(plan->actions[i].fd == fd)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * planSource
+ * Description: Finds the shell's descriptor that would become fd in the child. Builtins use
+ *      it to honour their redirections without starting a child
+ * -----
+ * Input: plan - the plan to search
+ *        fd - the file descriptor number in the child
+ * Output: Returns the descriptor of the last action for fd, or -1 if fd is not redirected
+ * ******************/
+
+int planSource(struct spawnPlan *plan, int fd)
+{
+    int i;
+    for(i = plan->numActions - 1; i >= 0; i--)
+    {
+        if(plan->actions[i].fd == fd)
+            return plan->actions[i].srcFd;
+    }
+
+    return -1;
+}
+
+
+/********************
+ * planClose
+ * Description: Closes the parent copies of every file opened for the plan. Descriptors
+ *      added with planDup belong to the caller and stay open
+ * -----
+ * Input: plan - the plan whose file actions are no longer needed
+ * Output: NA - all file actions are closed and removed
+ * ******************/
+
+void planClose(struct spawnPlan *plan)
+{
+    int i;
+    for(i = 0; i < plan->numActions; i++)
+    {
+        if(plan->actions[i].owned)
+            close(plan->actions[i].srcFd);
+    }
+
+    plan->numActions = 0;
+}
+
+
+/********************
+ * spawnPosix
+ * Description: Launches the plan with posix_spawn. The shell ignores SIGINT and SIGTSTP
+ *      (it reads them from a signalfd), so children inherit that; foreground children get
+ *      SIGINT back to its default action so ctrl-c can interrupt them, and every child gets
+ *      SIGPIPE back
+ * -----
+ * Input: plan - the plan to launch
+ *        path - the program, as found by pathLookup
+ * Output: Returns the pid of the child, or -1 if it could not be started (errno is set)
+ * ******************/
+
+static pid_t spawnPosix(struct spawnPlan *plan, const char *path)
+{
+    int i, result;
+    pid_t pid = -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+
+    // Build the file actions that will run in the child
+    posix_spawn_file_actions_init(&actions);
+    for(i = 0; i < plan->numActions; i++)
+        posix_spawn_file_actions_adddup2(&actions, plan->actions[i].srcFd, plan->actions[i].fd);
+
+    // Foreground processes will be interupted by the sigint signal. SIGPIPE is ignored by the
+    // shell only, children must die when the reader of their pipe goes away
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    if(!plan->background)
+        sigaddset(&defaults, SIGINT);
+
+    // The child starts with the mask the shell had before blocking signals
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &CHILD_MASK);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    result = posix_spawn(&pid, path, &actions, &attr, plan->argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/********************
+ * spawnFork
+ * Description: Launches the plan with fork and execv. The file actions are applied
+ *      in the child, so the parent's stdin and stdout are never modified. The parent does
+ *      not learn about exec errors, so a remembered program that is gone is searched again
+ *      by execvp in the child. With waitExec set, the parent waits on a close-on-exec pipe
+ *      until the child has called exec (or exited), so the time to exec can be measured
+ * -----
+ * Input: plan - the plan to launch
+ *        path - the program, as found by pathLookup
+ * Output: Returns the pid of the child, or -1 if forking failed
+ * ******************/
+
+static pid_t spawnFork(struct spawnPlan *plan, const char *path)
+{
+    int i;
+    char byte;
+    int execPipe[2] = {-1, -1};
+    struct sigaction ignore_action, default_action;
+
+    if(plan->waitExec && pipe2(execPipe, O_CLOEXEC) == -1)
+        execPipe[0] = execPipe[1] = -1;
+
+    pid_t pid = fork();
+    if(pid != 0)
+    {
+        if(execPipe[0] != -1)
+        {
+            // The write end closes when the child execs or exits: read then returns 0
+            close(execPipe[1]);
+            while(read(execPipe[0], &byte, 1) == -1 && errno == EINTR)
+                ;
+            close(execPipe[0]);
+        }
+        return pid;
+    }
+
+    // Set the foreground and background processes to ignore the sigtstp signal
+    memset(&ignore_action, 0, sizeof(ignore_action));
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGTSTP, &ignore_action, NULL);
+
+    // Background processes will ignore the sigint signal. Otherwise, foreground
+    // processes will be interupted by the sigint signal
+    memset(&default_action, 0, sizeof(default_action));
+    default_action.sa_handler = SIG_DFL;
+    if(plan->background)
+        sigaction(SIGINT, &ignore_action, NULL);
+    else
+        sigaction(SIGINT, &default_action, NULL);
+    sigaction(SIGPIPE, &default_action, NULL);
+
+    // Unblock the signals the shell reads from its signalfd
+    sigprocmask(SIG_SETMASK, &CHILD_MASK, NULL);
+
+    // Apply the redirections of the plan
+    for(i = 0; i < plan->numActions; i++)
+    {
+        if(dup2(plan->actions[i].srcFd, plan->actions[i].fd) == -1)
+        {
+            perror("dup2");
+            _exit(1);
+        }
+    }
+
+    execv(path, plan->argv);
+    if(errno == ENOENT && path != plan->argv[0])
+        execvp(plan->argv[0], plan->argv);
+
+    // There was an error in execusion: Display error message and exit dramatically.
+    printf("%s: no such file or directory\n", plan->argv[0]);
+    fflush(stdout);
+    _exit(1);
+}
+
+
+/********************
+ * spawnCommand
+ * Description: Launches the plan with the currently selected spawn engine. The program is
+ *      found through the command hash table (see pathcache.c), so a command that does not
+ *      exist is reported without starting a child at all
+ * -----
+ * Input: plan - the plan to launch
+ * Output: Returns the pid of the child, or -1 if it could not be started (errno is set)
+ * ******************/
+
+pid_t spawnCommand(struct spawnPlan *plan)
+{
+    pid_t pid;
+    int retried = 0;
+    long long start = 0;
+
+    // A traced fork records when the exec happened, so the fork engine waits for it
+    if(TRACING)
+    {
+        plan->waitExec = 1;
+        start = clockNow();
+    }
+
+    while(1)
+    {
+        const char *path = pathLookup(plan->argv[0]);
+        if(path == 0)
+        {
+            TRACE(TRACE_EXEC, 0, -1, ENOENT, plan->argv[0]);
+            errno = ENOENT;
+            return -1;
+        }
+
+        int mode = SPAWN_MODE;
+        if(mode == SPAWN_FORK)
+            pid = spawnFork(plan, path);
+        else if(mode == SPAWN_SERVER)
+            pid = spawnServer(plan, path);
+        else
+            pid = spawnPosix(plan, path);
+
+        // The spawn server stopped answering and was dropped: use posix_spawn instead
+        if(pid == -1 && mode != SPAWN_MODE)
+            continue;
+
+        // A remembered program that was removed or moved: forget it and search PATH once more
+        if(pid == -1 && errno == ENOENT && path != plan->argv[0] && !retried)
+        {
+            pathForget(plan->argv[0]);
+            retried = 1;
+            continue;
+        }
+
+        if(pid == -1)
+            TRACE(TRACE_EXEC, 0, -1, errno, plan->argv[0]);
+        else
+        {
+            TRACE(TRACE_FORK, start, pid, SPAWN_MODE, plan->argv[0]);
+            TRACE(TRACE_EXEC, 0, pid, 0, path);
+        }
+
+        return pid;
+    }
+}
@@ -0,0 +1,589 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The spawn server engine (WISH_SPAWN=server). A helper process is forked when
+ *      the shell starts, while it is still tiny, and launches every command on the shell's
+ *      behalf: the shell sends the program, argv, the environment and the redirection
+ *      descriptors (SCM_RIGHTS) over a socketpair, and the helper replies with the pid, or
+ *      the errno of a failed exec. The cost of copying the page tables therefore depends on
+ *      the helper's size, not on the size the shell has grown to.
+ *      The helper starts each command with clone(CLONE_PARENT), which makes the command a
+ *      child of the shell itself: the shell waits for it, watches it with a pidfd and gets
+ *      its exit status from the kernel exactly as with the other engines
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+
+#include "wish.h"
+
+extern char **environ;
+
+// A command sent to the helper. The descriptors travel as SCM_RIGHTS with the request and
+// are followed by dataLen bytes: the working directory when the shell changed it since the
+// last request, the program path, the arguments and the environment, each NUL terminated
+struct spawnRequest
+{
+    int argc;
+    int envc;
+    int background;
+    int moved;                   // the data starts with the shell's new working directory
+    int numFds;
+    int targets[MAX_ACTIONS];    // the descriptor number each received descriptor becomes
+    size_t dataLen;
+};
+
+// The answer of the helper: the pid of the command, or the errno of its exec
+struct spawnReply
+{
+    pid_t pid;
+    int error;
+};
+
+// The most descriptors the helper looks at when it starts, see closeShellFds
+#define MAX_HELPER_FDS 1024
+
+// The shell's end of the socketpair, and the helper
+static int serverFd = -1;
+static pid_t serverPid = -1;
+
+// Set by cd: the helper is still in the directory the shell left
+static int serverMoved = 0;
+
+
+/********************
+ * readAll
+ * Description: Reads exactly len bytes from a descriptor
+ * -----
+ * Input: fd - the descriptor
+ *        data - where the bytes go
+ *        len - the number of bytes
+ * Output: Returns -1 on an error or at end of file, otherwise 0
+ * ******************/
+
+static int readAll(int fd, void *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t numRead = read(fd, data, len);
+        if(numRead == -1 && errno == EINTR)
+            continue;
+        if(numRead <= 0)
+            return -1;
+
+        data = (char *)data + numRead;
+        len -= numRead;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * writeAll
+ * Description: Writes exactly len bytes to a socket
+ * -----
+ * Input: fd - the socket
+ *        data - the bytes
+ *        len - the number of bytes
+ * Output: Returns -1 on an error, otherwise 0
+ * ******************/
+
+static int writeAll(int fd, const void *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written = send(fd, data, len, MSG_NOSIGNAL);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            return -1;
+
+        data = (const char *)data + written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * launchRequest
+ * Description: Starts one command in the helper. The command is cloned with CLONE_PARENT so
+ *      that it is a child of the shell. A close-on-exec pipe tells the helper whether the
+ *      exec worked: it is closed by a successful exec, or receives the errno
+ * -----
+ * Input: request - the command
+ *        fds - the received descriptors
+ *        data - the program path, arguments and environment
+ * Output: Returns the reply for the shell
+ * ******************/
+
+static struct spawnReply launchRequest(struct spawnRequest *request, int *fds, char *data)
+{
+    struct spawnReply reply = {-1, 0};
+    int i, errPipe[2];
+    char **argv = malloc(sizeof(char *) * (request->argc + request->envc + 2));
+
+    if(argv == 0)
+    {
+        reply.error = ENOMEM;
+        return reply;
+    }
+
+    // Point into the data: the path, then argc arguments, then envc variables
+    char *path = data;
+    char *next = data + strlen(data) + 1;
+    for(i = 0; i < request->argc + request->envc; i++)
+    {
+        argv[i + (i >= request->argc)] = next;
+        next += strlen(next) + 1;
+    }
+    argv[request->argc] = 0;
+    char **envp = argv + request->argc + 1;
+    envp[request->envc] = 0;
+
+    if(pipe2(errPipe, O_CLOEXEC) == -1)
+    {
+        reply.error = errno;
+        free(argv);
+        return reply;
+    }
+
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    if(pid == 0)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+
+        // Same signal dispositions as the other engines (see spawn.c)
+        action.sa_handler = SIG_IGN;
+        sigaction(SIGTSTP, &action, NULL);
+        if(request->background)
+            sigaction(SIGINT, &action, NULL);
+        action.sa_handler = SIG_DFL;
+        if(!request->background)
+            sigaction(SIGINT, &action, NULL);
+        sigaction(SIGPIPE, &action, NULL);
+
+        // A received descriptor numbered like a target could be replaced before its own dup2
+        int maxTarget = -1;
+        for(i = 0; i < request->numFds; i++)
+        {
+            if(request->targets[i] > maxTarget)
+                maxTarget = request->targets[i];
+        }
+        for(i = 0; i < request->numFds; i++)
+        {
+            int moved;
+            if(fds[i] <= maxTarget && (moved = fcntl(fds[i], F_DUPFD_CLOEXEC, maxTarget + 1)) != -1)
+                fds[i] = moved;
+        }
+
+        for(i = 0; i < request->numFds; i++)
+        {
+            if(dup2(fds[i], request->targets[i]) == -1)
+                break;
+        }
+
+        if(i == request->numFds)
+            execve(path, argv, envp);
+
+        int error = errno;
+        write(errPipe[1], &error, sizeof(error));
+        _exit(127);
+    }
+
+    close(errPipe[1]);
+    if(pid == -1)
+        reply.error = errno;
+    else
+    {
+        reply.pid = pid;
+        if(readAll(errPipe[0], &reply.error, sizeof(reply.error)) == -1)
+            reply.error = 0;
+    }
+
+    close(errPipe[0]);
+    free(argv);
+    return reply;
+}
+
+
+/********************
+ * serveRequests
+ * Description: The main loop of the helper: receives commands until the shell goes away
+ * -----
+ * Input: fd - the helper's end of the socketpair
+ * Output: NA - does not return
+ * ******************/
+
+static void serveRequests(int fd)
+{
+    struct spawnRequest request;
+    struct spawnReply reply;
+    char control[CMSG_SPACE(sizeof(int) * MAX_ACTIONS)];
+    int fds[MAX_ACTIONS];
+    char *data = 0;
+    size_t dataCap = 0;
+    int i;
+
+    while(1)
+    {
+        struct iovec iov = {&request, sizeof(request)};
+        struct msghdr message;
+
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        // The descriptors arrive with the first byte of the request
+        ssize_t received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+        if(received == -1 && errno == EINTR)
+            continue;
+        if(received <= 0)
+            _exit(0);
+
+        int numFds = 0;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        if(cmsg != 0 && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * numFds);
+        }
+
+        if((size_t)received < sizeof(request) &&
+            readAll(fd, (char *)&request + received, sizeof(request) - received) == -1)
+            _exit(0);
+
+        if(request.dataLen + 1 > dataCap)
+        {
+            dataCap = request.dataLen + 1;
+            data = realloc(data, dataCap);
+            if(data == 0)
+                _exit(1);
+        }
+        if(readAll(fd, data, request.dataLen) == -1)
+            _exit(0);
+        data[request.dataLen] = '\0';
+
+        // The helper follows the shell, the commands it clones start where the shell is
+        char *command = data;
+        if(request.moved)
+            command += strlen(data) + 1;
+
+        if(numFds != request.numFds)
+        {
+            reply.pid = -1;
+            reply.error = EBADF;
+        }
+        else if(request.moved && chdir(data) == -1)
+        {
+            reply.pid = -1;
+            reply.error = errno;
+        }
+        else
+            reply = launchRequest(&request, fds, command);
+
+        for(i = 0; i < numFds; i++)
+            close(fds[i]);
+
+        if(writeAll(fd, &reply, sizeof(reply)) == -1)
+            _exit(0);
+    }
+}
+
+
+/********************
+ * closeShellFds
+ * Description: Closes the close-on-exec descriptors the helper got from the shell: pipes of
+ *      running pipelines would never see their end of file while the helper holds them
+ * -----
+ * Input: keep - the helper's end of the socketpair
+ * Output: NA
+ * ******************/
+
+static void closeShellFds(int keep)
+{
+    int fd, numFds = 0, flags;
+    int found[MAX_HELPER_FDS];
+    struct dirent *entry;
+
+    DIR *dir = opendir("/proc/self/fd");
+    if(dir == 0)
+    {
+        // Without /proc only stdin, stdout and stderr are kept
+        if(keep > 3)
+            close_range(3, keep - 1, 0);
+        close_range(keep + 1, ~0U, 0);
+        return;
+    }
+
+    // The directory's own descriptor is listed too, it is closed first
+    while((entry = readdir(dir)) != 0 && numFds < MAX_HELPER_FDS)
+    {
+        fd = atoi(entry->d_name);
+        if(fd > 2 && fd != keep && fd != dirfd(dir))
+            found[numFds++] = fd;
+    }
+    closedir(dir);
+
+    while(numFds-- > 0)
+    {
+        fd = found[numFds];
+        if((flags = fcntl(fd, F_GETFD)) != -1 && (flags & FD_CLOEXEC))
+            close(fd);
+    }
+}
+
+
+/********************
+ * startSpawnServer
+ * Description: Forks the helper. It must be called early, while the shell is small, and after
+ *      CHILD_MASK is recorded: the helper keeps that mask and so do the commands it starts
+ * -----
+ * Input: NA
+ * Output: Returns -1 if the helper could not be started (a message is displayed), otherwise 0
+ * ******************/
+
+int startSpawnServer()
+{
+    int fds[2];
+    struct sigaction ignore_action;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        perror("Error starting the spawn server");
+        return -1;
+    }
+
+    serverPid = fork();
+    if(serverPid == -1)
+    {
+        perror("Error starting the spawn server");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if(serverPid == 0)
+    {
+        // The helper ignores the terminal's signals and dies with the shell
+        memset(&ignore_action, 0, sizeof(ignore_action));
+        ignore_action.sa_handler = SIG_IGN;
+        sigaction(SIGINT, &ignore_action, NULL);
+        sigaction(SIGTSTP, &ignore_action, NULL);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        // Keep its end of the socketpair and the descriptors commands inherit: stdin, stdout,
+        // stderr and those redirected with exec. The shell's own ones are close-on-exec
+        closeShellFds(fds[1]);
+
+        serveRequests(fds[1]);
+    }
+
+    close(fds[1]);
+    serverMoved = 0;
+
+    // Like the event loop's descriptors, kept clear of the numbers exec may redirect
+    serverFd = fcntl(fds[0], F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+    if(serverFd == -1)
+        serverFd = fds[0];
+    else
+        close(fds[0]);
+
+    return 0;
+}
+
+
+/********************
+ * stopSpawnServer
+ * Description: Forgets a helper that stopped answering. The shell goes on with posix_spawn
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+static void stopSpawnServer()
+{
+    fprintf(stderr, "wish: the spawn server stopped, using posix_spawn\n");
+
+    close(serverFd);
+    serverFd = -1;
+    kill(serverPid, SIGKILL);
+    waitpid(serverPid, NULL, 0);
+    SPAWN_MODE = SPAWN_POSIX;
+}
+
+
+/********************
+ * restartSpawnServer
+ * Description: Replaces the helper with a new one that has the shell's descriptors as they
+ *      are now. Commands inherit their descriptors from the helper, so exec calls it once it
+ *      has redirected the shell
+ * -----
+ * Input: NA
+ * Output: NA - SPAWN_MODE becomes SPAWN_POSIX if the new helper could not be started
+ * ******************/
+
+void restartSpawnServer()
+{
+    if(serverFd == -1)
+        return;
+
+    close(serverFd);
+    serverFd = -1;
+    kill(serverPid, SIGKILL);
+    waitpid(serverPid, NULL, 0);
+
+    if(startSpawnServer() == -1)
+        SPAWN_MODE = SPAWN_POSIX;
+}
+
+
+/********************
+ * spawnServerMoved
+ * Description: Called by cd once the shell changed directory, the next request carries the
+ *      new working directory to the helper
+ * -----
+ * Input: NA
+ * Output: NA
+ * ******************/
+
+void spawnServerMoved()
+{
+    serverMoved = 1;
+}
+
+
+/********************
+ * spawnServer
+ * Description: Launches the plan through the helper
+ * -----
+ * Input: plan - the plan to launch
+ *        path - the program, as found by pathLookup
+ * Output: Returns the pid of the child, or -1 if it could not be started (errno is set)
+ * ******************/
+
+pid_t spawnServer(struct spawnPlan *plan, const char *path)
+{
+    struct spawnRequest request;
+    struct spawnReply reply;
+    char control[CMSG_SPACE(sizeof(int) * MAX_ACTIONS)];
+    char cwd[PATH_MAX];
+    int i, envc = 0;
+    size_t len, cwdLen = 0;
+
+    memset(&request, 0, sizeof(request));
+    memset(control, 0, sizeof(control));
+
+    // Measure the working directory, path, arguments and environment
+    if(serverMoved && getcwd(cwd, sizeof(cwd)) != 0)
+    {
+        request.moved = 1;
+        cwdLen = strlen(cwd) + 1;
+    }
+    request.dataLen = cwdLen + strlen(path) + 1;
+    for(i = 0; plan->argv[i] != 0; i++)
+        request.dataLen += strlen(plan->argv[i]) + 1;
+    request.argc = i;
+    for(envc = 0; environ[envc] != 0; envc++)
+        request.dataLen += strlen(environ[envc]) + 1;
+    request.envc = envc;
+
+    request.background = plan->background;
+    request.numFds = plan->numActions;
+    for(i = 0; i < plan->numActions; i++)
+        request.targets[i] = plan->actions[i].fd;
+
+    char *data = malloc(request.dataLen);
+    if(data == 0)
+        return -1;
+
+    memcpy(data, cwd, cwdLen);
+    len = strlen(path) + 1;
+    memcpy(data + cwdLen, path, len);
+    len += cwdLen;
+    for(i = 0; plan->argv[i] != 0; i++)
+    {
+        size_t wordLen = strlen(plan->argv[i]) + 1;
+        memcpy(data + len, plan->argv[i], wordLen);
+        len += wordLen;
+    }
+    for(i = 0; i < envc; i++)
+    {
+        size_t varLen = strlen(environ[i]) + 1;
+        memcpy(data + len, environ[i], varLen);
+        len += varLen;
+    }
+
+    // The request and its descriptors in one message, then the strings
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if(plan->numActions > 0)
+    {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * plan->numActions);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * plan->numActions);
+        for(i = 0; i < plan->numActions; i++)
+            memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &plan->actions[i].srcFd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do
+        sent = sendmsg(serverFd, &message, MSG_NOSIGNAL);
+    while(sent == -1 && errno == EINTR);
+
+    int failed = sent <= 0 || writeAll(serverFd, (char *)&request + sent, sizeof(request) - sent) == -1 ||
+        writeAll(serverFd, data, request.dataLen) == -1 || readAll(serverFd, &reply, sizeof(reply)) == -1;
+    free(data);
+
+    // spawnCommand sees SPAWN_MODE change and starts the command again with posix_spawn
+    if(failed)
+    {
+        stopSpawnServer();
+        errno = EAGAIN;
+        return -1;
+    }
+    if(request.moved)
+        serverMoved = 0;
+
+    // A command whose exec failed is the shell's child too: reap it
+    if(reply.error != 0)
+    {
+        if(reply.pid > 0)
+            waitpid(reply.pid, NULL, 0);
+        errno = reply.error;
+        return -1;
+    }
+
+    return reply.pid;
+}
@@ -0,0 +1,266 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Command substitution. $(commands) is replaced by the output of the commands,
+ *      without its trailing newlines, and $? becomes their status. A single utility builtin
+ *      (echo, printf, pwd, test...) with no operators and no redirections runs inside the
+ *      shell and its output is collected in memory, so $(echo ...) costs no process at all.
+ *      Anything else runs in a forked copy of the shell, which reads the commands like a
+ *      script and writes into a pipe; the shell reads the pipe into the line arena. The
+ *      output stays one word, like $NAME: there is no field splitting
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "wish.h"
+
+// The first read from the pipe of a forked substitution, it grows from there
+#define CAPTURE_INITIAL 1024
+
+
+/********************
+ * simpleBuiltin
+ * Description: Finds the utility builtin of a substitution that can run inside the shell
+ * -----
+ * Input: words - the words of the substitution, with their quotes
+ *        numWords - the number of words
+ * Output: Returns the index of the builtin, or -1 if the commands need a copy of the shell
+ * ******************/
+
+static int simpleBuiltin(char **words, int numWords)
+{
+    int i;
+
+    if(numWords == 0 || !wordIsLiteral(words[0]))
+        return -1;
+
+    // Operators and redirections are separate words, a quoted one is not an operator
+    for(i = 0; i < numWords; i++)
+    {
+        if(listOperator(words[i]) || strcmp(words[i], "|") == 0 || redirectOperator(words[i]) != 0)
+            return -1;
+    }
+
+    int index = findBuiltin(words[0]);
+    if(index == -1 || !builtinIsUtility(index))
+        return -1;
+
+    return index;
+}
+
+
+/********************
+ * captureBuiltin
+ * Description: Runs a utility builtin inside the shell and collects its output in memory
+ * -----
+ * Input: arena - the arena of the command line
+ *        words - the words of the command, expanded here
+ *        numWords - the number of words
+ *        index - the builtin
+ *        outLen - set to the length of the output
+ * Output: Returns the output, allocated from the arena
+ * ******************/
+
+static char *captureBuiltin(struct arena *arena, char **words, int numWords, int index, size_t *outLen)
+{
+    struct builtinCall call;
+    struct output output;
+    int result;
+
+    outInit(&output, -1);
+
+    call.arena = arena;
+    call.argList = words;
+    call.numArgs = expandWords(arena, words, numWords);
+    call.in = 0;
+    call.out = &output;
+    call.inPipeline = 1;
+    call.plan = 0;
+
+    result = runBuiltin(index, &call);
+    STATUS = W_EXITCODE(result & 0xff, 0);
+
+    char *text = arenaStrndup(arena, output.data ? output.data : "", output.len);
+    *outLen = output.len;
+    outRelease(&output);
+
+    return text;
+}
+
+
+/********************
+ * runSubshell
+ * Description: The forked copy of the shell: runs the commands of a substitution with its
+ *      output going to the pipe, then exits with their status
+ * -----
+ * Input: text - the commands
+ *        len - the length of the commands
+ *        fd - the write end of the pipe
+ * Output: NA - does not return
+ * ******************/
+
+static void runSubshell(const char *text, size_t len, int fd)
+{
+    struct arena arena;
+    struct commandList list;
+    int parsed;
+
+    dup2(fd, 1);
+    close(fd);
+
+    // The commands are read like a script, the memory stays valid until the copy exits
+    char *commands = malloc(len + 1);
+    if(commands == 0)
+        _exit(1);
+    memcpy(commands, text, len);
+    commands[len] = '\n';
+    inputOpenBuffer(commands, len + 1);
+
+    // Refer to utility.c, exit in the commands leaves only this copy
+    if(enterSubshell() == -1)
+        _exit(1);
+
+    arenaInit(&arena);
+    while((parsed = parseNextLine(&arena, &list)) != PARSE_EOF)
+    {
+        if(parsed == PARSE_ERROR)
+            STATUS = W_EXITCODE(2, 0);
+        else if(parsed == PARSE_OK)
+            runList(&arena, &list);
+
+        cleanBuffer(&arena);
+    }
+
+    fflush(stdout);
+    _exit(WIFSIGNALED(STATUS) ? 128 + WTERMSIG(STATUS) : WEXITSTATUS(STATUS));
+}
+
+
+/********************
+ * captureSubshell
+ * Description: Runs the commands of a substitution in a forked copy of the shell and reads
+ *      their output from a pipe
+ * -----
+ * Input: arena - the arena of the command line
+ *        text - the commands
+ *        len - the length of the commands
+ *        outLen - set to the length of the output
+ * Output: Returns the output, allocated from the arena
+ * ******************/
+
+static char *captureSubshell(struct arena *arena, const char *text, size_t len, size_t *outLen)
+{
+    int fds[2];
+    int status;
+    size_t used = 0, cap = CAPTURE_INITIAL;
+    char *data;
+    pid_t pid;
+
+    *outLen = 0;
+
+    if(pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("Error creating pipe");
+        STATUS = W_EXITCODE(1, 0);
+        return "";
+    }
+
+    // Output buffered by the shell must not be written twice
+    fflush(stdout);
+
+    pid = fork();
+    if(pid == 0)
+    {
+        close(fds[0]);
+        runSubshell(text, len, fds[1]);
+    }
+    close(fds[1]);
+
+    if(pid == -1)
+    {
+        perror("Error forking");
+        close(fds[0]);
+        STATUS = W_EXITCODE(1, 0);
+        return "";
+    }
+
+    TRACE(TRACE_FORK, 0, pid, -2, "command substitution");
+
+    // Read until every writer is gone, the buffer doubles in the arena as it fills
+    data = arenaAlloc(arena, cap);
+    while(1)
+    {
+        if(used + 1 == cap)
+        {
+            data = arenaRealloc(arena, data, used, cap * 2);
+            cap *= 2;
+        }
+
+        ssize_t got = read(fds[0], data + used, cap - used - 1);
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            break;
+        used += got;
+    }
+    close(fds[0]);
+    data[used] = '\0';
+
+    while(waitpid(pid, &status, 0) == -1)
+    {
+        if(errno != EINTR)
+        {
+            status = W_EXITCODE(1, 0);
+            break;
+        }
+    }
+
+    TRACE(TRACE_EXIT, 0, pid, status, "command substitution");
+    STATUS = status;
+
+    *outLen = used;
+    return data;
+}
+
+
+/********************
+ * substitute
+ * Description: Runs the commands of a $( ) and gives their output, with the trailing newlines
+ *      removed. STATUS is set to their status
+ * -----
+ * Input: arena - the arena of the command line
+ *        text - the commands, between the parentheses
+ *        len - the length of the commands
+ *        outLen - set to the length of the output
+ * Output: Returns the output, allocated from the arena
+ * ******************/
+
+char *substitute(struct arena *arena, const char *text, size_t len, size_t *outLen)
+{
+    char **words;
+    int numWords, index;
+    char *output;
+
+    // One line of words may be a builtin that needs no copy of the shell
+    words = lexString(arena, (char *)text, len, &numWords);
+    if(words != 0 && (index = simpleBuiltin(words, numWords)) != -1)
+        output = captureBuiltin(arena, words, numWords, index, outLen);
+    else
+        output = captureSubshell(arena, text, len, outLen);
+
+    while(*outLen > 0 && output[*outLen - 1] == '\n')
+        (*outLen)--;
+
+    return output;
+}
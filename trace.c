@@ -0,0 +1,245 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: The trace log of the shell. When the WISH_TRACE environment variable is set,
+ *      the shell records an event for every fork, exec, redirection, child exit and signal,
+ *      with a CLOCK_MONOTONIC timestamp and the pid involved. Events go either to a JSONL
+ *      file (one JSON object per line, written with a single append each) or to a ring
+ *      buffer in POSIX shared memory that the wishtrace tool reads while the shell runs:
+ *
+ *          WISH_TRACE=shm          ring named /wish-trace.<pid of the shell>
+ *          WISH_TRACE=shm:NAME     ring named /NAME
+ *          WISH_TRACE=path.jsonl   JSONL file, appended to
+ *
+ *      The ring takes no lock: a writer claims a record by incrementing the head, marks it
+ *      busy, fills it, then publishes it by storing its sequence number. A reader that sees
+ *      the same sequence number before and after copying a record got a consistent copy.
+ *      This file only uses the C library, so wishtrace links it as well
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "wish.h"
+
+// Records in a ring, unless WISH_TRACE_SIZE asks for another number (rounded up to a power of two)
+#define TRACE_RING_DEFAULT 16384
+
+// Set when tracing is on, checked by the TRACE macro before any call is made
+int TRACING = 0;
+
+// The sinks: the mapped ring, or the JSONL file
+static struct traceRing *ring = 0;
+static int jsonFd = -1;
+
+// Names of the event types, in the order of the TRACE_ values
+static const char *EVENT_NAMES[] = {"fork", "exec", "redirect", "exit", "signal"};
+
+
+/********************
+ * traceRingSize
+ * Description: Gives the size of the shared memory of a ring
+ * -----
+ * Input: capacity - the number of records
+ * Output: Returns the size in bytes
+ * ******************/
+
+size_t traceRingSize(unsigned capacity)
+{
+    return sizeof(struct traceRing) + (size_t)capacity * sizeof(struct traceRecord);
+}
+
+
+/********************
+ * openRing
+ * Description: Creates the shared memory ring, replacing any ring of the same name
+ * -----
+ * Input: name - the shared memory name, starting with /
+ * Output: Returns -1 if the ring could not be created (a message is displayed), otherwise 0
+ * ******************/
+
+static int openRing(const char *name)
+{
+    unsigned capacity = TRACE_RING_DEFAULT;
+    char *size = getenv("WISH_TRACE_SIZE");
+
+    if(size != 0 && atoi(size) > 0)
+    {
+        capacity = 1;
+        while(capacity < (unsigned)atoi(size) && capacity < (1u << 24))
+            capacity *= 2;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1 || ftruncate(fd, traceRingSize(capacity)) == -1)
+    {
+        perror("wish: trace ring");
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    ring = mmap(NULL, traceRingSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+    {
+        perror("wish: trace ring");
+        ring = 0;
+        return -1;
+    }
+
+    // The pages are zero: every record has sequence 0, which no published record uses
+    ring->magic = TRACE_MAGIC;
+    ring->version = TRACE_VERSION;
+    ring->capacity = capacity;
+    ring->recordSize = sizeof(struct traceRecord);
+    ring->writerPid = getpid();
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+/********************
+ * initTrace
+ * Description: Opens the trace sink named by the WISH_TRACE environment variable, if set
+ * -----
+ * Input: NA
+ * Output: NA - TRACING is set if events will be recorded
+ * ******************/
+
+void initTrace()
+{
+    char name[256];
+    char *sink = getenv("WISH_TRACE");
+
+    if(sink == 0 || *sink == '\0')
+        return;
+
+    if(strcmp(sink, "shm") == 0 || strncmp(sink, "shm:", 4) == 0)
+    {
+        if(sink[3] == ':')
+            snprintf(name, sizeof(name), "/%s", sink + 4);
+        else
+            snprintf(name, sizeof(name), "/wish-trace.%d", (int)getpid());
+
+        if(openRing(name) == -1)
+            return;
+    }
+    else
+    {
+        jsonFd = open(sink, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(jsonFd == -1)
+        {
+            perror(sink);
+            return;
+        }
+    }
+
+    TRACING = 1;
+}
+
+
+/********************
+ * traceFormat
+ * Description: Writes an event as one line of JSON
+ * -----
+ * Input: record - the event
+ *        buffer - where the line is written
+ *        size - the size of the buffer, at least 64 + 6 * TRACE_DETAIL bytes
+ * Output: Returns the length of the line, newline included
+ * ******************/
+
+int traceFormat(struct traceRecord *record, char *buffer, size_t size)
+{
+    const char *name = record->type >= 0 && record->type <= TRACE_SIGNAL ? EVENT_NAMES[record->type] : "unknown";
+    int len, i;
+
+    len = snprintf(buffer, size, "{\"ts_ns\":%lld,\"event\":\"%s\",\"pid\":%d,\"value\":%d,\"detail\":\"",
+        (long long)record->time, name, (int)record->pid, (int)record->value);
+
+    // The detail is a command name or a file name: escape it for JSON
+    for(i = 0; i < TRACE_DETAIL && record->detail[i] != '\0' && (size_t)len < size - 16; i++)
+    {
+        unsigned char c = record->detail[i];
+
+        if(c == '"' || c == '\\')
+        {
+            buffer[len++] = '\\';
+            buffer[len++] = c;
+        }
+        else if(c < 0x20)
+            len += snprintf(buffer + len, size - len, "\\u%04x", c);
+        else
+            buffer[len++] = c;
+    }
+
+    len += snprintf(buffer + len, size - len, "\"}\n");
+    return len;
+}
+
+
+/********************
+ * traceEvent
+ * Description: Records an event. Called through the TRACE macro, so only when TRACING is set
+ * -----
+ * Input: type - one of the TRACE_ event types
+ *        time - CLOCK_MONOTONIC nanoseconds of the event, 0 for now
+ *        pid - the process concerned, 0 for the shell itself
+ *        value - depends on the type: a status, a descriptor, a signal number, an errno
+ *        detail - a command or file name, may be NULL. Truncated to TRACE_DETAIL - 1 bytes
+ * Output: NA
+ * ******************/
+
+void traceEvent(int type, long long time, pid_t pid, int value, const char *detail)
+{
+    struct traceRecord local;
+    struct traceRecord *record = &local;
+    uint64_t seq = 0;
+
+    if(time == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        time = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+
+    // Claim the next record of the ring and mark it busy while it is written
+    if(ring != 0)
+    {
+        seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) + 1;
+        record = &ring->records[(seq - 1) & (ring->capacity - 1)];
+        __atomic_store_n(&record->seq, TRACE_BUSY, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    record->time = time;
+    record->type = type;
+    record->pid = pid;
+    record->value = value;
+    if(detail == 0)
+        detail = "";
+    strncpy(record->detail, detail, TRACE_DETAIL - 1);
+    record->detail[TRACE_DETAIL - 1] = '\0';
+
+    // Publish the record: a reader that sees seq knows every field above is written
+    if(ring != 0)
+    {
+        __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+        return;
+    }
+
+    char line[64 + 6 * TRACE_DETAIL];
+    int len = traceFormat(record, line, sizeof(line));
+    write(jsonFd, line, len);
+}
@@ -0,0 +1,164 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Resource usage of the commands run by the shell. A measured command records
+ *      its wall time (CLOCK_MONOTONIC), the CPU time, peak RSS and context switches of its
+ *      processes (collected by wait4 in events.c) plus the shell's own share, and how long
+ *      each process took from the spawn call to its exec. The `time` prefix prints the
+ *      usage of a pipeline, and `status` prints the usage of the last measured command
+ * ********************/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "wish.h"
+
+// The usage of the last foreground command that was measured (valid is 0 if it was not)
+struct usage LAST_USAGE;
+
+
+/********************
+ * clockNow
+ * Description: Reads the monotonic clock
+ * -----
+ * Input: NA
+ * Output: Returns the time in nanoseconds
+ * ******************/
+
+long long clockNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/********************
+ * timevalMicro
+ * Description: Converts a CPU time to microseconds
+ * -----
+ * Input: time - the time from a struct rusage
+ * Output: Returns the time in microseconds
+ * ******************/
+
+static long long timevalMicro(struct timeval time)
+{
+    return (long long)time.tv_sec * 1000000LL + time.tv_usec;
+}
+
+
+/********************
+ * usageStart
+ * Description: Starts measuring a command
+ * -----
+ * Input: usage - the usage to fill in
+ * Output: NA
+ * ******************/
+
+void usageStart(struct usage *usage)
+{
+    memset(usage, 0, sizeof(*usage));
+    getrusage(RUSAGE_SELF, &usage->shellStart);
+    usage->start = clockNow();
+}
+
+
+/********************
+ * usageSpawned
+ * Description: Records the time one process took from the spawn call until its exec
+ * -----
+ * Input: usage - the usage of the command
+ *        nanos - the time taken
+ * Output: NA
+ * ******************/
+
+void usageSpawned(struct usage *usage, long long nanos)
+{
+    usage->spawnTotal += nanos;
+    if(nanos > usage->spawnMax)
+        usage->spawnMax = nanos;
+    usage->numSpawned++;
+}
+
+
+/********************
+ * usageAdd
+ * Description: Adds the usage of one reaped process to a total. The peak RSS is the largest
+ *      of the processes, every other field is summed
+ * -----
+ * Input: total - the total, zeroed before the first process
+ *        add - the usage reported by wait4
+ * Output: NA
+ * ******************/
+
+void usageAdd(struct rusage *total, struct rusage *add)
+{
+    timeradd(&total->ru_utime, &add->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &add->ru_stime, &total->ru_stime);
+    if(add->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = add->ru_maxrss;
+    total->ru_nvcsw += add->ru_nvcsw;
+    total->ru_nivcsw += add->ru_nivcsw;
+}
+
+
+/********************
+ * usageFinish
+ * Description: Stops measuring a command. The shell's own CPU time and context switches
+ *      since usageStart (builtins, spawning) are added to those of the processes
+ * -----
+ * Input: usage - the usage of the command
+ *        children - the total usage of the processes of the command
+ * Output: NA
+ * ******************/
+
+void usageFinish(struct usage *usage, struct rusage *children)
+{
+    struct rusage shell;
+
+    usage->wall = clockNow() - usage->start;
+    getrusage(RUSAGE_SELF, &shell);
+
+    usage->user = timevalMicro(children->ru_utime) +
+        timevalMicro(shell.ru_utime) - timevalMicro(usage->shellStart.ru_utime);
+    usage->sys = timevalMicro(children->ru_stime) +
+        timevalMicro(shell.ru_stime) - timevalMicro(usage->shellStart.ru_stime);
+    usage->volSwitches = children->ru_nvcsw + shell.ru_nvcsw - usage->shellStart.ru_nvcsw;
+    usage->involSwitches = children->ru_nivcsw + shell.ru_nivcsw - usage->shellStart.ru_nivcsw;
+
+    // A command without processes ran inside the shell: its peak is the shell's
+    usage->maxRss = usage->numSpawned > 0 ? children->ru_maxrss : shell.ru_maxrss;
+    usage->valid = 1;
+}
+
+
+/********************
+ * usagePrint
+ * Description: Displays the usage of a command, one measure per line
+ * -----
+ * Input: out - where to write
+ *        usage - the usage of the command
+ * Output: NA
+ * ******************/
+
+void usagePrint(struct output *out, struct usage *usage)
+{
+    outPrintf(out, "real\t%.3f ms\n", usage->wall / 1e6);
+    outPrintf(out, "user\t%.3f ms\n", usage->user / 1e3);
+    outPrintf(out, "sys\t%.3f ms\n", usage->sys / 1e3);
+    outPrintf(out, "maxrss\t%ld KB\n", usage->maxRss);
+    outPrintf(out, "csw\t%ld voluntary, %ld involuntary\n", usage->volSwitches, usage->involSwitches);
+
+    if(usage->numSpawned > 0)
+        outPrintf(out, "spawn\t%.3f ms avg, %.3f ms max (%d process%s)\n",
+            usage->spawnTotal / 1e6 / usage->numSpawned, usage->spawnMax / 1e6,
+            usage->numSpawned, usage->numSpawned == 1 ? "" : "es");
+}
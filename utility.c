@@ -5,7 +5,7 @@
  * Date: May 27th 2018
  *
  * Description: The various utility functions used throughout the wish program
- *      Includes redirection functions, the built in cd function, and the $$ expansion function
+ *      Includes redirection functions, the built in cd function, and the shell clean up function
  * ********************/
 
 #include <unistd.h>
@@ -18,6 +18,9 @@
 
 #include "wish.h"
 
+// Set in a forked copy of the shell, which exits without the shell's reports and clean up
+static int subshell = 0;
+
 
 /********************
  * builtIn_cd
@@ -36,6 +39,7 @@ void builtIn_cd(char *path)
         if(chdir(getenv("HOME")) != 0)
         {
             perror("Error - HOME");
+            return;
         }
     }
 
@@ -46,71 +50,12 @@ void builtIn_cd(char *path)
         if(chdir(path) != 0)
         {
             perror("Error - provided path");
+            return;
         }
     }
-}
-
-
-/*********************
- * expandProcessID
- * Description: Expands the $$ for the input string
- * -----
- * Input: argList - the pointer array to string that represents the input from the command line
- *        argString - The index of argList of which string holds the $$ variable
- *        argChar  the index of the argString that holds the exact location of $$
- * Output: NA - The $$ will be expanded in the passed in string to the processID
- * *******************/
 
-void expandProcessID(char ** argList, int argString, int argChar)
-{
-    // Two temporary buffers
-    char firstPart[ARG_SIZE];
-    char finalString[ARG_SIZE];
-
-    // Set these buffers to NULL
-    memset(firstPart, '\0', ARG_SIZE);
-    memset(finalString, '\0', ARG_SIZE);
-
-    // Copy the very first part of the string (up to the first instance of the provided $)
-    strncpy(firstPart, argList[argString], argChar);
-
-    // Build the string with the process ID next
-    sprintf(finalString, "%s%d", firstPart, getpid());
-
-    // Loop through the string characters after the last occurence of the $
-    // and place them into the finalString buffer, character by character
-    int k = 0;
-    argChar += 2;
-    while(argList[argString][argChar] != '\0')
-    {
-        // Loop until the finalString is at the end of it's buffer
-        if(finalString[k] != '\0')
-        {
-            k++;
-        }
-        // Then, place each character from the actual argList string into the final string buffer
-        else
-        {
-            finalString[k] = argList[argString][argChar];
-            // Increment the char in both finalString and argList[argString] (the two strings)
-            k++;
-            argChar++;
-        }
-    } 
-
-    // Free up the memory that was in the argList array
-    free(argList[argString]);
-
-    // ... and allocate some new memory for this string that is the size of finalString
-    argList[argString] = (char*)malloc((sizeof(char) * strlen(finalString)) + 1);
-
-    // Copy the final string into the new memory allocated for the argument list string
-    strcpy(argList[argString], finalString);
-
-    // Ensure the null terminator was copied over
-    argList[argString][strlen(finalString)] = '\0';
-
-    // The argList[argString] will now be the newly allocated string with the process ID expanded!
+    // The spawn server's helper has its own working directory
+    spawnServerMoved();
 }
 
 
@@ -118,145 +63,124 @@ void expandProcessID(char ** argList, int argString, int argChar)
  * cleanShell
  * Description: Kills any children that need to be cleaned up and de-allocates memory 
  * -----
- * Input: argList - Dynamically allocated memory that will be freed
- *        background_ps - the background process id array. Each child process will be cleaned up and killed
- *        numPs - the number of process IDs
+ * Input: arena - the command line arena, its memory will be freed
  * Output: NA - Shell is now ok to exit
  * ********************/
 
-void cleanShell(char **argList, pid_t *background_ps, int numPs)
+void cleanShell(struct arena *arena)
 {
-    // Kill all processes or jobs that the shell started
-    int i, counter = 0;
-
-    // Loop as long as the counter has not reached the number of background processes and not greater than
-    // the max number of background processes
-    while(counter != numPs && i < MAX_PS)
+    // Kill all processes or jobs that the shell started. Only live jobs are visited
+    int i, j;
+    for(i = 0; i < numJobs(); i++)
     {
-        if(background_ps[i] != -5)
+        struct job *job = jobAt(liveJob(i));
+        for(j = 0; j < job->numProcs; j++)
         {
-            // If valid PID, sent that process a SIGTERM signal
-            kill(background_ps[i], SIGTERM);
-            counter++;
+            if(!job->procs[j].done)
+                kill(job->procs[j].pid, SIGTERM);
         }
-
-        // Go to the next background process ID in the array
-        i++;
     }
     
-    // Call the clean up function for the dynamic memory in the argList array
-    cleanBuffer(argList);
+    // Return the memory of the command line arena to the heap
+    arenaFree(arena);
 }
 
 
-/*****************
- * redirectToNull
- * Description: Redirects both stdin and stdout to /dev/null
- * ------
+/********************
+ * enterSubshell
+ * Description: Prepares a forked copy of the shell to run commands of its own (a command
+ *      substitution, see substitute.c). The copy is not interactive, starts its commands
+ *      without the spawn server and exits without reporting or cleaning up for the shell
+ * -----
  * Input: NA
- * Output: Returns -1 if failed, otherwise, returns 0 if succesfully redirected stdin and stdout
- * ***************/
+ * Output: Returns -1 if the event loop could not be set up, otherwise 0
+ * ********************/
 
-int redirectToNull()
+int enterSubshell()
 {
-    // Open /dev/null for input and output
-    int nullFile_write = open("/dev/null", O_WRONLY);
-    int nullFile_read = open("/dev/null", O_RDONLY);
+    subshell = 1;
+    INTERACTIVE = 0;
 
-    // Check if opening worked
-    if(nullFile_write == -1 || nullFile_read == -1)
-    {
-        perror("Error with opening dev null\n");
-        return -1;
-    }
+    // The spawn server would make the commands children of the shell, not of this copy
+    if(SPAWN_MODE == SPAWN_SERVER)
+        SPAWN_MODE = SPAWN_POSIX;
 
-    // Attempt redirection of stdin  and dispaly error as needed
-    int result = dup2(nullFile_read, 0);
-    if(result == -1)
-    {
-        perror("Error with dup2 using stdout and 0\n");
-        return -1;
-    }
+    return resetEvents();
+}
 
-    // Attempt redirection of stdout now. Display error as needed
-    result = dup2(nullFile_write, 1);
-    if(result == -1)
+
+/********************
+ * exitShell
+ * Description: Terminates the shell, from the exit builtin or at the end of the input.
+ *      Displays the counters that were asked for first
+ * -----
+ * Input: arena - the command line arena
+ *        value - the exit value of the shell
+ * Output: NA - does not return
+ * ********************/
+
+void exitShell(struct arena *arena, int value)
+{
+    // The counters, the cache and the jobs belong to the shell, not to a copy of it
+    if(subshell)
     {
-        perror("Error with dup2 using stdin and 1\n");
-        return -1;
+        fflush(stdout);
+        _exit(value);
     }
 
-    // Close the file descriptors
-    close(nullFile_write);
-    close(nullFile_read);
+    // Report the arena counters if asked, to verify that steady-state lines do not touch the heap
+    if(getenv("WISH_ARENA_STATS") != 0)
+        fprintf(stderr, "arena: %lu allocations, %lu heap allocations\n", arena->allocs, arena->heapAllocs);
 
-    return 0;
+    // Report the script throughput (wish -t). Refer to buffer_io.c for details
+    inputReportStats();
+
+    // A script that ends with exit still gets its cache file. Refer to scriptcache.c for details
+    cacheFinish();
+
+    // Clean up shell and exit the program
+    cleanShell(arena);
+    exit(value);
 }
 
 
 /**********************
  * redirectStdin
- * Description: Redirects stdin to /dev/null
+ * Description: Plans the redirection of stdin to /dev/null
  * -----
- * Input: NA
- * Output: Returns -1 if failed, otherwise, returns 0 if successfully redirected stdin
+ * Input: plan - the spawn plan of the command being redirected
+ * Output: Returns -1 if failed, otherwise, returns 0 if successfully planned stdin
  * *********************/
 
-int redirectStdin()
+int redirectStdin(struct spawnPlan *plan)
 {
-    // Open the /dev/null file for reading
-    int myFile = open("/dev/null", O_RDONLY);
-
-    // Check if successfully opened
-    if(myFile == -1)
+    // Open the /dev/null file for reading. It becomes stdin in the child
+    if(planOpen(plan, 0, "/dev/null", O_RDONLY) == -1)
     {
         perror("Error with openeing file for stdin");
-        return -1;    
-    }
-
-    // Redirect stdin and dispaly error if failed
-    int result = dup2(myFile, 0);
-    if(result == -1)
-    {
-        perror("Error with dup2 in stdin\n");
         return -1;
     }
 
-    close(myFile);
-
     return 0;
 }
 
 
 /*********************
  * redirectStdout
- * Description: Redirects stdout to /dev/null
+ * Description: Plans the redirection of stdout to /dev/null
  * ------
- * Input: NA
- * Output: Returns -1 if failed, otherwise 0 if successfully redirected stdout
+ * Input: plan - the spawn plan of the command being redirected
+ * Output: Returns -1 if failed, otherwise 0 if successfully planned stdout
  * *******************/
 
-int redirectStdout()
+int redirectStdout(struct spawnPlan *plan)
 {
-    // Open dev/null for writing
-    int myFile = open("/dev/null", O_WRONLY);
-
-    // Check if error and dispaly error message
-    if(myFile == -1)
+    // Open dev/null for writing. It becomes stdout in the child
+    if(planOpen(plan, 1, "/dev/null", O_WRONLY) == -1)
     {
         perror("Error with opening stdout redirection file");
         return -1;
     }
 
-    // Redirect stdout and dispaly error as needed
-    int result = dup2(myFile, 1);
-    if(result == -1)
-    {
-        perror("Error with dup2 in stdout");
-        return -1;
-    }
-
-    close(myFile);
-
     return 0;
 }
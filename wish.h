@@ -5,23 +5,440 @@
  * Date: May 27th 2018
  *
  * Description: The macros used for the lengths of buffers and the various
- *      function headers from buffer_io.c and utility.c
+ *      function headers from buffer_io.c, lexer.c, expand.c, substitute.c, parser.c, ast.c,
+ *      exec.c, builtins.c, builtin_test.c, builtin_files.c, builtin_parallel.c, usage.c, trace.c,
+ *      utility.c, spawn.c, spawn_server.c, pathcache.c, scriptcache.c, events.c, serve.c, arena.c
+ *      and jobs.c
  * **********************/
 
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// Results of parseNextLine (see parser.c)
+#define PARSE_EOF   -1
+#define PARSE_EMPTY  0
+#define PARSE_OK     1
+#define PARSE_ERROR  2
+
+// Result of lexLine for a line the end of the input left inside quotes (see lexer.c)
+#define LEX_ERROR   -2
+
+// How a pipeline of a command list follows the previous one
+#define LIST_ALWAYS 0   // first pipeline, or after ; or &
+#define LIST_AND    1   // after &&: runs if STATUS is 0
+#define LIST_OR     2   // after ||: runs if STATUS is not 0
+
+// Compound commands (see ast.c)
+#define COMPOUND_IF    0
+#define COMPOUND_WHILE 1
+#define COMPOUND_UNTIL 2
+#define COMPOUND_FOR   3
+
+// The builtin of a command is looked up by name when it runs (see struct command)
+#define BUILTIN_UNRESOLVED -2
+
 // Program length macros
-#define LINE_SIZE 2048
-#define ARG_SIZE  512
-#define MAX_PS    256
+#define READ_SIZE 65536
+#define MAX_ACTIONS 16
+#define OUTPUT_BUFFER 4096
+#define HERE_PIPE_MAX 4096      // here-documents up to this size go through a pipe, a memfd above
+#define SHELL_FD_MIN 10         // the shell's own long-lived descriptors start here, 3 to 9 are left to exec
+
+// Spawn engines. The default may be chosen at compile time with -DWISH_SPAWN_DEFAULT=SPAWN_FORK
+// and overridden at runtime with the WISH_SPAWN environment variable (posix, fork or server)
+#define SPAWN_POSIX  0
+#define SPAWN_FORK   1
+#define SPAWN_SERVER 2
+
+#ifndef WISH_SPAWN_DEFAULT
+#define WISH_SPAWN_DEFAULT SPAWN_POSIX
+#endif
+
+// Trace event types (see trace.c)
+#define TRACE_FORK     0    // a child was started: value is the spawn engine, -1 for an output feeder,
+                            // or -2 for a command substitution
+#define TRACE_EXEC     1    // the child called exec (pid -1 and value errno if it could not start)
+#define TRACE_REDIRECT 2    // a file was opened for a command: value is the descriptor it becomes
+#define TRACE_EXIT     3    // a child was reaped: value is its wait status
+#define TRACE_SIGNAL   4    // the shell received a signal: pid is the sender, value the signal
+
+#define TRACE_DETAIL   96
+#define TRACE_MAGIC    0x48534957u      // "WISH"
+#define TRACE_VERSION  1
+#define TRACE_BUSY     UINT64_MAX
+
+// Records an event if tracing is on, without a call otherwise
+#define TRACE(type, time, pid, value, detail) \
+    do { if(TRACING) traceEvent(type, time, pid, value, detail); } while(0)
+
+// One event of the trace. seq is 0 while unused, TRACE_BUSY while being written
+struct traceRecord
+{
+    uint64_t seq;
+    int64_t time;           // CLOCK_MONOTONIC nanoseconds
+    int32_t type;
+    int32_t pid;
+    int32_t value;
+    int32_t reserved;
+    char detail[TRACE_DETAIL];
+};
+
+// The shared memory trace ring: a header followed by a power of two number of records
+struct traceRing
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    int32_t writerPid;
+    uint32_t reserved;
+    uint64_t head;          // sequence number of the last record claimed
+    _Alignas(64) struct traceRecord records[];
+};
+
+extern int TRACING;
+
+// A file action applied in the child: srcFd (opened by the shell) becomes fd
+struct fileAction
+{
+    int fd;
+    int srcFd;
+    int owned;      // 1 if the plan opened srcFd and closes it, 0 for the caller's pipe ends
+};
+
+// What the target of a redirection is
+#define REDIRECT_FILE       0   // a file name: <, > and >>
+#define REDIRECT_HEREDOC    1   // the body of a here-document, expanded with expandHere: <<
+#define REDIRECT_HERESTRING 2   // a word given as input, with a newline added: <<<
+#define REDIRECT_DUP        3   // the number of a file descriptor that fd becomes a copy of: <& and >&
+
+// A redirection found on the command line: target is opened with flags and becomes fd.
+// target is the word as it was typed, it is expanded when the command runs
+struct redirect
+{
+    int fd;
+    int flags;
+    int kind;       // one of the REDIRECT_ values
+    char *target;
+};
+
+// One command of a pipeline. The words still have their quotes, see expand.c
+struct command
+{
+    char **words;       // NULL terminated
+    int numWords;
+    int numRedirects;
+    int builtin;        // builtin index found when compiled, -1 for a program, or BUILTIN_UNRESOLVED
+    int numSlots;       // words that need expansion, -1 if they were not counted
+    struct redirect redirects[MAX_ACTIONS];
+    struct compound *compound;  // an if, while, until or for run in a copy of the shell, its
+                                // words are only redirections. NULL for a simple command
+};
+
+// Commands connected with the | operator. See parser.c and exec.c
+struct pipeline
+{
+    struct command *commands;
+    int numCommands;
+    int background;
+    int timed;          // 1 if the pipeline was prefixed with `time`
+    int connector;      // how it follows the previous pipeline of its list, one of the LIST_ values
+    struct compound *compound;  // an if, while, until or for instead of commands, NULL otherwise
+};
+
+// The pipelines of a command line, separated by ;, &, && and || (see parser.c)
+struct commandList
+{
+    struct pipeline *pipelines;
+    int numPipelines;
+};
+
+// A compiled if, while, until or for. It is run as many times as needed without parsing it
+// again. An elif is an if alone in orElse
+struct compound
+{
+    int type;
+    struct commandList cond;    // if, while and until
+    struct commandList body;    // after then or do
+    struct commandList orElse;  // after else
+    char *var;                  // the variable of a for
+    char **words;               // the words of a for, with their quotes
+    int numWords;
+};
+
+// Where a builtin writes: to fd through a small buffer, or into memory when fd is -1 (see exec.c)
+struct output
+{
+    int fd;
+    char *data;
+    size_t len;
+    size_t cap;
+    char buffer[OUTPUT_BUFFER];
+};
+
+// A builtin being run: its expanded words and the descriptors it reads and writes (see builtins.c)
+struct builtinCall
+{
+    struct arena *arena;
+    char **argList;
+    int numArgs;
+    int in;
+    struct output *out;
+    int inPipeline;     // 1 if the command is part of a pipeline of several commands
+    struct spawnPlan *plan;     // the redirections of the command, opened. NULL if it has none
+};
+
+// Everything needed to launch one external command
+struct spawnPlan
+{
+    char **argv;
+    int background;
+    int waitExec;       // 1 to return only once the child has called exec (fork engine)
+    int numActions;
+    struct fileAction actions[MAX_ACTIONS];
+};
+
+extern int SPAWN_MODE;
+extern sigset_t CHILD_MASK;
+
+// Shell state shared with the event loop (defined in wish.c)
+extern int STATUS;
+extern int BACK_STATUS;
+extern int TSTP_FLAG;
+extern int INTERACTIVE;
+extern pid_t LAST_BG_PID;
+
+// Set in a session of the command server (see serve.c)
+extern int SERVING;
+
+// Resource usage of a measured command. See usage.c
+struct usage
+{
+    long long start;            // CLOCK_MONOTONIC nanoseconds when the command started
+    long long wall;             // nanoseconds
+    long long user;             // CPU microseconds, the processes and the shell's share
+    long long sys;
+    long maxRss;                // KB, the largest process
+    long volSwitches;
+    long involSwitches;
+    long long spawnTotal;       // nanoseconds from the spawn calls to the execs
+    long long spawnMax;
+    int numSpawned;
+    int valid;
+    struct rusage shellStart;   // the shell's own usage when the command started
+};
+
+extern struct usage LAST_USAGE;
+
+// One process of a background job, or of the foreground pipeline
+struct jobProc
+{
+    pid_t pid;
+    int pidfd;      // watches the process in the event loop, -1 if SIGCHLD is used instead
+    int done;       // 1 once the process has been reaped
+    int status;     // wait status, once it has been reaped
+};
+
+// A background job: every process of a pipeline. See jobs.c
+struct job
+{
+    pid_t pid;              // the process reported to the user, the last one of the pipeline
+    struct jobProc *procs;
+    int numProcs;
+    int remaining;          // processes not reaped yet
+    int status;             // wait status of the last process
+    int livePos;            // position in the live job list, -1 if the slot is free
+    int nextFree;           // next slot in the free list
+};
+
+// A chunk of arena memory. See arena.c
+struct arenaChunk
+{
+    struct arenaChunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+};
+
+// A position in an arena that it can be rewound to
+struct arenaMark
+{
+    struct arenaChunk *chunk;
+    size_t used;
+};
+
+// Bump allocator for everything that lives for a single command line
+struct arena
+{
+    struct arenaChunk *head;
+    struct arenaChunk *current;
+    void *last;                   // most recent allocation, may grow in place
+    unsigned long allocs;         // allocations served by the arena
+    unsigned long heapAllocs;     // chunks requested from malloc
+};
 
 // Functions found in buffer_io.c
-void getCommandLine(int *inNum, char **argList);
-void cleanBuffer(char **argList);
+char **getCommandLine(struct arena *arena, int *inNum);
+char **getContinuationLine(struct arena *arena, int *inNum);
+int inputOpenScript(const char *path);
+void inputOpenBuffer(char *data, size_t len);
+void inputOpenString(char *commands);
+void inputTrackStats();
+void inputReportStats();
+void cleanBuffer(struct arena *arena);
+void inputOpenStream(int fd);
+int inputStream();
+int inputPending();
+int inputPeek(char **data);
+int inputFill(char **data, size_t len);
+void inputConsume(int numBytes);
+char **lexString(struct arena *arena, char *text, size_t len, int *inNum);
+
+// Functions found in lexer.c
+int lexLine(struct arena *arena, char ***wordsOut);
+void lexerQuiet(int on);
+
+// Functions found in expand.c
+void initExpand();
+int wordIsLiteral(const char *word);
+char *expandWord(struct arena *arena, char *word);
+char *expandHere(struct arena *arena, char *text, size_t *len);
+int expandWords(struct arena *arena, char **argList, int numArgs);
+
+// Functions found in substitute.c
+char *substitute(struct arena *arena, const char *text, size_t len, size_t *outLen);
+
+// Functions found in parser.c
+int parseCommand(struct command *cmd);
+int parsePipeline(struct arena *arena, char **words, int numWords, struct pipeline *pipeline);
+int parseList(struct arena *arena, char **words, int numWords, struct commandList *list);
+int parseNextLine(struct arena *arena, struct commandList *list);
+int listOperator(const char *word);
+const char *redirectOperator(const char *word);
+
+// Functions found in ast.c
+int needsCompiler(char **words, int numWords);
+int compileLine(struct arena *arena, char **words, int numWords, struct commandList *list);
+void runCompound(struct arena *arena, struct compound *compound);
+
+// Functions found in exec.c
+void initExec();
+void runPipeline(struct arena *arena, struct pipeline *pipeline);
+void runList(struct arena *arena, struct commandList *list);
+void outInit(struct output *out, int fd);
+void outWrite(struct output *out, const char *data, size_t len);
+void outPrintf(struct output *out, const char *format, ...);
+void outFlush(struct output *out);
+void outRelease(struct output *out);
+
+// Functions found in builtins.c
+int findBuiltin(const char *name);
+int lookupBuiltin(const char *name);
+int builtinEnabled(int index);
+int builtinKeepsStatus(int index);
+int builtinIsUtility(int index);
+int builtinStreams(int index);
+int builtinRedirectsShell(int index);
+int runBuiltin(int index, struct builtinCall *call);
+
+// Functions found in builtin_test.c
+int builtIn_test(struct builtinCall *call);
+
+// Functions found in builtin_files.c
+int builtIn_cat(struct builtinCall *call);
+int builtIn_cp(struct builtinCall *call);
+int builtIn_tee(struct builtinCall *call);
+
+// Functions found in builtin_parallel.c
+int builtIn_parallel(struct builtinCall *call);
+
+// Functions found in usage.c
+long long clockNow();
+void usageStart(struct usage *usage);
+void usageSpawned(struct usage *usage, long long nanos);
+void usageAdd(struct rusage *total, struct rusage *add);
+void usageFinish(struct usage *usage, struct rusage *children);
+void usagePrint(struct output *out, struct usage *usage);
+
+// Functions found in trace.c
+void initTrace();
+size_t traceRingSize(unsigned capacity);
+int traceFormat(struct traceRecord *record, char *buffer, size_t size);
+void traceEvent(int type, long long time, pid_t pid, int value, const char *detail);
 
 // Functions found in utility.c
 void builtIn_cd(char *path);
-void cleanShell(char **argList, pid_t *background_ps, int numPs);
-void expandProcessID(char **argList, int argString, int argChar);
+void cleanShell(struct arena *arena);
+int enterSubshell();
+void exitShell(struct arena *arena, int value);
+
+int redirectStdin(struct spawnPlan *plan);
+int redirectStdout(struct spawnPlan *plan);
+
+// Functions found in spawn.c
+void initSpawnMode();
+void planInit(struct spawnPlan *plan, char **argv, int background);
+int planOpen(struct spawnPlan *plan, int fd, const char *path, int flags);
+int planHere(struct spawnPlan *plan, int fd, const char *data, size_t len);
+int planDup(struct spawnPlan *plan, int fd, int srcFd);
+int planHas(struct spawnPlan *plan, int fd);
+int planSource(struct spawnPlan *plan, int fd);
+void planClose(struct spawnPlan *plan);
+pid_t spawnCommand(struct spawnPlan *plan);
+
+// Functions found in serve.c
+void serveSocket(const char *path);
+void serveLine();
+
+// Functions found in spawn_server.c
+int startSpawnServer();
+void restartSpawnServer();
+void spawnServerMoved();
+pid_t spawnServer(struct spawnPlan *plan, const char *path);
+
+// Functions found in pathcache.c
+const char *pathLookup(const char *name);
+void pathForget(const char *name);
+void pathClear();
+void pathWarm();
+int builtIn_hash(char **argList, struct output *out);
+
+// Functions found in scriptcache.c
+int cacheLoad(const char *script, struct stat *info);
+int cacheNextLine(struct arena *arena, char ***wordsOut, int *numBytes);
+void cacheStart(const char *script, struct stat *info);
+void cacheRecord(char **words, int numWords, int numBytes);
+void cacheFinish();
+void cacheDrop();
+
+// Functions found in events.c
+int initEvents();
+int watchChild(int slot, int proc, pid_t pid);
+void waitForInput();
+void waitForeground(pid_t *pids, int numPids, int setStatus, struct rusage *usage);
+int waitJob(pid_t pid, int *status);
+int interruptPending(int poll);
+int waitReadable(int fd);
+void interruptClear();
+int resetEvents();
+
+// Functions found in arena.c
+void arenaInit(struct arena *arena);
+void *arenaAlloc(struct arena *arena, size_t size);
+void *arenaRealloc(struct arena *arena, void *ptr, size_t oldSize, size_t newSize);
+char *arenaStrndup(struct arena *arena, const char *str, size_t len);
+void arenaMark(struct arena *arena, struct arenaMark *mark);
+void arenaRewind(struct arena *arena, struct arenaMark *mark);
+void arenaReset(struct arena *arena);
+void arenaFree(struct arena *arena);
 
-int redirectToNull();
-int redirectStdin();
-int redirectStdout();
+// Functions found in jobs.c
+int jobAdd(pid_t *pids, int numPids);
+int jobFind(pid_t pid);
+void jobRemove(int slot);
+struct job *jobAt(int slot);
+int numJobs();
+int liveJob(int i);
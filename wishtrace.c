@@ -0,0 +1,179 @@
+/*********************
+ * Author: John McBride
+ * Email: mcbridej@oregonstate.edu
+ * CS 344 - Operating systems
+ * Date: May 27th 2018
+ *
+ * Description: Reader of the trace ring of a wish shell started with WISH_TRACE=shm or
+ *      WISH_TRACE=shm:NAME (see trace.c). Prints the events in the ring as JSON lines, the
+ *      same format as a WISH_TRACE file. Events overwritten before they could be read are
+ *      reported as one "lost" line with their number. The shell is never slowed down: the
+ *      reader only maps the ring read-only and copies records out of it
+ *
+ *      Usage: wishtrace [-f] [-u] name | pid
+ *          -f  follow: keep printing new events until the shell exits
+ *          -u  remove the ring once it is read
+ * ********************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wish.h"
+
+// How long to sleep between two looks at the ring when following it
+#define FOLLOW_NANOS 50000000L
+
+
+/********************
+ * usage
+ * Description: Displays how to start the reader and exits
+ * -----
+ * Input: NA
+ * Output: NA - does not return
+ * ******************/
+
+static void usage()
+{
+    fprintf(stderr, "usage: wishtrace [-f] [-u] name | pid\n");
+    exit(2);
+}
+
+
+/********************
+ * readRing
+ * Description: Prints the records published since the last call
+ * -----
+ * Input: ring - the mapped ring
+ *        next - the sequence number of the next record to print, advanced
+ * Output: Returns the number of lines printed
+ * ******************/
+
+static unsigned long readRing(struct traceRing *ring, uint64_t *next)
+{
+    char line[64 + 6 * TRACE_DETAIL];
+    struct traceRecord copy;
+    unsigned long seen = 0;
+
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    // Records older than one lap have been written over
+    if(head > ring->capacity && *next <= head - ring->capacity)
+    {
+        printf("{\"event\":\"lost\",\"value\":%llu}\n", (unsigned long long)(head - ring->capacity + 1 - *next));
+        *next = head - ring->capacity + 1;
+        seen++;
+    }
+
+    for(; *next <= head; (*next)++)
+    {
+        struct traceRecord *record = &ring->records[(*next - 1) & (ring->capacity - 1)];
+
+        uint64_t before = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+
+        // Claimed but not published yet: read it next time
+        if(before < *next || before == TRACE_BUSY)
+            break;
+
+        memcpy(&copy, record, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t after = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+
+        // Written over while it was copied
+        if(before != *next || after != *next)
+        {
+            printf("{\"event\":\"lost\",\"value\":1}\n");
+            seen++;
+            continue;
+        }
+
+        fwrite(line, 1, traceFormat(&copy, line, sizeof(line)), stdout);
+        seen++;
+    }
+
+    fflush(stdout);
+    return seen;
+}
+
+
+/********************
+ * Main method
+ * Description: Maps the ring and prints it, once or until the shell exits
+ * -----
+ * Input: argv - the options and the ring name (or the pid of the shell)
+ * Output: Returns 0, or 1 if the ring could not be read
+ * ******************/
+
+int main(int argc, char *argv[])
+{
+    int option, follow = 0, unlinkRing = 0;
+    char name[256];
+    struct stat info;
+    struct timespec pause = {0, FOLLOW_NANOS};
+    uint64_t next = 1;
+
+    while((option = getopt(argc, argv, "fu")) != -1)
+    {
+        if(option == 'f')
+            follow = 1;
+        else if(option == 'u')
+            unlinkRing = 1;
+        else
+            usage();
+    }
+
+    if(optind != argc - 1)
+        usage();
+
+    // A number is the pid of a shell started with WISH_TRACE=shm
+    const char *arg = argv[optind];
+    if(strspn(arg, "0123456789") == strlen(arg))
+        snprintf(name, sizeof(name), "/wish-trace.%s", arg);
+    else
+        snprintf(name, sizeof(name), "%s%s", arg[0] == '/' ? "" : "/", arg);
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if(fd == -1 || fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(struct traceRing))
+    {
+        fprintf(stderr, "wishtrace: %s: %s\n", name, fd == -1 ? strerror(errno) : "not a trace ring");
+        return 1;
+    }
+
+    struct traceRing *ring = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED || ring->magic != TRACE_MAGIC || ring->version != TRACE_VERSION ||
+        ring->recordSize != sizeof(struct traceRecord) || traceRingSize(ring->capacity) > (size_t)info.st_size)
+    {
+        fprintf(stderr, "wishtrace: %s: not a trace ring\n", name);
+        return 1;
+    }
+
+    readRing(ring, &next);
+
+    // Keep reading while the shell is alive, then once more for its last events
+    while(follow)
+    {
+        int alive = kill(ring->writerPid, 0) == 0 || errno == EPERM;
+
+        if(readRing(ring, &next) == 0)
+        {
+            if(!alive)
+                break;
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    if(unlinkRing)
+        shm_unlink(name);
+
+    return 0;
+}